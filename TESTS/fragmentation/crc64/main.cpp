@@ -0,0 +1,99 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "mbed.h"
+#include <greentea-client/test_env.h>
+#include <utest/utest.h>
+#include <unity/unity.h>
+
+using namespace utest::v1;
+
+#include "FragmentationCrc.h"
+
+// Same corpus as the update client hash tests
+#include "../../../update-client-hub-common/TESTS/tests/alice.h"
+
+// CRC64 of alice, same polynomial as FragmentationCrc64
+#define ALICE_CRC64         0x745528fd8ed545fbULL
+
+#define CHECK_SIZE          300
+
+static uint8_t check_buffer[CHECK_SIZE + 8];
+
+static void check_engine(frag_crc64_fn engine, const char* name) {
+    TEST_ASSERT_TRUE_MESSAGE(engine(0, alice, sizeof(alice)) == ALICE_CRC64, name);
+
+    for (size_t ix = 0; ix < sizeof(check_buffer); ix++) {
+        check_buffer[ix] = (uint8_t)(ix * 29 + 11);
+    }
+
+    // every length up to a few folding blocks, misaligned, and continuing from a running CRC
+    for (size_t len = 0; len <= CHECK_SIZE; len++) {
+        for (size_t offset = 0; offset < 8; offset += 3) {
+            uint64_t expected = frag_crc64_bitwise(0x0123456789abcdefULL, check_buffer + offset, len);
+            TEST_ASSERT_TRUE_MESSAGE(engine(0x0123456789abcdefULL, check_buffer + offset, len) == expected, name);
+        }
+    }
+}
+
+void test_table_engine() {
+    check_engine(frag_crc64_table, "table");
+}
+
+void test_selected_engine() {
+    check_engine(frag_crc64_update, frag_crc64_engine_name());
+}
+
+static int bench_engine(frag_crc64_fn engine, uint64_t* crc) {
+    Timer t;
+    t.start();
+    *crc = engine(0, alice, sizeof(alice));
+    t.stop();
+    return t.read_us();
+}
+
+void test_benchmark() {
+    uint64_t crc;
+
+    int bitwise_us = bench_engine(frag_crc64_bitwise, &crc);
+    int table_us = bench_engine(frag_crc64_table, &crc);
+    int selected_us = bench_engine(frag_crc64_update, &crc);
+
+    printf("CRC64 of %u bytes (alice.h):\n", sizeof(alice));
+    printf("  bitwise: %d us\n", bitwise_us);
+    printf("  table:   %d us\n", table_us);
+    printf("  %s: %d us (selected)\n", frag_crc64_engine_name(), selected_us);
+
+    TEST_ASSERT_TRUE(crc == ALICE_CRC64);
+}
+
+Case cases[] = {
+    Case("table engine matches bitwise", test_table_engine),
+    Case("selected engine matches bitwise", test_selected_engine),
+    Case("benchmark alice.h", test_benchmark)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(2 * 60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
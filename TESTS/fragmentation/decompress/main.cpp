@@ -0,0 +1,235 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-decompress"
+#include "../fragmentation_test_setup.h"
+#include "FragmentationVerifier.h"
+#include "FragmentationDecompress.h"
+
+#define DATA_SIZE           (8 * 1024)
+#define COMPRESSED_MAX      (DATA_SIZE + 1024)
+#define WINDOW_BITS         9
+#define COMPRESSED_OFFSET   (64 * 528)
+#define TARGET_OFFSET       MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET
+
+static uint8_t data[DATA_SIZE];
+static uint8_t compressed[COMPRESSED_MAX];
+static uint8_t window[1 << WINDOW_BITS];
+static uint8_t read_buffer[64];
+static uint8_t verify_buffer[128];
+
+static size_t put_number(uint8_t* out, uint32_t value) {
+    size_t len = 0;
+    do {
+        out[len++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+    return len;
+}
+
+static size_t put_length(uint8_t* out, uint32_t len) {
+    size_t n = 0;
+    for (len -= 15; len >= 255; len -= 255) out[n++] = 255;
+    out[n++] = len;
+    return n;
+}
+
+/**
+ * Greedy compressor in the format of test-fw/compress (which is lazy and hashed, but decodes the same way)
+ */
+static size_t compress(const uint8_t* in, size_t size, uint8_t window_bits) {
+    size_t window_size = 1 << window_bits;
+    size_t out = put_number(compressed, size);
+    compressed[out++] = window_bits;
+
+    size_t pos = 0, literal_start = 0;
+    while (true) {
+        size_t best_len = 0, best_offset = 0;
+        for (size_t offset = 1; offset <= window_size && offset <= pos; offset++) {
+            size_t len = 0;
+            while (pos + len < size && in[pos + len - offset] == in[pos + len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                best_offset = offset;
+            }
+        }
+
+        if (pos < size && best_len < 4) {
+            pos++;
+            continue;
+        }
+
+        size_t literal_len = pos - literal_start;
+        size_t match_len = best_len >= 4 ? best_len - 4 : 0;
+        compressed[out++] = ((literal_len < 15 ? literal_len : 15) << 4) | (match_len < 15 ? match_len : 15);
+        if (literal_len >= 15) out += put_length(compressed + out, literal_len);
+        memcpy(compressed + out, in + literal_start, literal_len);
+        out += literal_len;
+
+        if (pos == size) break;
+
+        compressed[out++] = best_offset & 0xff;
+        compressed[out++] = best_offset >> 8;
+        if (match_len >= 15) out += put_length(compressed + out, match_len);
+
+        pos += best_len;
+        literal_start = pos;
+    }
+
+    return out;
+}
+
+static void write_compressed(size_t size) {
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(compressed, COMPRESSED_OFFSET, size));
+}
+
+static FragmentationDecompressResult inflate(size_t compressed_size, size_t target_max, size_t* out_size) {
+    FragmentationDecompress decompress(&fbd, window, sizeof(window), read_buffer, sizeof(read_buffer));
+    return decompress.inflate(COMPRESSED_OFFSET, compressed_size, TARGET_OFFSET, target_max, out_size);
+}
+
+void test_inflate() {
+    size_t compressed_size = compress(data, DATA_SIZE, WINDOW_BITS);
+    write_compressed(compressed_size);
+
+    size_t out_size = 0;
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_OK, inflate(compressed_size, DATA_SIZE, &out_size));
+    TEST_ASSERT_EQUAL(DATA_SIZE, out_size);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    // the SHA256 over the output in flash is what the signature is checked against
+    uint64_t crc;
+    unsigned char sha256[32], expected_sha256[32];
+    FragmentationVerifier verifier(&fbd, verify_buffer, sizeof(verify_buffer));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.verify(TARGET_OFFSET, out_size, NULL, 0, &crc, sha256));
+    mbedtls_sha256(data, DATA_SIZE, expected_sha256, 0);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_sha256, sha256, 32);
+
+    printf("Compressed %u bytes to %u bytes\n", DATA_SIZE, compressed_size);
+}
+
+void test_inflate_edges() {
+    size_t out_size;
+
+    // nothing but literals
+    size_t compressed_size = compress(data, 20, WINDOW_BITS);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_OK, inflate(compressed_size, DATA_SIZE, &out_size));
+    TEST_ASSERT_EQUAL(20, out_size);
+
+    // empty
+    compressed_size = compress(data, 0, WINDOW_BITS);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_OK, inflate(compressed_size, DATA_SIZE, &out_size));
+    TEST_ASSERT_EQUAL(0, out_size);
+
+    // one byte repeated, matches that overlap what they produce
+    static uint8_t same[2000];
+    memset(same, 0x5a, sizeof(same));
+    compressed_size = compress(same, sizeof(same), WINDOW_BITS);
+    TEST_ASSERT_TRUE(compressed_size < 32);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_OK, inflate(compressed_size, DATA_SIZE, &out_size));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    for (size_t offset = 0; offset < sizeof(same); offset += sizeof(verify_buffer)) {
+        size_t len = sizeof(same) - offset < sizeof(verify_buffer) ? sizeof(same) - offset : sizeof(verify_buffer);
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.read(verify_buffer, TARGET_OFFSET + offset, len));
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(same, verify_buffer, len);
+    }
+}
+
+void test_reject_corrupt() {
+    size_t out_size;
+    size_t compressed_size = compress(data, DATA_SIZE, WINDOW_BITS);
+
+    // truncated
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_CORRUPT, inflate(compressed_size - 1, DATA_SIZE, &out_size));
+
+    // trailing data
+    compressed[compressed_size] = 0;
+    write_compressed(compressed_size + 1);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_CORRUPT, inflate(compressed_size + 1, DATA_SIZE, &out_size));
+
+    // a match before the start of the output: 4 bytes, a literal and a match at offset 2
+    const uint8_t before_start[] = { 4, WINDOW_BITS, 0x10, 0xaa, 0x02, 0x00 };
+    memcpy(compressed, before_start, sizeof(before_start));
+    write_compressed(sizeof(before_start));
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_CORRUPT, inflate(sizeof(before_start), DATA_SIZE, &out_size));
+
+    // longer than the size in the header
+    const uint8_t too_long[] = { 4, WINDOW_BITS, 0x10, 0xaa, 0x01, 0x00, 0x00 };
+    memcpy(compressed, too_long, sizeof(too_long));
+    write_compressed(sizeof(too_long));
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_CORRUPT, inflate(sizeof(too_long), DATA_SIZE, &out_size));
+}
+
+void test_reject_window() {
+    size_t out_size;
+    size_t compressed_size = compress(data, 1024, WINDOW_BITS + 1);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_WINDOW, inflate(compressed_size, DATA_SIZE, &out_size));
+}
+
+void test_reject_too_large() {
+    size_t out_size;
+    size_t compressed_size = compress(data, DATA_SIZE, WINDOW_BITS);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_TOO_LARGE, inflate(compressed_size, DATA_SIZE - 1, &out_size));
+}
+
+void test_throughput() {
+    size_t compressed_size = compress(data, DATA_SIZE, WINDOW_BITS);
+    write_compressed(compressed_size);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    Timer t;
+    t.start();
+    size_t out_size;
+    TEST_ASSERT_EQUAL(FRAG_DECOMPRESS_OK, inflate(compressed_size, DATA_SIZE, &out_size));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+    t.stop();
+
+    printf("Decompressed in %d ms (%d KB/s), %u bytes of buffers\n", t.read_ms(),
+        t.read_us() ? (int)((uint64_t)out_size * 1000000 / t.read_us() / 1024) : 0,
+        sizeof(window) + sizeof(read_buffer));
+}
+
+Case cases[] = {
+    Case("decompress", test_inflate),
+    Case("decompress literals, empty and overlapping matches", test_inflate_edges),
+    Case("reject corrupt data", test_reject_corrupt),
+    Case("reject a window that is too large", test_reject_window),
+    Case("reject output that does not fit", test_reject_too_large),
+    Case("throughput", test_throughput)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    // something like code: short runs that repeat with small changes
+    for (size_t ix = 0; ix < DATA_SIZE; ix++) {
+        data[ix] = (uint8_t)((ix % 48) < 24 ? (ix % 24) * 3 : (ix >> 6) ^ (ix % 7));
+    }
+
+    return fragmentation_test_setup(number_of_cases, 2 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
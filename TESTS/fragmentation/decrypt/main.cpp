@@ -0,0 +1,172 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-decrypt"
+#include "../fragmentation_test_setup.h"
+#include "update_params.h"
+#include "FragmentationVerifier.h"
+
+// AES-256-CTR test vector of the update client: ecila is alice encrypted with key and nc
+#include "../../../update-client-hub-common/TESTS/tests/alice.h"
+
+// Only the start of alice.h, so the ciphertext and the plaintext both fit in the flash of the L151
+#define FIRMWARE_SIZE       (16 * 1024)
+#define PACKAGE_SIZE        (FIRMWARE_SIZE + FOTA_SIGNATURE_LENGTH)
+#define PACKAGE_OFFSET      MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET
+
+static uint8_t buffer[528];
+static arm_uc_cipherHandle_t cipher;
+static uint8_t cipher_iv[16];
+
+/**
+ * Ciphertext followed by a trailer, as it is in flash after reception
+ */
+static void write_package(UpdateSignature_t* trailer) {
+    for (size_t offset = 0; offset < FIRMWARE_SIZE; offset += sizeof(buffer)) {
+        size_t len = FIRMWARE_SIZE - offset < sizeof(buffer) ? FIRMWARE_SIZE - offset : sizeof(buffer);
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(ecila + offset, PACKAGE_OFFSET + offset, len));
+    }
+
+    memset(trailer, 0, sizeof(UpdateSignature_t));
+    ((uint8_t*)&trailer->diff_info)[0] = FOTA_DIFF_FLAG_ENCRYPTED;
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(trailer, PACKAGE_OFFSET + FIRMWARE_SIZE, FOTA_SIGNATURE_LENGTH));
+}
+
+static void setup_cipher() {
+    // the counter block is updated while decrypting
+    memcpy(cipher_iv, nc, sizeof(cipher_iv));
+
+    arm_uc_buffer_t key_buffer = { sizeof(key), sizeof(key), (uint8_t*)key };
+    arm_uc_buffer_t iv_buffer = { sizeof(cipher_iv), sizeof(cipher_iv), cipher_iv };
+    TEST_ASSERT_EQUAL(ARM_UC_CU_ERR_NONE, ARM_UC_cryptoDecryptSetup(&cipher, &key_buffer, &iv_buffer, 256).error);
+}
+
+/**
+ * Decrypt with a read buffer of `chunk_size`, sizes that are not a multiple of the AES block carry the keystream over
+ */
+static void check_decrypt(size_t chunk_size) {
+    UpdateSignature_t written, trailer;
+    write_package(&written);
+    setup_cipher();
+
+    uint64_t crc;
+    unsigned char sha256[32];
+    FragmentationVerifier verifier(&fbd, buffer, chunk_size);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.start(PACKAGE_OFFSET, PACKAGE_SIZE, &trailer, FOTA_SIGNATURE_LENGTH, &cipher));
+
+    // nothing can be hashed before it's decrypted
+    TEST_ASSERT_FALSE(verifier.update_at(PACKAGE_OFFSET, ecila, chunk_size));
+
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.finish(&crc, sha256));
+    ARM_UC_cryptoDecryptFinish(&cipher, NULL);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    // CRC64 over what was sent, SHA256 over the plaintext
+    uint64_t expected_crc = frag_crc64_update(frag_crc64_update(0, ecila, FIRMWARE_SIZE), (uint8_t*)&written, FOTA_SIGNATURE_LENGTH);
+    TEST_ASSERT_TRUE(crc == expected_crc);
+
+    unsigned char expected_sha256[32];
+    mbedtls_sha256(alice, FIRMWARE_SIZE, expected_sha256, 0);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_sha256, sha256, 32);
+
+    // the trailer is not encrypted
+    TEST_ASSERT_EQUAL_UINT8_ARRAY((uint8_t*)&written, (uint8_t*)&trailer, FOTA_SIGNATURE_LENGTH);
+
+    // the plaintext replaced the ciphertext in flash
+    for (size_t offset = 0; offset < PACKAGE_SIZE; offset += sizeof(buffer)) {
+        size_t len = PACKAGE_SIZE - offset < sizeof(buffer) ? PACKAGE_SIZE - offset : sizeof(buffer);
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.read(buffer, PACKAGE_OFFSET + offset, len));
+
+        size_t fw_len = offset >= FIRMWARE_SIZE ? 0 : (FIRMWARE_SIZE - offset < len ? FIRMWARE_SIZE - offset : len);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(alice + offset, buffer, fw_len);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY((uint8_t*)&written + (offset + fw_len - FIRMWARE_SIZE), buffer + fw_len, len - fw_len);
+    }
+}
+
+void test_decrypt_aligned() {
+    check_decrypt(128);
+}
+
+void test_decrypt_unaligned() {
+    check_decrypt(17);
+    check_decrypt(sizeof(buffer));
+}
+
+static int sweep(arm_uc_cipherHandle_t* c) {
+    UpdateSignature_t written, trailer;
+    write_package(&written);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    uint64_t crc;
+    unsigned char sha256[32];
+    FragmentationVerifier verifier(&fbd, buffer, 128);
+
+    // includes flushing the plaintext out of the page buffer
+    Timer t;
+    t.start();
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.start(PACKAGE_OFFSET, PACKAGE_SIZE, &trailer, FOTA_SIGNATURE_LENGTH, c));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.finish(&crc, sha256));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+    t.stop();
+
+    return t.read_us();
+}
+
+void test_throughput() {
+    int plain_us = sweep(NULL);
+
+    setup_cipher();
+    int decrypt_us = sweep(&cipher);
+    ARM_UC_cryptoDecryptFinish(&cipher, NULL);
+
+    // AES-CTR alone, in RAM
+    setup_cipher();
+    Timer t;
+    t.start();
+    for (size_t offset = 0; offset < FIRMWARE_SIZE; offset += 128) {
+        arm_uc_buffer_t out = { 128, 0, buffer };
+        ARM_UC_cryptoDecryptUpdate(&cipher, ecila + offset, 128, &out);
+    }
+    t.stop();
+    ARM_UC_cryptoDecryptFinish(&cipher, NULL);
+    int aes_us = t.read_us();
+
+    printf("Sweep over %u bytes (128 byte chunks):\n", PACKAGE_SIZE);
+    printf("  verify:             %d us (%d KB/s)\n", plain_us, plain_us ? (int)((uint64_t)PACKAGE_SIZE * 1000000 / plain_us / 1024) : 0);
+    printf("  verify and decrypt: %d us (%d KB/s)\n", decrypt_us, decrypt_us ? (int)((uint64_t)PACKAGE_SIZE * 1000000 / decrypt_us / 1024) : 0);
+    printf("  AES-CTR in RAM:     %d us (%d KB/s)\n", aes_us, aes_us ? (int)((uint64_t)FIRMWARE_SIZE * 1000000 / aes_us / 1024) : 0);
+#if !ARM_UC_USE_PAL_CRYPTO
+    // compare the engines (ARM_UC_AES_CTR_ENGINE) on the target before picking the T-table one, it costs flash
+    printf("  AES-CTR engine:     %s\n", arm_uc_aes_ctr_engine_name());
+#endif
+}
+
+Case cases[] = {
+    Case("decrypt in place, 128 byte chunks", test_decrypt_aligned),
+    Case("decrypt in place, unaligned chunks", test_decrypt_unaligned),
+    Case("throughput", test_throughput)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    return fragmentation_test_setup(number_of_cases, 5 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
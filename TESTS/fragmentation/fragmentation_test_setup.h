@@ -0,0 +1,73 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_TEST_SETUP_H_
+#define _FRAGMENTATION_TEST_SETUP_H_
+
+/**
+ * Block device stack that the tests share with main.cpp: flash, read back of programs, page buffer and the
+ * wrapper that the fragmentation library writes through. Define FRAGMENTATION_TEST_NAME (the name of the
+ * simulated flash) before including this file.
+ */
+
+#include "mbed.h"
+#include <greentea-client/test_env.h>
+#include <utest/utest.h>
+#include <unity/unity.h>
+
+using namespace utest::v1;
+
+#include "mbed_lorawan_frag_lib.h"
+#include "FragmentationVerifiedBlockDevice.h"
+#include "FragmentationPageBuffer.h"
+
+#ifndef FRAGMENTATION_TEST_NAME
+#error "Define FRAGMENTATION_TEST_NAME before including fragmentation_test_setup.h"
+#endif
+
+#ifdef TARGET_SIMULATOR
+#include "SimulatorBlockDevice.h"
+SimulatorBlockDevice bd(FRAGMENTATION_TEST_NAME, 256 * 528, 528);
+#else
+#include "AT45BlockDevice.h"
+AT45BlockDevice bd(SPI_MOSI, SPI_MISO, SPI_SCK, SPI_NSS);
+#endif
+
+static FragmentationVerifiedBlockDevice vbd(&bd);
+static FragmentationPageBuffer pbd(&vbd, MBED_CONF_APP_FRAGMENTATION_PAGE_BUFFER_PAGES,
+                                   MBED_CONF_APP_FRAGMENTATION_READ_CACHE_PAGES);
+static FragmentationBlockDeviceWrapper fbd(&pbd);
+
+/**
+ * Call from greentea_setup, sets up greentea and initializes the block device stack
+ *
+ * @param number_of_cases Passed in by utest
+ * @param timeout_s Timeout for the whole test in seconds
+ */
+static utest::v1::status_t fragmentation_test_setup(const size_t number_of_cases, uint32_t timeout_s) {
+    GREENTEA_SETUP(timeout_s, "default_auto");
+
+    int r = fbd.init();
+    if (r != BD_ERROR_OK) {
+        printf("Failed to initialize BlockDevice (%d)\n", r);
+        return STATUS_ABORT;
+    }
+
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+#endif // _FRAGMENTATION_TEST_SETUP_H_
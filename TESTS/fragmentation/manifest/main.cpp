@@ -0,0 +1,144 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-manifest"
+#include "../fragmentation_test_setup.h"
+#include "update_params.h"
+#include "update-client-common/arm_uc_utilities.h"
+#include "FragmentationVerifier.h"
+
+// AES-256-CTR test vector of the update client: ecila is alice encrypted with key and nc
+#include "../../../update-client-hub-common/TESTS/tests/alice.h"
+
+#define FIRMWARE_SIZE       (8 * 1024)
+#define PACKAGE_SIZE        (FOTA_MANIFEST_LENGTH + FIRMWARE_SIZE)
+#define PACKAGE_OFFSET      MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET
+#define FRAGMENT_SIZE       204
+
+static uint8_t package[PACKAGE_SIZE];
+static uint8_t buffer[128];
+static arm_uc_cipherHandle_t cipher;
+static uint8_t cipher_iv[16];
+
+/**
+ * Manifest followed by the firmware, as create-packets-h.js --head-manifest lays it out
+ */
+static void build_package(const uint8_t* firmware, uint8_t flags) {
+    UpdateManifest_t manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    manifest.magic = FOTA_MANIFEST_MAGIC;
+    memset(manifest.signature.manufacturer_uuid, 0x11, 16);
+    memset(manifest.signature.device_class_uuid, 0x22, 16);
+    ((uint8_t*)&manifest.signature.diff_info)[0] = flags;
+    manifest.crc32 = arm_uc_crc32((const uint8_t*)&manifest, offsetof(UpdateManifest_t, crc32));
+
+    memcpy(package, &manifest, FOTA_MANIFEST_LENGTH);
+    memcpy(package + FOTA_MANIFEST_LENGTH, firmware, FIRMWARE_SIZE);
+}
+
+static void write_package() {
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(package, PACKAGE_OFFSET, PACKAGE_SIZE));
+}
+
+/**
+ * The fragments come in order, the sweep starts as if there is a trailer, and starts over with the manifest left out
+ * once the first fragment is in (like main.cpp)
+ */
+void test_sweep_while_receiving() {
+    build_package(alice, 0);
+
+    UpdateSignature_t trailer;
+    UpdateManifest_t manifest;
+    FragmentationVerifier verifier(&fbd, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.start(PACKAGE_OFFSET, PACKAGE_SIZE, &trailer, FOTA_SIGNATURE_LENGTH));
+
+    for (size_t offset = 0; offset < PACKAGE_SIZE; offset += FRAGMENT_SIZE) {
+        size_t len = PACKAGE_SIZE - offset < FRAGMENT_SIZE ? PACKAGE_SIZE - offset : FRAGMENT_SIZE;
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(package + offset, PACKAGE_OFFSET + offset, len));
+        TEST_ASSERT_TRUE(verifier.update_at(PACKAGE_OFFSET + offset, package + offset, len));
+
+        if (offset == 0) {
+            TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.start(PACKAGE_OFFSET, PACKAGE_SIZE, &manifest, FOTA_MANIFEST_LENGTH, NULL, true));
+            TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.catch_up(FRAGMENT_SIZE));
+            TEST_ASSERT_EQUAL(FRAGMENT_SIZE, verifier.get_position());
+        }
+    }
+
+    uint64_t crc;
+    unsigned char sha256[32];
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.finish(&crc, sha256));
+
+    // CRC64 over what was sent, SHA256 over the firmware only
+    TEST_ASSERT_TRUE(crc == frag_crc64_update(0, package, PACKAGE_SIZE));
+
+    unsigned char expected_sha256[32];
+    mbedtls_sha256(alice, FIRMWARE_SIZE, expected_sha256, 0);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_sha256, sha256, 32);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(package, (uint8_t*)&manifest, FOTA_MANIFEST_LENGTH);
+}
+
+void test_decrypt() {
+    build_package(ecila, FOTA_DIFF_FLAG_ENCRYPTED);
+    write_package();
+
+    memcpy(cipher_iv, nc, sizeof(cipher_iv));
+    arm_uc_buffer_t key_buffer = { sizeof(key), sizeof(key), (uint8_t*)key };
+    arm_uc_buffer_t iv_buffer = { sizeof(cipher_iv), sizeof(cipher_iv), cipher_iv };
+    TEST_ASSERT_EQUAL(ARM_UC_CU_ERR_NONE, ARM_UC_cryptoDecryptSetup(&cipher, &key_buffer, &iv_buffer, 256).error);
+
+    uint64_t crc;
+    unsigned char sha256[32];
+    UpdateManifest_t manifest;
+    FragmentationVerifier verifier(&fbd, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.start(PACKAGE_OFFSET, PACKAGE_SIZE, &manifest, FOTA_MANIFEST_LENGTH, &cipher, true));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.finish(&crc, sha256));
+    ARM_UC_cryptoDecryptFinish(&cipher, NULL);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    TEST_ASSERT_TRUE(crc == frag_crc64_update(0, package, PACKAGE_SIZE));
+
+    unsigned char expected_sha256[32];
+    mbedtls_sha256(alice, FIRMWARE_SIZE, expected_sha256, 0);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_sha256, sha256, 32);
+
+    // the manifest is not encrypted, the plaintext replaced the ciphertext behind it
+    for (size_t offset = 0; offset < PACKAGE_SIZE; offset += sizeof(buffer)) {
+        size_t len = PACKAGE_SIZE - offset < sizeof(buffer) ? PACKAGE_SIZE - offset : sizeof(buffer);
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.read(buffer, PACKAGE_OFFSET + offset, len));
+
+        for (size_t ix = 0; ix < len; ix++) {
+            size_t pos = offset + ix;
+            uint8_t expected = pos < FOTA_MANIFEST_LENGTH ? package[pos] : alice[pos - FOTA_MANIFEST_LENGTH];
+            TEST_ASSERT_EQUAL_UINT8(expected, buffer[ix]);
+        }
+    }
+}
+
+Case cases[] = {
+    Case("head manifest, hashed while receiving", test_sweep_while_receiving),
+    Case("head manifest, decrypt in place", test_decrypt)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    return fragmentation_test_setup(number_of_cases, 2 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
@@ -0,0 +1,212 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-patch"
+#include "../fragmentation_test_setup.h"
+#include "FragmentationVerifier.h"
+#include "FragmentationPatch.h"
+
+#define OLD_SIZE            (8 * 1024)
+#define NEW_MAX             (OLD_SIZE + 1024)
+#define PATCH_MAX           2048
+#define PATCH_OFFSET        (64 * 528)
+#define TARGET_OFFSET       MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET
+
+// the old image stands in for the application in internal flash
+static uint8_t old_image[OLD_SIZE];
+static uint8_t new_image[NEW_MAX];
+static uint8_t patch_data[PATCH_MAX];
+static uint8_t page_buffer[528];
+static uint8_t read_buffer[64];
+static uint8_t verify_buffer[128];
+
+/**
+ * Builds a patch and, next to it, the new image that the patch should produce
+ */
+class PatchBuilder {
+public:
+    PatchBuilder() : patch_size(0), new_size(0), _old_pos(0) {}
+
+    void begin(uint32_t size) {
+        number(size);
+    }
+
+    void copy(uint32_t len) {
+        patch_data[patch_size++] = FRAG_PATCH_COPY;
+        number(len);
+        memcpy(new_image + new_size, old_image + _old_pos, len);
+        new_size += len;
+        _old_pos += len;
+    }
+
+    void insert(const uint8_t* data, uint32_t len) {
+        patch_data[patch_size++] = FRAG_PATCH_INSERT;
+        number(len);
+        memcpy(patch_data + patch_size, data, len);
+        patch_size += len;
+        memcpy(new_image + new_size, data, len);
+        new_size += len;
+    }
+
+    void seek(int32_t offset) {
+        patch_data[patch_size++] = FRAG_PATCH_SEEK;
+        number(offset < 0 ? ((uint32_t)(-(offset + 1)) << 1) | 1 : (uint32_t)offset << 1);
+        _old_pos += offset;
+    }
+
+    void number(uint32_t value) {
+        do {
+            patch_data[patch_size++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+            value >>= 7;
+        } while (value);
+    }
+
+    size_t patch_size;
+    size_t new_size;
+
+private:
+    size_t _old_pos;
+};
+
+static void write_patch(size_t size) {
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, fbd.program(patch_data, PATCH_OFFSET, size));
+}
+
+static FragmentationPatchResult apply(size_t patch_size, size_t target_max, size_t* new_size) {
+    FragmentationPatch patch(&fbd, page_buffer, sizeof(page_buffer), read_buffer, sizeof(read_buffer));
+    return patch.apply(old_image, OLD_SIZE, PATCH_OFFSET, patch_size, TARGET_OFFSET, target_max, new_size);
+}
+
+// A minor release: a few changed bytes, a function that grew, a block that moved
+static void build_minor_release(PatchBuilder* b) {
+    const uint8_t changed[] = { 0xde, 0xad, 0xbe, 0xef };
+    const uint8_t grown[] = { 0x00, 0xbf, 0x00, 0xbf, 0x70, 0x47, 0x00, 0xbf, 0x10, 0xb5, 0x04, 0x46 };
+
+    b->begin(OLD_SIZE + sizeof(grown) + 300);
+    b->copy(1000);
+    b->insert(changed, sizeof(changed));
+    b->seek(sizeof(changed));
+    b->copy(3000);
+    b->insert(grown, sizeof(grown));
+    b->copy(OLD_SIZE - 4000 - sizeof(changed) - 600);
+    b->seek(-2000);
+    b->copy(300);
+    b->seek(2000 - 300);
+    b->copy(600);
+}
+
+void test_apply() {
+    PatchBuilder b;
+    build_minor_release(&b);
+    write_patch(b.patch_size);
+
+    size_t new_size = 0;
+    TEST_ASSERT_EQUAL(FRAG_PATCH_OK, apply(b.patch_size, NEW_MAX, &new_size));
+    TEST_ASSERT_EQUAL(b.new_size, new_size);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+
+    // the SHA256 over the result in flash is what the signature is checked against
+    uint64_t crc;
+    unsigned char sha256[32], expected_sha256[32];
+    FragmentationVerifier verifier(&fbd, verify_buffer, sizeof(verify_buffer));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.verify(TARGET_OFFSET, new_size, NULL, 0, &crc, sha256));
+    mbedtls_sha256(new_image, new_size, expected_sha256, 0);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_sha256, sha256, 32);
+
+    printf("Patch of %u bytes for an image of %u bytes\n", b.patch_size, new_size);
+}
+
+void test_reject_corrupt() {
+    size_t new_size;
+
+    // copy beyond the end of the old image
+    PatchBuilder b1;
+    b1.begin(OLD_SIZE + 1);
+    b1.number(0); // FRAG_PATCH_COPY
+    b1.number(OLD_SIZE + 1);
+    write_patch(b1.patch_size);
+    TEST_ASSERT_EQUAL(FRAG_PATCH_CORRUPT, apply(b1.patch_size, NEW_MAX, &new_size));
+
+    // seek before the start of the old image
+    PatchBuilder b2;
+    b2.begin(16);
+    b2.seek(-1);
+    write_patch(b2.patch_size);
+    TEST_ASSERT_EQUAL(FRAG_PATCH_CORRUPT, apply(b2.patch_size, NEW_MAX, &new_size));
+
+    // truncated
+    PatchBuilder b3;
+    build_minor_release(&b3);
+    write_patch(b3.patch_size);
+    TEST_ASSERT_EQUAL(FRAG_PATCH_CORRUPT, apply(b3.patch_size - 1, NEW_MAX, &new_size));
+
+    // unknown command
+    PatchBuilder b4;
+    b4.begin(16);
+    b4.number(0x7f);
+    b4.number(16);
+    write_patch(b4.patch_size);
+    TEST_ASSERT_EQUAL(FRAG_PATCH_CORRUPT, apply(b4.patch_size, NEW_MAX, &new_size));
+}
+
+void test_reject_too_large() {
+    PatchBuilder b;
+    build_minor_release(&b);
+    write_patch(b.patch_size);
+
+    size_t new_size;
+    TEST_ASSERT_EQUAL(FRAG_PATCH_TOO_LARGE, apply(b.patch_size, b.new_size - 1, &new_size));
+}
+
+void test_throughput() {
+    PatchBuilder b;
+    build_minor_release(&b);
+    write_patch(b.patch_size);
+
+    Timer t;
+    t.start();
+    size_t new_size;
+    TEST_ASSERT_EQUAL(FRAG_PATCH_OK, apply(b.patch_size, NEW_MAX, &new_size));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+    t.stop();
+
+    printf("Applied patch in %d ms (%d KB/s), %u bytes of buffers\n", t.read_ms(),
+        t.read_us() ? (int)((uint64_t)new_size * 1000000 / t.read_us() / 1024) : 0,
+        sizeof(page_buffer) + sizeof(read_buffer));
+}
+
+Case cases[] = {
+    Case("apply a patch", test_apply),
+    Case("reject a corrupt patch", test_reject_corrupt),
+    Case("reject an image that does not fit", test_reject_too_large),
+    Case("throughput", test_throughput)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    // not quite random, so the copies are easy to tell apart
+    for (size_t ix = 0; ix < OLD_SIZE; ix++) {
+        old_image[ix] = (uint8_t)((ix * 7) ^ (ix >> 5));
+    }
+
+    return fragmentation_test_setup(number_of_cases, 2 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
@@ -0,0 +1,239 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-replay"
+#include "../fragmentation_test_setup.h"
+#include "packets.h"
+#include "FragmentationSessionManager.h"
+#include "FragmentationReplay.h"
+
+#define FRAME_COUNT     (sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0]))
+
+// the session table is in the last blocks of the flash, as in main.cpp
+#define JOURNAL_OFFSET  FragmentationSessionManager::get_table_offset(&bd, MBED_CONF_APP_FRAGMENTATION_JOURNAL_BLOCKS)
+#define FRAME_SIZE      sizeof(FAKE_PACKETS[0])
+#define MASK_SIZE       ((FRAME_COUNT + 7) / 8)
+#define MASK_COUNT      2
+#define FRAMES_OFFSET   sizeof(FragmentationReplayHeader_t)
+#define TIMES_OFFSET    ((FRAMES_OFFSET + FRAME_COUNT * FRAME_SIZE + 3) & ~3)
+#define MASKS_OFFSET    (TIMES_OFFSET + FRAME_COUNT * 4)
+#define FILE_SIZE       (MASKS_OFFSET + MASK_COUNT * MASK_SIZE)
+
+static uint32_t file[(FILE_SIZE + 3) / 4];
+static FragmentationReplayHeader_t* header = (FragmentationReplayHeader_t*)file;
+
+// uncoded fragments at the start, in the middle and at the end, as the stress test
+static const uint16_t lost[] = { 1, 2, 13, 21, 22, 38, 40 };
+
+/**
+ * Replay file of packets.h, what create-packets-h.js --replay --interval 1500 --loss <capture> writes. Mask 0 loses
+ * nothing, mask 1 the frames in `lost`.
+ */
+static void build_file() {
+    memset(file, 0, sizeof(file));
+    header->magic = FRAG_REPLAY_MAGIC;
+    header->version = FRAG_REPLAY_VERSION;
+    header->header_size = sizeof(FragmentationReplayHeader_t);
+    header->file_size = FILE_SIZE;
+    header->number_of_fragments = (FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2];
+    header->fragment_size = FAKE_PACKETS_HEADER[4];
+    header->padding = FAKE_PACKETS_HEADER[6];
+    header->frame_count = FRAME_COUNT;
+    header->frame_size = FRAME_SIZE;
+    header->loss_mask_count = MASK_COUNT;
+    header->crc64 = FAKE_PACKETS_CRC64_HASH;
+    header->frames_offset = FRAMES_OFFSET;
+    header->timestamps_offset = TIMES_OFFSET;
+    header->loss_masks_offset = MASKS_OFFSET;
+
+    uint8_t* data = (uint8_t*)file;
+    memcpy(data + FRAMES_OFFSET, FAKE_PACKETS, sizeof(FAKE_PACKETS));
+
+    for (size_t ix = 0; ix < FRAME_COUNT; ix++) {
+        ((uint32_t*)(data + TIMES_OFFSET))[ix] = ix * 1500;
+
+        uint16_t frameCounter = (FAKE_PACKETS[ix][2] << 8) + FAKE_PACKETS[ix][1];
+        for (size_t lx = 0; lx < sizeof(lost) / sizeof(lost[0]); lx++) {
+            if (lost[lx] == frameCounter) {
+                data[MASKS_OFFSET + MASK_SIZE + ix / 8] |= 1 << (ix % 8);
+            }
+        }
+    }
+}
+
+void test_read() {
+    build_file();
+
+    FragmentationReplay replay;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_OK, replay.open(file, FILE_SIZE));
+
+    FragmentationSessionOpts_t opts;
+    replay.get_opts(&opts);
+    TEST_ASSERT_EQUAL((FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2], opts.NumberOfFragments);
+    TEST_ASSERT_EQUAL(FAKE_PACKETS_HEADER[4], opts.FragmentSize);
+    TEST_ASSERT_EQUAL(FAKE_PACKETS_HEADER[6], opts.Padding);
+    TEST_ASSERT_EQUAL(FRAME_COUNT - opts.NumberOfFragments, opts.RedundancyPackets);
+    TEST_ASSERT_TRUE(replay.get_crc64() == FAKE_PACKETS_CRC64_HASH);
+    TEST_ASSERT_EQUAL(FRAME_SIZE, replay.get_frame_size());
+    TEST_ASSERT_EQUAL(FRAME_COUNT, replay.get_frame_count());
+    TEST_ASSERT_TRUE(replay.has_timestamps());
+    TEST_ASSERT_EQUAL(MASK_COUNT, replay.get_loss_mask_count());
+
+    size_t lost_frames = 0;
+    for (size_t ix = 0; ix < FRAME_COUNT; ix++) {
+        // frames point into the file
+        TEST_ASSERT_TRUE(replay.get_frame(ix) == (uint8_t*)file + FRAMES_OFFSET + ix * FRAME_SIZE);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(FAKE_PACKETS[ix], replay.get_frame(ix), FRAME_SIZE);
+        TEST_ASSERT_EQUAL(ix * 1500, replay.get_timestamp(ix));
+        TEST_ASSERT_FALSE(replay.is_lost(0, ix));
+        TEST_ASSERT_FALSE(replay.is_lost(-1, ix));
+        TEST_ASSERT_FALSE(replay.is_lost(MASK_COUNT, ix));
+        lost_frames += replay.is_lost(1, ix);
+    }
+    TEST_ASSERT_EQUAL(sizeof(lost) / sizeof(lost[0]), lost_frames);
+}
+
+void test_reject() {
+    FragmentationReplay replay;
+
+    build_file();
+    header->magic ^= 1;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, FILE_SIZE));
+
+    build_file();
+    header->version = FRAG_REPLAY_VERSION + 1;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_NEWER_VERSION, replay.open(file, FILE_SIZE));
+
+    // truncated
+    build_file();
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, FILE_SIZE - 1));
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, sizeof(FragmentationReplayHeader_t) - 1));
+
+    // tables that run past the end of the file
+    build_file();
+    header->frame_count += 100;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, FILE_SIZE));
+
+    build_file();
+    header->loss_masks_offset = FILE_SIZE - MASK_SIZE;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, FILE_SIZE));
+
+    build_file();
+    header->timestamps_offset++;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_INVALID, replay.open(file, FILE_SIZE));
+
+    // no timestamps and no loss masks
+    build_file();
+    header->timestamps_offset = 0;
+    header->loss_mask_count = 0;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_OK, replay.open(file, FILE_SIZE));
+    TEST_ASSERT_FALSE(replay.has_timestamps());
+    TEST_ASSERT_EQUAL(0, replay.get_timestamp(1));
+    TEST_ASSERT_FALSE(replay.is_lost(1, 0));
+}
+
+/**
+ * Feed the frames that are not lost in the mask, as main.cpp does, and check the CRC64 of the image
+ */
+static void run_session(int mask) {
+    build_file();
+
+    FragmentationReplay replay;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_OK, replay.open(file, FILE_SIZE));
+
+    FragmentationSessionManager::clear(&fbd, JOURNAL_OFFSET);
+
+    FragmentationSessionManager* sessions = new FragmentationSessionManager(&fbd,
+        MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET, JOURNAL_OFFSET, JOURNAL_OFFSET, bd.get_erase_size(), &pbd);
+
+    FragmentationSessionOpts_t opts;
+    replay.get_opts(&opts);
+    opts.FlashOffset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
+    TEST_ASSERT_EQUAL(FRAG_OK, sessions->resume());
+    TEST_ASSERT_EQUAL(FRAG_OK, sessions->setup_session(0, &opts, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET));
+
+    FragResult result = FRAG_OK;
+    for (size_t ix = 0; result != FRAG_COMPLETE && ix < replay.get_frame_count(); ix++) {
+        if (replay.is_lost(mask, ix)) continue;
+
+        const uint8_t* buffer = replay.get_frame(ix);
+        uint16_t frameCounter = (buffer[2] << 8) + buffer[1];
+        result = sessions->process_frame(frameCounter, (uint8_t*)buffer + 3, replay.get_frame_size() - 3);
+        TEST_ASSERT_MESSAGE(result == FRAG_OK || result == FRAG_COMPLETE, FragmentationDecoder::frag_result_string(result));
+    }
+    TEST_ASSERT_EQUAL(FRAG_COMPLETE, result);
+
+    delete sessions;
+
+    uint8_t crc_buffer[128];
+    FragmentationCrc64 crc64(&fbd, crc_buffer, sizeof(crc_buffer));
+    uint64_t crc_res = crc64.calculate(opts.FlashOffset, (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding);
+    TEST_ASSERT_TRUE_MESSAGE(crc_res == replay.get_crc64(), "CRC64 of the image does not match");
+
+    FragmentationSessionManager::clear(&fbd, JOURNAL_OFFSET);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+}
+
+void test_replay() {
+    run_session(-1);
+}
+
+void test_replay_loss_mask() {
+    run_session(1);
+}
+
+void test_map_file() {
+#if FRAG_REPLAY_MMAP
+    build_file();
+
+    const char* path = "lorawan-frag-replay.bin";
+    FILE* f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(FILE_SIZE, fwrite(file, 1, FILE_SIZE, f));
+    fclose(f);
+
+    FragmentationReplay replay;
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_OK, replay.open(path));
+    TEST_ASSERT_EQUAL(FRAME_COUNT, replay.get_frame_count());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(FAKE_PACKETS[FRAME_COUNT - 1], replay.get_frame(FRAME_COUNT - 1), FRAME_SIZE);
+    TEST_ASSERT_TRUE(replay.is_lost(1, 0));
+    replay.close();
+
+    remove(path);
+    TEST_ASSERT_EQUAL(FRAG_REPLAY_OPEN_ERROR, replay.open(path));
+#else
+    printf("No file system to map replay files from, skipping\n");
+#endif
+}
+
+Case cases[] = {
+    Case("read a replay file", test_read),
+    Case("reject files that are not valid", test_reject),
+    Case("replay every frame", test_replay),
+    Case("replay with a loss mask", test_replay_loss_mask),
+    Case("map a replay file", test_map_file)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    return fragmentation_test_setup(number_of_cases, 2 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
@@ -0,0 +1,594 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "mbed.h"
+#include <greentea-client/test_env.h>
+#include <utest/utest.h>
+#include <unity/unity.h>
+
+using namespace utest::v1;
+
+#include "mbed_lorawan_frag_lib.h"
+#include "packets.h"
+#include "FragmentationSessionManager.h"
+#include "FragmentationFlashAllocator.h"
+#include "FragmentationPageBuffer.h"
+#include "FragmentationMatrixLine.h"
+#include "FragmentationXor.h"
+
+#ifdef TARGET_SIMULATOR
+#include "SimulatorBlockDevice.h"
+SimulatorBlockDevice bd("lorawan-frag-resume", 256 * 528, 528);
+#else
+#include "AT45BlockDevice.h"
+AT45BlockDevice bd(SPI_MOSI, SPI_MISO, SPI_SCK, SPI_NSS);
+#endif
+
+#define STORAGE_OFFSET          MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET
+#define JOURNAL_OFFSET          FragmentationSessionManager::get_table_offset(&bd, MBED_CONF_APP_FRAGMENTATION_JOURNAL_BLOCKS)
+
+// package of fragments that are all 0x00 or all 0xff, so solved fragments XOR to zero
+#define SYNTHETIC_FRAGMENTS     24
+#define SYNTHETIC_REDUNDANCY    16
+#define SYNTHETIC_SIZE          32
+
+/**
+ * Block device that loses power after a number of programs or erases: that one and all after it fail, and
+ * nothing is written, until power_on() is called again
+ */
+class PowerLossBlockDevice : public BlockDevice {
+public:
+    PowerLossBlockDevice(BlockDevice* bd)
+        : _bd(bd), _budget(-1), _writes(0), _failed(0)
+    {
+    }
+
+    virtual int init() {
+        return _bd->init();
+    }
+
+    virtual int deinit() {
+        return _bd->deinit();
+    }
+
+    virtual int read(void* buffer, bd_addr_t addr, bd_size_t size) {
+        return _bd->read(buffer, addr, size);
+    }
+
+    virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+        if (!write_allowed()) return BD_ERROR_DEVICE_ERROR;
+
+        return _bd->program(buffer, addr, size);
+    }
+
+    virtual int erase(bd_addr_t addr, bd_size_t size) {
+        if (!write_allowed()) return BD_ERROR_DEVICE_ERROR;
+
+        return _bd->erase(addr, size);
+    }
+
+    virtual bd_size_t get_read_size() const {
+        return _bd->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const {
+        return _bd->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const {
+        return _bd->get_erase_size();
+    }
+
+    virtual bd_size_t size() const {
+        return _bd->size();
+    }
+
+    /**
+     * @param budget Number of writes that go through before the power is lost, or -1 to never lose it
+     */
+    void power_on(int budget) {
+        _budget = budget;
+        _writes = 0;
+        _failed = 0;
+    }
+
+    /**
+     * Number of writes that failed since power_on()
+     */
+    uint32_t get_failed() {
+        return _failed;
+    }
+
+private:
+    bool write_allowed() {
+        if (_budget >= 0 && _writes >= (uint32_t)_budget) {
+            _failed++;
+            return false;
+        }
+
+        _writes++;
+        return true;
+    }
+
+    BlockDevice* _bd;
+    int _budget;
+    uint32_t _writes;
+    uint32_t _failed;
+};
+
+static PowerLossBlockDevice plbd(&bd);
+
+/**
+ * Everything the device holds in RAM, a reset throws it away without syncing the page buffer
+ */
+class Device {
+public:
+    Device()
+        : pbd(&plbd, MBED_CONF_APP_FRAGMENTATION_PAGE_BUFFER_PAGES, MBED_CONF_APP_FRAGMENTATION_READ_CACHE_PAGES),
+          fbd(&pbd), sessions(NULL)
+    {
+    }
+
+    ~Device() {
+        delete sessions;
+    }
+
+    FragResult boot() {
+        if (fbd.init() != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        sessions = new FragmentationSessionManager(&fbd, STORAGE_OFFSET, JOURNAL_OFFSET, JOURNAL_OFFSET,
+            bd.get_erase_size(), &pbd);
+        return sessions->resume();
+    }
+
+    FragmentationPageBuffer pbd;
+    FragmentationBlockDeviceWrapper fbd;
+    FragmentationSessionManager* sessions;
+};
+
+typedef struct {
+    FragmentationSessionOpts_t opts;
+    const uint8_t* frames;          // frames with the fragmentation header, uncoded fragments first
+    size_t frame_size;
+    size_t frame_count;
+} package_t;
+
+typedef struct {
+    FragmentationJournalState state;
+    int solve_col;
+    bool solution_pending;
+    uint16_t lost;
+} journal_snapshot_t;
+
+static uint8_t synthetic_frames[SYNTHETIC_FRAGMENTS + SYNTHETIC_REDUNDANCY][3 + SYNTHETIC_SIZE];
+
+static package_t get_fake_package() {
+    package_t package;
+    package.opts.NumberOfFragments = (FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2];
+    package.opts.FragmentSize = FAKE_PACKETS_HEADER[4];
+    package.opts.Padding = FAKE_PACKETS_HEADER[6];
+    package.opts.RedundancyPackets = (sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0])) - package.opts.NumberOfFragments;
+    package.opts.FlashOffset = STORAGE_OFFSET;
+    package.frames = (const uint8_t*)FAKE_PACKETS;
+    package.frame_size = sizeof(FAKE_PACKETS[0]);
+    package.frame_count = sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0]);
+    return package;
+}
+
+/**
+ * Build a package out of runs of 0x00 and 0xff fragments, with the redundancy frames a sender would add
+ */
+static package_t get_synthetic_package() {
+    frag_bits_t line[frag_bits_words(SYNTHETIC_FRAGMENTS)];
+
+    for (uint16_t ix = 0; ix < SYNTHETIC_FRAGMENTS + SYNTHETIC_REDUNDANCY; ix++) {
+        uint8_t* frame = synthetic_frames[ix];
+        frame[0] = 0x08; // DataFragment
+        frame[1] = (ix + 1) & 0xff;
+        frame[2] = (ix + 1) >> 8;
+
+        if (ix < SYNTHETIC_FRAGMENTS) {
+            memset(frame + 3, (ix / 3) % 2 ? 0xff : 0x00, SYNTHETIC_SIZE);
+            continue;
+        }
+
+        memset(frame + 3, 0, SYNTHETIC_SIZE);
+        frag_matrix_line(ix + 1 - SYNTHETIC_FRAGMENTS, SYNTHETIC_FRAGMENTS, line);
+        for (uint16_t fx = 0; fx < SYNTHETIC_FRAGMENTS; fx++) {
+            if (frag_bits_get(line, fx)) {
+                frag_xor(frame + 3, synthetic_frames[fx] + 3, SYNTHETIC_SIZE);
+            }
+        }
+    }
+
+    package_t package;
+    package.opts.NumberOfFragments = SYNTHETIC_FRAGMENTS;
+    package.opts.FragmentSize = SYNTHETIC_SIZE;
+    package.opts.Padding = 0;
+    package.opts.RedundancyPackets = SYNTHETIC_REDUNDANCY;
+    package.opts.FlashOffset = STORAGE_OFFSET;
+    package.frames = (const uint8_t*)synthetic_frames;
+    package.frame_size = sizeof(synthetic_frames[0]);
+    package.frame_count = SYNTHETIC_FRAGMENTS + SYNTHETIC_REDUNDANCY;
+    return package;
+}
+
+/**
+ * Feed all frames of a package, except the ones in `lost`, until a frame does not return FRAG_OK
+ */
+static FragResult feed(FragmentationSessionManager* sessions, uint8_t frag_index, const package_t* package,
+                       const uint16_t* lost, size_t lost_count, size_t max_frames = 0xffff) {
+    FragResult result = FRAG_OK;
+
+    for (size_t ix = 0; ix < package->frame_count && ix < max_frames; ix++) {
+        const uint8_t* frame = package->frames + (ix * package->frame_size);
+        uint16_t frameCounter = (frame[2] << 8) + frame[1];
+
+        bool skip = false;
+        for (size_t lx = 0; lx < lost_count; lx++) {
+            if (lost[lx] == frameCounter) skip = true;
+        }
+        if (skip) continue;
+
+        result = sessions->process_frame((frag_index << 14) | frameCounter, (uint8_t*)frame + 3, package->frame_size - 3);
+        if (result != FRAG_OK) break;
+    }
+
+    return result;
+}
+
+/**
+ * Compare the image in flash against the uncoded fragments of the package
+ */
+static void check_image(FragmentationBlockDeviceWrapper* flash, const package_t* package, bd_addr_t offset) {
+    const FragmentationSessionOpts_t* opts = &package->opts;
+    uint8_t buffer[255];
+
+    for (uint16_t ix = 0; ix < opts->NumberOfFragments; ix++) {
+        size_t size = opts->FragmentSize - (ix == opts->NumberOfFragments - 1 ? opts->Padding : 0);
+
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, flash->read(buffer, offset + ((bd_addr_t)ix * opts->FragmentSize), size));
+        TEST_ASSERT_TRUE_MESSAGE(memcmp(buffer, package->frames + (ix * package->frame_size) + 3, size) == 0,
+            "Fragment in flash does not match");
+    }
+}
+
+/**
+ * Fill the fragment storage with a pattern that is in none of the packages, so a fragment that was never
+ * written can't match by accident
+ */
+static void wipe_storage(const package_t* package) {
+    uint8_t page[528];
+    memset(page, 0x5a, sizeof(page));
+
+    bd_size_t page_size = bd.get_erase_size();
+    TEST_ASSERT_TRUE(page_size <= sizeof(page));
+
+    bd_size_t size = (bd_size_t)package->opts.NumberOfFragments * package->opts.FragmentSize;
+
+    for (bd_addr_t addr = STORAGE_OFFSET; addr < STORAGE_OFFSET + size; addr += page_size) {
+        TEST_ASSERT_EQUAL(BD_ERROR_OK, bd.program(page, addr, page_size));
+    }
+}
+
+/**
+ * Read the journal of session 0 straight from flash, to see where a reset happened
+ */
+static void read_journal(journal_snapshot_t* snapshot) {
+    FragmentationBlockDeviceWrapper flash(&plbd);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, flash.init());
+
+    FragmentationSessionTable_t table;
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, flash.read(&table, JOURNAL_OFFSET, sizeof(table)));
+    TEST_ASSERT_TRUE(table.sessions[0].in_use);
+
+    FragmentationJournal journal(&flash, table.sessions[0].journal_offset, table.sessions[0].journal_size);
+    TEST_ASSERT_TRUE(journal.load());
+
+    snapshot->state = journal.get_state();
+    snapshot->solve_col = journal.get_solve_col();
+    snapshot->solution_pending = journal.is_solution_pending();
+    snapshot->lost = journal.get_lost();
+}
+
+/**
+ * Run a session and lose power after `budget` writes, then resume it and feed all frames again
+ *
+ * @returns false if the session completed before the power was lost
+ */
+static bool run_with_reset(const package_t* package, const uint16_t* lost, size_t lost_count, int budget,
+                           journal_snapshot_t* snapshot) {
+    plbd.power_on(-1);
+    wipe_storage(package);
+
+    Device* device = new Device();
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->fbd.init());
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, FragmentationSessionManager::clear(&device->fbd, JOURNAL_OFFSET));
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+
+    FragmentationSessionOpts_t opts = package->opts;
+    TEST_ASSERT_EQUAL(FRAG_OK, device->sessions->setup_session(0, &opts, STORAGE_OFFSET));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->pbd.sync());
+
+    plbd.power_on(budget);
+    FragResult result = feed(device->sessions, 0, package, lost, lost_count);
+    bool reset = plbd.get_failed() > 0;
+
+    delete device;
+    plbd.power_on(-1);
+
+    if (!reset) {
+        TEST_ASSERT_EQUAL(FRAG_COMPLETE, result);
+        return false;
+    }
+
+    read_journal(snapshot);
+
+    device = new Device();
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+
+    FragmentationDecoder* session = device->sessions->get_session(0);
+    TEST_ASSERT_NOT_NULL(session);
+
+    result = session->is_complete() ? FRAG_COMPLETE : feed(device->sessions, 0, package, lost, lost_count);
+    TEST_ASSERT_MESSAGE(result == FRAG_COMPLETE, FragmentationDecoder::frag_result_string(result));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->pbd.sync());
+
+    check_image(&device->fbd, package, STORAGE_OFFSET);
+
+    delete device;
+    return true;
+}
+
+/**
+ * Reset after every single write of a session in turn, every reset has to resume into the same image
+ */
+static void run_all_resets(const package_t* package, const uint16_t* lost, size_t lost_count) {
+    uint32_t resets[FRAG_JOURNAL_COMPLETE + 1] = { 0 };
+    uint32_t partly_solved = 0;
+    uint32_t pending = 0;
+
+    int budget = 0;
+    journal_snapshot_t snapshot;
+    while (run_with_reset(package, lost, lost_count, budget, &snapshot)) {
+        TEST_ASSERT_TRUE(snapshot.state >= FRAG_JOURNAL_RECEIVING && snapshot.state <= FRAG_JOURNAL_COMPLETE);
+        resets[snapshot.state]++;
+
+        if (snapshot.state == FRAG_JOURNAL_SOLVING && snapshot.solve_col < snapshot.lost - 1) {
+            partly_solved++;
+        }
+        if (snapshot.state == FRAG_JOURNAL_SOLVING && snapshot.solution_pending) {
+            pending++;
+        }
+        budget++;
+    }
+
+    printf("%d resets: %lu receiving, %lu coding, %lu solving (%lu after the first column, %lu while copying a solution), %lu complete\n",
+        budget, resets[FRAG_JOURNAL_RECEIVING], resets[FRAG_JOURNAL_CODING], resets[FRAG_JOURNAL_SOLVING],
+        partly_solved, pending, resets[FRAG_JOURNAL_COMPLETE]);
+
+    TEST_ASSERT_TRUE_MESSAGE(resets[FRAG_JOURNAL_RECEIVING] > 0, "No reset while receiving");
+    TEST_ASSERT_TRUE_MESSAGE(resets[FRAG_JOURNAL_CODING] > 0, "No reset while coding");
+    TEST_ASSERT_TRUE_MESSAGE(partly_solved > 0, "No reset during back-substitution");
+    TEST_ASSERT_TRUE_MESSAGE(pending > 0, "No reset while a solution was programmed");
+}
+
+void test_reset_fake_packets() {
+    package_t package = get_fake_package();
+    const uint16_t lost[] = { 1, 2, 13, 21, 22, 38, 40 };
+    run_all_resets(&package, lost, sizeof(lost) / sizeof(lost[0]));
+}
+
+void test_reset_repeated_fragments() {
+    package_t package = get_synthetic_package();
+    const uint16_t lost[] = { 1, 2, 4, 5, 6, 10, 11, 17, 24 };
+    run_all_resets(&package, lost, sizeof(lost) / sizeof(lost[0]));
+}
+
+void test_too_many_lost() {
+    package_t package = get_fake_package();
+
+    uint16_t lost[21];
+    for (uint16_t ix = 0; ix < sizeof(lost) / sizeof(lost[0]); ix++) {
+        lost[ix] = ix + 1;
+    }
+
+    Device device;
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.fbd.init());
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, FragmentationSessionManager::clear(&device.fbd, JOURNAL_OFFSET));
+    TEST_ASSERT_EQUAL(FRAG_OK, device.boot());
+
+    FragmentationSessionOpts_t opts = package.opts;
+    TEST_ASSERT_EQUAL(FRAG_OK, device.sessions->setup_session(0, &opts, STORAGE_OFFSET));
+
+    TEST_ASSERT_EQUAL(FRAG_TOO_MANY_LOST, feed(device.sessions, 0, &package, lost, sizeof(lost) / sizeof(lost[0])));
+    TEST_ASSERT_FALSE(device.sessions->get_session(0)->is_complete());
+}
+
+void test_two_sessions() {
+    package_t fake = get_fake_package();
+    package_t synthetic = get_synthetic_package();
+    const uint16_t lost[] = { 3, 7, 24 };
+
+    plbd.power_on(-1);
+
+    Device* device = new Device();
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->fbd.init());
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, FragmentationSessionManager::clear(&device->fbd, JOURNAL_OFFSET));
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+
+    FragmentationSessionOpts_t opts = fake.opts;
+    TEST_ASSERT_EQUAL(FRAG_OK, device->sessions->setup_session(0, &opts, STORAGE_OFFSET));
+    opts = synthetic.opts;
+    TEST_ASSERT_EQUAL(FRAG_OK, device->sessions->setup_session(1, &opts));
+
+    // half of both sessions, then reset
+    TEST_ASSERT_EQUAL(FRAG_OK, feed(device->sessions, 0, &fake, lost, 3, fake.frame_count / 2));
+    TEST_ASSERT_EQUAL(FRAG_OK, feed(device->sessions, 1, &synthetic, lost, 3, synthetic.frame_count / 2));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->pbd.sync());
+    delete device;
+
+    device = new Device();
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+    TEST_ASSERT_NOT_NULL(device->sessions->get_session(0));
+    TEST_ASSERT_NOT_NULL(device->sessions->get_session(1));
+
+    TEST_ASSERT_EQUAL(FRAG_COMPLETE, feed(device->sessions, 1, &synthetic, lost, 3));
+    TEST_ASSERT_EQUAL(FRAG_COMPLETE, feed(device->sessions, 0, &fake, lost, 3));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->pbd.sync());
+
+    TEST_ASSERT_TRUE(device->sessions->get_opts(1, &opts));
+    check_image(&device->fbd, &fake, STORAGE_OFFSET);
+    check_image(&device->fbd, &synthetic, opts.FlashOffset);
+
+    delete device;
+}
+
+void test_allocator() {
+    const bd_size_t block = 528;
+    FragmentationFlashAllocator allocator(0, 8 * block, block);
+
+    // sizes are rounded up to whole blocks
+    TEST_ASSERT_TRUE(allocator.allocate(100) == 0);
+    TEST_ASSERT_TRUE(allocator.allocate(block + 1) == block);
+
+    TEST_ASSERT_FALSE(allocator.allocate_at(2 * block, block));
+    TEST_ASSERT_FALSE(allocator.allocate_at(7 * block, 2 * block));
+    TEST_ASSERT_TRUE(allocator.allocate_at(5 * block, block));
+
+    // blocks 3-4 and 6-7 are free, but not three in a row
+    TEST_ASSERT_TRUE(allocator.allocate(3 * block) == FRAG_ADDRESS_NONE);
+    TEST_ASSERT_TRUE(allocator.get_free_size() == 4 * block);
+
+    allocator.free(block);
+    TEST_ASSERT_TRUE(allocator.allocate(3 * block) == block);
+    TEST_ASSERT_TRUE(allocator.allocate(2 * block) == 6 * block);
+    TEST_ASSERT_TRUE(allocator.get_free_size() == block);
+}
+
+void test_allocator_top() {
+    const bd_size_t block = 528;
+    FragmentationFlashAllocator allocator(0, 8 * block + 100, block);
+
+    // staging goes to the end, aligned, so the start stays free
+    TEST_ASSERT_TRUE(allocator.allocate_top(block + 1) == 6 * block);
+    TEST_ASSERT_TRUE(allocator.allocate_at(2 * block, block));
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(0) == 2 * block);
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(block) == block);
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(2 * block) == 0);
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(3 * block) == 3 * block);
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(7 * block) == 0);
+    TEST_ASSERT_TRUE(allocator.get_free_size_at(8 * block) == 100);
+
+    // the last gap that fits, not the last gap
+    TEST_ASSERT_TRUE(allocator.allocate_top(3 * block) == 3 * block);
+    TEST_ASSERT_TRUE(allocator.allocate_top(block) == block);
+    TEST_ASSERT_TRUE(allocator.allocate_top(block) == 0);
+    TEST_ASSERT_TRUE(allocator.allocate_top(block) == FRAG_ADDRESS_NONE);
+}
+
+void test_session_scratch() {
+    plbd.power_on(-1);
+
+    Device* device = new Device();
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->fbd.init());
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, FragmentationSessionManager::clear(&device->fbd, JOURNAL_OFFSET));
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+
+    package_t fake = get_fake_package();
+    FragmentationSessionOpts_t opts = fake.opts;
+    TEST_ASSERT_EQUAL(FRAG_OK, device->sessions->setup_session(0, &opts, STORAGE_OFFSET));
+
+    // a staging region does not overlap the session, and is gone after a reset
+    bd_size_t size = 4 * bd.get_erase_size();
+    bd_addr_t staging = device->sessions->allocate_scratch(size);
+    TEST_ASSERT_TRUE(staging != FRAG_ADDRESS_NONE);
+    TEST_ASSERT_TRUE(staging + size <= JOURNAL_OFFSET);
+    TEST_ASSERT_TRUE(staging >= STORAGE_OFFSET + opts.NumberOfFragments * opts.FragmentSize);
+    TEST_ASSERT_TRUE(device->sessions->allocate_scratch(size, staging) == FRAG_ADDRESS_NONE);
+    TEST_ASSERT_TRUE(device->sessions->get_free_size_at(STORAGE_OFFSET) == 0);
+
+    // with the session gone, the storage offset has everything up to the staging region
+    TEST_ASSERT_EQUAL(FRAG_OK, device->sessions->delete_session(0));
+    TEST_ASSERT_TRUE(device->sessions->get_free_size_at(STORAGE_OFFSET) == staging - STORAGE_OFFSET);
+    TEST_ASSERT_TRUE(device->sessions->allocate_scratch(JOURNAL_OFFSET) == FRAG_ADDRESS_NONE);
+
+    delete device;
+
+    device = new Device();
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device->fbd.init());
+    TEST_ASSERT_EQUAL(FRAG_OK, device->boot());
+    TEST_ASSERT_TRUE(device->sessions->get_free_size_at(STORAGE_OFFSET) == JOURNAL_OFFSET - STORAGE_OFFSET);
+
+    delete device;
+}
+
+void test_erase_drops_buffered_pages() {
+    plbd.power_on(-1);
+
+    Device device;
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.fbd.init());
+
+    const bd_size_t page_size = bd.get_erase_size();
+    const bd_addr_t addr = STORAGE_OFFSET;
+
+    uint8_t data[64];
+    memset(data, 0x3c, sizeof(data));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.pbd.program(data, addr, sizeof(data)));
+    TEST_ASSERT_TRUE(device.pbd.is_dirty(addr, sizeof(data)));
+
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.pbd.erase(addr, page_size));
+    TEST_ASSERT_FALSE(device.pbd.is_dirty(addr, sizeof(data)));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.pbd.sync());
+
+    // the data written before the erase neither comes from the buffer, nor ended up in flash
+    uint8_t buffered[64], flash[64];
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, device.pbd.read(buffered, addr, sizeof(buffered)));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, bd.read(flash, addr, sizeof(flash)));
+    TEST_ASSERT_TRUE(memcmp(buffered, flash, sizeof(flash)) == 0);
+    TEST_ASSERT_FALSE(memcmp(flash, data, sizeof(data)) == 0);
+}
+
+Case cases[] = {
+    Case("reset at every write, fake packets", test_reset_fake_packets),
+    Case("reset at every write, repeated fragments", test_reset_repeated_fragments),
+    Case("more fragments lost than redundancy packets", test_too_many_lost),
+    Case("two sessions resumed", test_two_sessions),
+    Case("flash allocator", test_allocator),
+    Case("flash allocator, staging at the end", test_allocator_top),
+    Case("staging regions next to sessions", test_session_scratch),
+    Case("erase drops buffered pages", test_erase_drops_buffered_pages)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(10 * 60, "default_auto");
+
+    int r = bd.init();
+    if (r != BD_ERROR_OK) {
+        printf("Failed to initialize BlockDevice (%d)\n", r);
+    }
+
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
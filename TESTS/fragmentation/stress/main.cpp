@@ -0,0 +1,241 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#define FRAGMENTATION_TEST_NAME "lorawan-frag-stress"
+#include "../fragmentation_test_setup.h"
+#include "packets.h"
+#include "update_params.h"
+#include "FragmentationSessionManager.h"
+#include "FragmentationVerifier.h"
+#include "FragmentationEcdsaRestartable.h"
+#include "FragmentationCryptoPool.h"
+#include "UpdateCerts.h"
+
+#define FRAME_COUNT     (sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0]))
+
+// the session table is in the last blocks of the flash, as in main.cpp
+#define JOURNAL_OFFSET  FragmentationSessionManager::get_table_offset(&bd, MBED_CONF_APP_FRAGMENTATION_JOURNAL_BLOCKS)
+
+static FragmentationCryptoPool crypto_pool;
+
+static FragmentationSessionOpts_t get_opts() {
+    FragmentationSessionOpts_t opts;
+    opts.NumberOfFragments = (FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2];
+    opts.FragmentSize = FAKE_PACKETS_HEADER[4];
+    opts.Padding = FAKE_PACKETS_HEADER[6];
+    opts.RedundancyPackets = FRAME_COUNT - opts.NumberOfFragments;
+    opts.FlashOffset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
+    return opts;
+}
+
+/**
+ * Convert a DER signature to raw r || s, what create-packets-h.js --raw-signature does on the host
+ */
+static bool der_to_raw(const unsigned char* der, size_t der_length, unsigned char raw[FRAG_ECDSA_RAW_SIG_LENGTH]) {
+    memset(raw, 0, FRAG_ECDSA_RAW_SIG_LENGTH);
+
+    size_t offset = 2; // SEQUENCE tag and length
+    for (size_t ix = 0; ix < 2; ix++) {
+        if (offset + 2 > der_length || der[offset] != 0x02) return false;
+
+        size_t len = der[offset + 1];
+        const unsigned char* value = der + offset + 2;
+        offset += 2 + len;
+        if (offset > der_length) return false;
+
+        // INTEGER has a leading zero when the top bit is set
+        while (len > 32 && *value == 0) {
+            value++;
+            len--;
+        }
+        if (len > 32) return false;
+
+        memcpy(raw + (ix * 32) + (32 - len), value, len);
+    }
+
+    return offset == der_length;
+}
+
+/**
+ * Verify the signature in slices, as the application does between other events
+ */
+static FragmentationEcdsaResult verify_signature(unsigned char sha256[32], UpdateSignature_t* trailer) {
+    // main.cpp takes the pool from the scratch arena, here it only lives for the verification as well
+    uint8_t* pool = new uint8_t[FOTALORA_MBEDTLS_POOL_SIZE];
+    crypto_pool.start_stage("ecdsa", pool, FOTALORA_MBEDTLS_POOL_SIZE);
+    FragmentationEcdsaRestartable* ecdsa = new FragmentationEcdsaRestartable(UPDATE_CERT_PUBKEY_RAW);
+
+    FragmentationEcdsaResult result;
+    if (trailer->signature_length == (FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH)) {
+        result = ecdsa->start_raw(sha256, trailer->signature);
+    }
+    else {
+        result = ecdsa->start(sha256, trailer->signature, trailer->signature_length);
+    }
+    while (result == FRAG_ECDSA_IN_PROGRESS) {
+        result = ecdsa->step();
+    }
+
+    printf("ECDSA took %lu ms in %lu slices, longest slice %lu us\n",
+        ecdsa->get_total_us() / 1000, ecdsa->get_slices(), ecdsa->get_max_slice_us());
+
+    // with or without restartable ECP in mbed TLS, the verification must not run in one go
+    uint32_t slices = ecdsa->get_slices();
+    delete ecdsa;
+
+    // everything that was allocated from the pool is returned
+    FragmentationCryptoPoolStats_t stats;
+    crypto_pool.end_stage(&stats);
+    delete[] pool;
+    TEST_ASSERT_EQUAL(0, stats.current_blocks);
+
+    TEST_ASSERT_TRUE_MESSAGE(slices > 1, "ECDSA verification was not sliced");
+
+    return result;
+}
+
+/**
+ * Feed all frames at full speed, except the ones in `lost`, and check the CRC64 of the image
+ */
+static void run_session(const uint16_t* lost, size_t lost_count, bool check_signature = false) {
+    FragmentationSessionManager::clear(&fbd, JOURNAL_OFFSET);
+
+    FragmentationSessionManager* sessions = new FragmentationSessionManager(&fbd,
+        MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET, JOURNAL_OFFSET, JOURNAL_OFFSET, bd.get_erase_size(), &pbd);
+
+    FragmentationSessionOpts_t opts = get_opts();
+    TEST_ASSERT_EQUAL(FRAG_OK, sessions->resume());
+    TEST_ASSERT_EQUAL(FRAG_OK, sessions->setup_session(0, &opts, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET));
+
+    uint32_t polls = vbd.get_polls();
+    uint32_t retries = vbd.get_retries();
+    uint32_t read_back = vbd.get_read_back_bytes();
+
+    FragmentationPageBufferStats_t before, after;
+    pbd.get_stats(&before);
+
+    Timer t;
+    t.start();
+
+    FragResult result = FRAG_OK;
+    size_t processed = 0;
+    for (size_t ix = 0; result != FRAG_COMPLETE && ix < FRAME_COUNT; ix++) {
+        uint8_t* buffer = (uint8_t*)FAKE_PACKETS[ix];
+        uint16_t frameCounter = (buffer[2] << 8) + buffer[1];
+
+        bool skip = false;
+        for (size_t lx = 0; lx < lost_count; lx++) {
+            if (lost[lx] == frameCounter) skip = true;
+        }
+        if (skip) continue;
+
+        result = sessions->process_frame(frameCounter, buffer + 3, sizeof(FAKE_PACKETS[0]) - 3);
+        TEST_ASSERT_MESSAGE(result == FRAG_OK || result == FRAG_COMPLETE, FragmentationDecoder::frag_result_string(result));
+        processed++;
+    }
+
+    t.stop();
+
+    TEST_ASSERT_EQUAL(FRAG_COMPLETE, result);
+
+    pbd.get_stats(&after);
+
+    printf("Processed %u frames in %d ms (%d frames/s), %lu waits for the device, %lu retries, %lu bytes read back\n",
+        processed, t.read_ms(), t.read_ms() > 0 ? (int)(processed * 1000 / t.read_ms()) : 0,
+        vbd.get_polls() - polls, vbd.get_retries() - retries, vbd.get_read_back_bytes() - read_back);
+    printf("Flash traffic: %lu bytes read, %lu bytes programmed in %lu page programs, %lu cache hits, %lu misses\n",
+        after.read_bytes - before.read_bytes, after.program_bytes - before.program_bytes,
+        after.page_programs - before.page_programs,
+        after.read_hits - before.read_hits, after.read_misses - before.read_misses);
+
+    delete sessions;
+
+    uint8_t crc_buffer[128];
+    FragmentationCrc64 crc64(&fbd, crc_buffer, sizeof(crc_buffer));
+    uint64_t crc_res = crc64.calculate(opts.FlashOffset, (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding);
+
+    TEST_ASSERT_TRUE_MESSAGE(crc_res == FAKE_PACKETS_CRC64_HASH, "CRC64 of the image does not match");
+
+    // the single sweep verifier has to agree with FragmentationCrc64, and pick up the signature trailer
+    UpdateSignature_t trailer;
+    uint64_t sweep_crc;
+    unsigned char sha256[32];
+    FragmentationVerifier verifier(&fbd, crc_buffer, sizeof(crc_buffer));
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, verifier.verify(opts.FlashOffset, (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding,
+        &trailer, FOTA_SIGNATURE_LENGTH, &sweep_crc, sha256));
+    TEST_ASSERT_TRUE_MESSAGE(sweep_crc == FAKE_PACKETS_CRC64_HASH, "CRC64 of the verifier does not match");
+    TEST_ASSERT_TRUE((trailer.signature_length >= 70 && trailer.signature_length <= 72)
+        || trailer.signature_length == (FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH));
+
+    if (check_signature) {
+        TEST_ASSERT_EQUAL(FRAG_ECDSA_VALID, verify_signature(sha256, &trailer));
+
+        // the same signature as raw r || s
+        if (!(trailer.signature_length & FOTA_SIGNATURE_RAW)) {
+            unsigned char raw[FRAG_ECDSA_RAW_SIG_LENGTH];
+            TEST_ASSERT_TRUE(der_to_raw(trailer.signature, trailer.signature_length, raw));
+            memcpy(trailer.signature, raw, sizeof(raw));
+            trailer.signature_length = FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH;
+            TEST_ASSERT_EQUAL(FRAG_ECDSA_VALID, verify_signature(sha256, &trailer));
+        }
+
+        sha256[0] ^= 0x01;
+        TEST_ASSERT_EQUAL(FRAG_ECDSA_INVALID, verify_signature(sha256, &trailer));
+    }
+
+    FragmentationSessionManager::clear(&fbd, JOURNAL_OFFSET);
+    TEST_ASSERT_EQUAL(BD_ERROR_OK, pbd.sync());
+}
+
+void test_no_loss() {
+    run_session(NULL, 0);
+}
+
+void test_loss() {
+    // uncoded fragments at the start, in the middle and at the end
+    const uint16_t lost[] = { 1, 2, 13, 21, 22, 38, 40 };
+    run_session(lost, sizeof(lost) / sizeof(lost[0]));
+}
+
+void test_repeated() {
+    // back to back sessions rewrite the same pages over and over
+    const uint16_t lost[] = { 5, 17, 29 };
+    for (size_t ix = 0; ix < 5; ix++) {
+        run_session(lost, sizeof(lost) / sizeof(lost[0]));
+    }
+}
+
+void test_signature() {
+    run_session(NULL, 0, true);
+}
+
+Case cases[] = {
+    Case("frames back to back, no loss", test_no_loss),
+    Case("frames back to back, with loss", test_loss),
+    Case("frames back to back, repeated sessions", test_repeated),
+    Case("signature verified in slices", test_signature)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    return fragmentation_test_setup(number_of_cases, 5 * 60);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
@@ -0,0 +1,109 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "mbed.h"
+#include <greentea-client/test_env.h>
+#include <utest/utest.h>
+#include <unity/unity.h>
+
+using namespace utest::v1;
+
+#include "FragmentationXor.h"
+
+// Fragment size used by test-fw/create-packets-h.js
+#define FRAGMENT_SIZE       204
+#define BENCH_ITERATIONS    5000
+
+static uint8_t row_a[FRAGMENT_SIZE + 64];
+static uint8_t row_b[FRAGMENT_SIZE + 64];
+static uint8_t expected[FRAGMENT_SIZE + 64];
+
+static void fill_rows() {
+    for (size_t ix = 0; ix < sizeof(row_a); ix++) {
+        row_a[ix] = (uint8_t)(ix * 7 + 3);
+        row_b[ix] = (uint8_t)(ix * 13 + 5);
+    }
+}
+
+static void check_kernel(frag_xor_fn kernel, const char* name) {
+    // every length up to one fragment, with every combination of misalignment
+    for (size_t len = 0; len <= FRAGMENT_SIZE; len++) {
+        for (size_t dst_off = 0; dst_off < 4; dst_off++) {
+            for (size_t src_off = 0; src_off < 4; src_off++) {
+                fill_rows();
+                memcpy(expected, row_a, sizeof(expected));
+                frag_xor_bytes(expected + dst_off, row_b + src_off, len);
+
+                kernel(row_a + dst_off, row_b + src_off, len);
+
+                TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, row_a, sizeof(row_a), name);
+            }
+        }
+    }
+}
+
+void test_word_kernel() {
+    check_kernel(frag_xor_words, "word32");
+}
+
+void test_selected_kernel() {
+    check_kernel(frag_xor, frag_xor_kernel_name());
+}
+
+static int bench_kernel(frag_xor_fn kernel) {
+    Timer t;
+    t.start();
+    for (size_t ix = 0; ix < BENCH_ITERATIONS; ix++) {
+        kernel(row_a, row_b, FRAGMENT_SIZE);
+    }
+    t.stop();
+    return t.read_us();
+}
+
+void test_benchmark() {
+    fill_rows();
+
+    int byte_us = bench_kernel(frag_xor_bytes);
+    int word_us = bench_kernel(frag_xor_words);
+    int selected_us = bench_kernel(frag_xor);
+
+    printf("XOR of %d x %d bytes:\n", BENCH_ITERATIONS, FRAGMENT_SIZE);
+    printf("  byte:   %d us\n", byte_us);
+    printf("  word32: %d us\n", word_us);
+    printf("  %s: %d us (selected)\n", frag_xor_kernel_name(), selected_us);
+
+    // keep the compiler from dropping the benchmark loops
+    volatile uint8_t sink = row_a[FRAGMENT_SIZE - 1];
+    (void)sink;
+}
+
+Case cases[] = {
+    Case("word kernel matches byte loop", test_word_kernel),
+    Case("selected kernel matches byte loop", test_selected_kernel),
+    Case("benchmark 204 byte fragments", test_benchmark)
+};
+
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(2 * 60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+Specification specification(greentea_setup, cases);
+
+int main() {
+    Harness::run(specification);
+}
@@ -27,11 +27,15 @@
 #define MBEDTLS_REMOVE_ARC4_CIPHERSUITES
 #define MBEDTLS_ECP_DP_SECP256R1_ENABLED
 #define MBEDTLS_ECDSA_DETERMINISTIC
+#define MBEDTLS_ECP_RESTARTABLE
 #define MBEDTLS_NO_PLATFORM_ENTROPY
+/* Encrypted firmware, AES-CTR. Keep the AES tables in flash rather than generating them in RAM */
+#define MBEDTLS_CIPHER_MODE_CTR
+#define MBEDTLS_AES_ROM_TABLES
 
+#define MBEDTLS_AES_C
 #define MBEDTLS_ASN1_PARSE_C
 #define MBEDTLS_ASN1_WRITE_C
-#define MBEDTLS_BASE64_C
 #define MBEDTLS_BIGNUM_C
 #define MBEDTLS_ECDSA_C
 #define MBEDTLS_ECP_C
@@ -39,12 +43,21 @@
 #define MBEDTLS_HMAC_DRBG_C
 #define MBEDTLS_MD_C
 #define MBEDTLS_OID_C
-#define MBEDTLS_PEM_PARSE_C
-#define MBEDTLS_PK_C
-#define MBEDTLS_PK_PARSE_C
 #define MBEDTLS_PLATFORM_C
 #define MBEDTLS_SHA256_C
 
+/* Pool for the allocations of mbed TLS during signature verification, see FragmentationCryptoPool.h. 0 allocates from the heap */
+#ifndef FOTALORA_MBEDTLS_POOL_SIZE
+#define FOTALORA_MBEDTLS_POOL_SIZE 0
+#endif
+
+#if FOTALORA_MBEDTLS_POOL_SIZE > 0
+#define MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_MEMORY_BUFFER_ALLOC_C
+/* Peak and current usage per stage */
+#define MBEDTLS_MEMORY_DEBUG
+#endif
+
 #include "check_config.h"
 
 #endif /* FOTALORA_MBEDTLS_CONFIG_H */
@@ -0,0 +1,224 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_BIT_MATRIX_H_
+#define _FRAGMENTATION_BIT_MATRIX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Packed bitsets for the parity-check matrix, 64-bit words on 64-bit hosts and 32-bit words on the MCU.
+ * Bit `n` lives in word `n / FRAG_BITS_PER_WORD`, at position `n % FRAG_BITS_PER_WORD` (LSB first).
+ */
+#if defined(__LP64__) || defined(_WIN64)
+typedef uint64_t frag_bits_t;
+#define FRAG_BITS_CTZ(w)        __builtin_ctzll(w)
+#else
+typedef uint32_t frag_bits_t;
+#define FRAG_BITS_CTZ(w)        __builtin_ctz(w)
+#endif
+
+#define FRAG_BITS_PER_WORD      (sizeof(frag_bits_t) * 8)
+#define FRAG_BITS_NONE          (-1)
+
+static inline size_t frag_bits_words(size_t bits) {
+    return (bits + FRAG_BITS_PER_WORD - 1) / FRAG_BITS_PER_WORD;
+}
+
+static inline bool frag_bits_get(const frag_bits_t* bits, size_t n) {
+    return (bits[n / FRAG_BITS_PER_WORD] >> (n % FRAG_BITS_PER_WORD)) & 1;
+}
+
+static inline void frag_bits_set(frag_bits_t* bits, size_t n) {
+    bits[n / FRAG_BITS_PER_WORD] |= ((frag_bits_t)1) << (n % FRAG_BITS_PER_WORD);
+}
+
+static inline void frag_bits_clear(frag_bits_t* bits, size_t n) {
+    bits[n / FRAG_BITS_PER_WORD] &= ~(((frag_bits_t)1) << (n % FRAG_BITS_PER_WORD));
+}
+
+/**
+ * Find the first set bit at or after `from`
+ * @returns the bit index, or FRAG_BITS_NONE if no bit in [from, nbits) is set
+ */
+static inline int frag_bits_find_first(const frag_bits_t* bits, size_t nbits, size_t from) {
+    if (from >= nbits) return FRAG_BITS_NONE;
+
+    size_t word = from / FRAG_BITS_PER_WORD;
+    frag_bits_t w = bits[word] & (~((frag_bits_t)0) << (from % FRAG_BITS_PER_WORD));
+    size_t words = frag_bits_words(nbits);
+
+    while (true) {
+        if (w != 0) {
+            size_t n = word * FRAG_BITS_PER_WORD + FRAG_BITS_CTZ(w);
+            return n < nbits ? (int)n : FRAG_BITS_NONE;
+        }
+        if (++word >= words) return FRAG_BITS_NONE;
+        w = bits[word];
+    }
+}
+
+/**
+ * Find the first cleared bit at or after `from`
+ * @returns the bit index, or FRAG_BITS_NONE if every bit in [from, nbits) is set
+ */
+static inline int frag_bits_find_first_zero(const frag_bits_t* bits, size_t nbits, size_t from) {
+    if (from >= nbits) return FRAG_BITS_NONE;
+
+    size_t word = from / FRAG_BITS_PER_WORD;
+    frag_bits_t w = ~bits[word] & (~((frag_bits_t)0) << (from % FRAG_BITS_PER_WORD));
+    size_t words = frag_bits_words(nbits);
+
+    while (true) {
+        if (w != 0) {
+            size_t n = word * FRAG_BITS_PER_WORD + FRAG_BITS_CTZ(w);
+            return n < nbits ? (int)n : FRAG_BITS_NONE;
+        }
+        if (++word >= words) return FRAG_BITS_NONE;
+        w = ~bits[word];
+    }
+}
+
+/**
+ * Number of set bits in [0, nbits)
+ */
+static inline size_t frag_bits_count(const frag_bits_t* bits, size_t nbits) {
+    size_t count = 0;
+    size_t full = nbits / FRAG_BITS_PER_WORD;
+    for (size_t ix = 0; ix < full; ix++) {
+        count += __builtin_popcountll(bits[ix]);
+    }
+    if (nbits % FRAG_BITS_PER_WORD) {
+        frag_bits_t mask = (((frag_bits_t)1) << (nbits % FRAG_BITS_PER_WORD)) - 1;
+        count += __builtin_popcountll(bits[full] & mask);
+    }
+    return count;
+}
+
+/**
+ * Binary matrix with every row stored as a packed bitset.
+ * Row operations work on whole words, which is what keeps Gaussian elimination over GF(2) cheap.
+ */
+class FragmentationBitMatrix {
+public:
+    FragmentationBitMatrix()
+        : _bits(NULL), _rows(0), _cols(0), _stride(0)
+    {
+    }
+
+    ~FragmentationBitMatrix() {
+        if (_bits) free(_bits);
+    }
+
+    /**
+     * Allocate a zeroed rows x cols matrix, releases any previous allocation
+     * @returns true if the allocation succeeded
+     */
+    bool allocate(size_t rows, size_t cols) {
+        if (_bits) free(_bits);
+
+        _rows = rows;
+        _cols = cols;
+        _stride = frag_bits_words(cols);
+        _bits = (frag_bits_t*)calloc(_rows * _stride == 0 ? 1 : _rows * _stride, sizeof(frag_bits_t));
+
+        return _bits != NULL;
+    }
+
+    /**
+     * Number of bytes a rows x cols matrix takes up
+     */
+    static size_t get_size(size_t rows, size_t cols) {
+        return rows * frag_bits_words(cols) * sizeof(frag_bits_t);
+    }
+
+    size_t get_size() const {
+        return _rows * _stride * sizeof(frag_bits_t);
+    }
+
+    size_t rows() const { return _rows; }
+    size_t cols() const { return _cols; }
+    size_t words_per_row() const { return _stride; }
+
+    frag_bits_t* row(size_t r) {
+        return _bits + (r * _stride);
+    }
+
+    const frag_bits_t* row(size_t r) const {
+        return _bits + (r * _stride);
+    }
+
+    bool get(size_t r, size_t c) const {
+        return frag_bits_get(row(r), c);
+    }
+
+    void set(size_t r, size_t c) {
+        frag_bits_set(row(r), c);
+    }
+
+    void clear_row(size_t r) {
+        memset(row(r), 0, _stride * sizeof(frag_bits_t));
+    }
+
+    bool row_empty(size_t r) const {
+        const frag_bits_t* w = row(r);
+        for (size_t ix = 0; ix < _stride; ix++) {
+            if (w[ix]) return false;
+        }
+        return true;
+    }
+
+    /**
+     * row(dst) ^= row(src)
+     *
+     * @param from_col Columns before this one are known to be zero in src, and are skipped
+     */
+    void xor_row(size_t dst, size_t src, size_t from_col = 0) {
+        frag_bits_t* d = row(dst);
+        const frag_bits_t* s = row(src);
+        for (size_t ix = from_col / FRAG_BITS_PER_WORD; ix < _stride; ix++) {
+            d[ix] ^= s[ix];
+        }
+    }
+
+    void copy_row(size_t dst, size_t src) {
+        memcpy(row(dst), row(src), _stride * sizeof(frag_bits_t));
+    }
+
+    /**
+     * Pivot search: first set column in row r at or after column `from`
+     * @returns column index or FRAG_BITS_NONE
+     */
+    int find_first(size_t r, size_t from = 0) const {
+        return frag_bits_find_first(row(r), _cols, from);
+    }
+
+private:
+    // owns its buffer, not copyable
+    FragmentationBitMatrix(const FragmentationBitMatrix&);
+    FragmentationBitMatrix& operator=(const FragmentationBitMatrix&);
+
+    frag_bits_t* _bits;
+    size_t _rows;
+    size_t _cols;
+    size_t _stride;
+};
+
+#endif // _FRAGMENTATION_BIT_MATRIX_H_
@@ -0,0 +1,157 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_CRYPTO_POOL_H_
+#define _FRAGMENTATION_CRYPTO_POOL_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_stats.h"
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+#ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+#include "mbedtls/memory_buffer_alloc.h"
+#include "mbedtls/platform.h"
+#endif
+
+/**
+ * Usage of one stage, in bytes and in blocks (allocations)
+ */
+typedef struct {
+    uint32_t peak_bytes;        // most bytes in use during the stage
+    uint32_t peak_blocks;
+    uint32_t current_bytes;     // bytes still in use at the end of the stage, should be 0
+    uint32_t current_blocks;
+} FragmentationCryptoPoolStats_t;
+
+/**
+ * Pool for the allocations of mbed TLS (bignum and ECP during signature verification), so they stay off the general
+ * heap. Enabled with MBEDTLS_MEMORY_BUFFER_ALLOC_C, see fotalora_mbedtls_config.h and fragmentation-crypto-pool-size.
+ *
+ * The pool is not a static buffer: a stage that needs one passes it to start_stage() (main.cpp takes it from the scratch
+ * arena for the ECDSA stage), and end_stage() hands mbed TLS back to the heap. Nothing that mbed TLS allocates during a
+ * stage may outlive it. Stages without a pool allocate from the heap.
+ *
+ * Wrap every stage in start_stage() / end_stage() to get the peak usage of that stage, which is what the pool has to
+ * be sized for. Without a pool the stats come from the heap (MBED_HEAP_STATS_ENABLED), and include other allocations.
+ *
+ * The pool is not thread safe, all mbed TLS calls need to come from the same thread.
+ */
+class FragmentationCryptoPool {
+public:
+    FragmentationCryptoPool() : _stage(NULL), _pool_size(0), _heap_start(0) {
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    /**
+     * Size of the pool of the current stage, or 0 if mbed TLS allocates from the heap
+     */
+    size_t get_size() {
+        return _pool_size;
+    }
+
+    /**
+     * Start tracking the peak usage of a stage
+     *
+     * @param name Name of the stage, for the debug output
+     * @param pool Buffer that mbed TLS allocates from until end_stage(), or NULL to use the heap
+     * @param pool_size Size of the buffer
+     */
+    void start_stage(const char* name, void* pool = NULL, size_t pool_size = 0) {
+        _stage = name;
+        _pool_size = 0;
+
+#ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+        if (pool && pool_size > 0) {
+            mbedtls_memory_buffer_alloc_init((unsigned char*)pool, pool_size);
+            _pool_size = pool_size;
+            return;
+        }
+#endif
+
+        mbed_stats_heap_t heap_stats;
+        mbed_stats_heap_get(&heap_stats);
+        _heap_start = heap_stats.current_size;
+    }
+
+    /**
+     * Stop tracking, and print the usage of the stage
+     */
+    void end_stage(FragmentationCryptoPoolStats_t* stats = NULL) {
+        FragmentationCryptoPoolStats_t s;
+        memset(&s, 0, sizeof(s));
+
+#ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+        if (_pool_size > 0) {
+#ifdef MBEDTLS_MEMORY_DEBUG
+            size_t used, blocks;
+            mbedtls_memory_buffer_alloc_max_get(&used, &blocks);
+            s.peak_bytes = used;
+            s.peak_blocks = blocks;
+            mbedtls_memory_buffer_alloc_cur_get(&used, &blocks);
+            s.current_bytes = used;
+            s.current_blocks = blocks;
+
+            debug("Crypto pool (%s): peak %lu bytes in %lu blocks, %lu bytes in use, pool is %u bytes\n",
+                _stage, s.peak_bytes, s.peak_blocks, s.current_bytes, _pool_size);
+#endif
+
+            // the buffer goes back to its owner, later mbed TLS calls use the heap again
+            mbedtls_memory_buffer_alloc_free();
+            mbedtls_platform_set_calloc_free(calloc, free);
+            _pool_size = 0;
+        }
+        else
+#endif
+        {
+            // the heap has no per-stage peak, this is the growth over the stage
+            mbed_stats_heap_t heap_stats;
+            mbed_stats_heap_get(&heap_stats);
+            s.current_bytes = heap_stats.current_size > _heap_start ? heap_stats.current_size - _heap_start : 0;
+
+            debug("Crypto on heap (%s): %lu bytes more in use, heap peak %lu bytes\n",
+                _stage, s.current_bytes, (uint32_t)heap_stats.max_size);
+        }
+
+        if (s.peak_bytes > _stats.peak_bytes) {
+            _stats.peak_bytes = s.peak_bytes;
+            _stats.peak_blocks = s.peak_blocks;
+        }
+
+        if (stats) {
+            *stats = s;
+        }
+    }
+
+    /**
+     * Highest peak of all stages so far
+     */
+    uint32_t get_peak() {
+        return _stats.peak_bytes;
+    }
+
+private:
+    const char* _stage;
+    size_t _pool_size;          // size of the pool of the current stage, 0 outside of a stage or on the heap
+    uint32_t _heap_start;
+    FragmentationCryptoPoolStats_t _stats;
+};
+
+#endif // _FRAGMENTATION_CRYPTO_POOL_H_
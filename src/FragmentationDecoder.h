@@ -0,0 +1,537 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_DECODER_H_
+#define _FRAGMENTATION_DECODER_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "FragmentationBitMatrix.h"
+#include "FragmentationJournal.h"
+#include "FragmentationMatrixLine.h"
+#include "FragmentationVerifier.h"
+#include "FragmentationXor.h"
+
+// Not a result of mbed-lorawan-frag-lib: more fragments were lost than the session has redundancy packets,
+// so the lost fragments can't be recovered
+#define FRAG_TOO_MANY_LOST          ((FragResult)(FRAG_COMPLETE + 1))
+
+/**
+ * Fragmentation session with a bit-packed parity-check matrix.
+ *
+ * Uncoded fragments are written straight to their place in flash. When the first redundancy frame
+ * comes in the set of lost fragments is fixed, and every redundancy frame is reduced to a row over
+ * the lost fragments only (the fragments we already have are XOR'ed out of the payload right away).
+ * That keeps the matrix at lost x lost bits, rather than redundancy x NumberOfFragments bytes.
+ *
+ * The matrix is kept in echelon form while frames come in: every new row is reduced against the rows
+ * we already hold, and stored as the pivot row for the first column it still has a coefficient in.
+ * The pivot row for column `n` lives in flash in the slot of the `n`th lost fragment, so payloads never
+ * need RAM beyond two fragment buffers. Each frame costs at most one flash read per pivot row, and once
+ * every column has a pivot only a back-substitution is left before the session completes.
+ *
+ * With a FragmentationJournal the bookkeeping is mirrored to flash, and resume() picks the session up
+ * again after a reset without reading back any of the stored fragments.
+ *
+ * API is compatible with FragmentationSession from mbed-lorawan-frag-lib.
+ */
+class FragmentationDecoder {
+public:
+    /**
+     * Create a new decoder
+     *
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param opts Options for the session, normally obtained from FragSessionSetupReq
+     * @param journal Optional journal to make the session resumable
+     * @param xor_fn XOR kernel used to combine fragments
+     */
+    FragmentationDecoder(FragmentationBlockDeviceWrapper* flash, FragmentationSessionOpts_t opts,
+                         FragmentationJournal* journal = NULL, frag_xor_fn xor_fn = frag_xor)
+        : _flash(flash), _opts(opts), _journal(journal), _xor(xor_fn), _verifier(NULL),
+          _received(NULL), _line(NULL), _buffer(NULL), _scratch(NULL),
+          _received_count(0), _coding(false), _complete(false),
+          _lost(0), _lost_index(NULL), _has_pivot(NULL), _pivot_count(0)
+    {
+    }
+
+    ~FragmentationDecoder() {
+        if (_received) free(_received);
+        if (_line) free(_line);
+        if (_buffer) free(_buffer);
+        if (_scratch) free(_scratch);
+        if (_lost_index) free(_lost_index);
+        if (_has_pivot) free(_has_pivot);
+    }
+
+    /**
+     * Allocate the buffers for a new session, and start a new journal if there is one
+     *
+     * @returns FRAG_OK if succeeded, FRAG_NO_MEMORY if allocation failed
+     */
+    FragResult initialize() {
+        FragResult r = allocate();
+        if (r != FRAG_OK) return r;
+
+        if (_journal && _journal->start(_opts) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        return FRAG_OK;
+    }
+
+    /**
+     * Resume the session from the journal. If the journal does not hold a session with the same
+     * options this starts a new session, like initialize().
+     *
+     * @returns FRAG_OK if the session can take frames, FRAG_COMPLETE if the session was already
+     *          complete, or an error code
+     */
+    FragResult resume() {
+        if (!_journal || !_journal->load() || !_journal->matches(_opts)) {
+            return initialize();
+        }
+
+        FragResult r = allocate();
+        if (r != FRAG_OK) return r;
+
+        if (_journal->load_received(_received) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+        _received_count = frag_bits_count(_received, _opts.NumberOfFragments);
+
+        FragmentationJournalState state = _journal->get_state();
+
+        debug("FragmentationDecoder: resuming session, %d of %d fragments received\n",
+            _received_count, _opts.NumberOfFragments);
+
+        if (state == FRAG_JOURNAL_COMPLETE) {
+            _complete = true;
+            return FRAG_COMPLETE;
+        }
+
+        if (state == FRAG_JOURNAL_RECEIVING) {
+            // reset right after the last fragment was stored
+            return _received_count == _opts.NumberOfFragments ? complete(FRAG_BITS_NONE) : FRAG_OK;
+        }
+
+        if (_journal->get_lost() != _opts.NumberOfFragments - _received_count) {
+            debug("FragmentationDecoder: journal is inconsistent, starting a new session\n");
+            _received_count = 0;
+            memset(_received, 0, frag_bits_words(_opts.NumberOfFragments) * sizeof(frag_bits_t));
+            if (_journal->start(_opts) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+            return FRAG_OK;
+        }
+
+        r = start_coding();
+        if (r != FRAG_OK) return r;
+
+        for (uint16_t col = 0; col < _lost; col++) {
+            if (_journal->load_row(col, _matrix.row(col))) {
+                frag_bits_set(_has_pivot, col);
+                _pivot_count++;
+            }
+        }
+
+        debug("FragmentationDecoder: %d of %d lost fragments have a pivot row\n", _pivot_count, _lost);
+
+        if (state == FRAG_JOURNAL_CODING) {
+            // reset right after the last pivot row was stored
+            return _pivot_count == _lost ? complete(_lost - 1) : FRAG_OK;
+        }
+
+        // reset during back-substitution, the columns above solve_col are solved. A reset while the solution
+        // for solve_col was programmed might have left its slot half written, so copy it from the journal again.
+        int col = _journal->get_solve_col();
+        if (_pivot_count != _lost || col >= _lost) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        if (col >= 0 && _journal->is_solution_pending()) {
+            if (_journal->load_solution(_buffer) != BD_ERROR_OK ||
+                    _flash->program(_buffer, get_slot_address(col), _opts.FragmentSize) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+            col--;
+        }
+
+        return complete(col);
+    }
+
+    /**
+     * Process a fragmentation frame
+     *
+     * @param frameCounter The frame counter for this frame (1-based)
+     * @param buffer Frame payload, without the fragmentation header
+     * @param size Size of the buffer, should be equal to FragmentSize
+     *
+     * @returns FRAG_OK if the frame was processed, FRAG_COMPLETE if all fragments are in flash,
+     *          FRAG_TOO_MANY_LOST if a redundancy frame came in while more fragments were lost than
+     *          can be recovered, or an error code
+     */
+    FragResult process_frame(uint16_t frameCounter, uint8_t* buffer, size_t size) {
+        if (size != _opts.FragmentSize) {
+            return FRAG_SIZE_INCORRECT;
+        }
+
+        if (_complete) {
+            return FRAG_COMPLETE;
+        }
+
+        if (frameCounter == 0) {
+            return FRAG_OK;
+        }
+
+        // uncoded fragment
+        if (frameCounter <= _opts.NumberOfFragments) {
+            uint16_t index = frameCounter - 1;
+
+            if (frag_bits_get(_received, index)) {
+                return FRAG_OK;
+            }
+
+            if (!_coding) {
+                if (_flash->program(buffer, get_fragment_address(index), size) != BD_ERROR_OK) {
+                    return FRAG_FLASH_WRITE_ERROR;
+                }
+
+                frag_bits_set(_received, index);
+                _received_count++;
+
+                // advances the watermark if this fragment is next in line
+                if (_verifier) {
+                    _verifier->update_at(get_fragment_address(index), buffer, size);
+                }
+
+                if (_journal && _journal->mark_received(_received, index) != BD_ERROR_OK) {
+                    return FRAG_FLASH_WRITE_ERROR;
+                }
+
+                if (_received_count == _opts.NumberOfFragments) {
+                    return complete(FRAG_BITS_NONE);
+                }
+                return FRAG_OK;
+            }
+
+            // a late uncoded fragment is a row with a single coefficient
+            _matrix.clear_row(_lost);
+            _matrix.set(_lost, get_lost_column(index));
+            memcpy(_buffer, buffer, size);
+
+            return add_row();
+        }
+
+        // redundancy frame
+        if (!_coding) {
+            FragResult r = start_coding();
+            if (r != FRAG_OK) return r;
+
+            if (_journal && _journal->start_coding(_lost) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+        }
+
+        _matrix.clear_row(_lost);
+        memcpy(_buffer, buffer, size);
+
+        frag_matrix_line(frameCounter - _opts.NumberOfFragments, _opts.NumberOfFragments, _line);
+
+        // XOR the fragments we have out of the payload, the ones we miss make up the matrix row
+        int fragment = frag_bits_find_first(_line, _opts.NumberOfFragments, 0);
+        while (fragment != FRAG_BITS_NONE) {
+            if (frag_bits_get(_received, fragment)) {
+                if (_flash->read(_scratch, get_fragment_address(fragment), size) != BD_ERROR_OK) {
+                    return FRAG_FLASH_WRITE_ERROR;
+                }
+                _xor(_buffer, _scratch, size);
+            }
+            else {
+                _matrix.set(_lost, get_lost_column(fragment));
+            }
+
+            fragment = frag_bits_find_first(_line, _opts.NumberOfFragments, fragment + 1);
+        }
+
+        return add_row();
+    }
+
+    /**
+     * Hash uncoded fragments that arrive in order while they come in, so there is little left to read
+     * back when the session completes. The verifier needs to be started on this session's storage.
+     */
+    void set_verifier(FragmentationVerifier* verifier) {
+        _verifier = verifier;
+    }
+
+    /**
+     * Whether all fragments are in flash
+     */
+    bool is_complete() {
+        return _complete;
+    }
+
+    /**
+     * Whether a fragment is in flash, received uncoded or (once the session is complete) recovered
+     *
+     * @param index Index of the fragment, starting at 0
+     */
+    bool is_received(uint16_t index) {
+        return _complete || (index < _opts.NumberOfFragments && frag_bits_get(_received, index));
+    }
+
+    /**
+     * Number of fragments that were not received as uncoded frames
+     */
+    int get_lost_frame_count() {
+        return _opts.NumberOfFragments - _received_count;
+    }
+
+    /**
+     * Number of bytes this session has allocated on the heap
+     */
+    size_t get_memory_usage() {
+        size_t bitmap = frag_bits_words(_opts.NumberOfFragments) * sizeof(frag_bits_t);
+
+        size_t total = (2 * bitmap) + (2 * _opts.FragmentSize);
+        if (_coding) {
+            total += _matrix.get_size()
+                + (_lost * sizeof(uint16_t))
+                + (frag_bits_words(_lost) * sizeof(frag_bits_t));
+        }
+        return total;
+    }
+
+    /**
+     * Human readable description of a FragResult, including FRAG_TOO_MANY_LOST
+     */
+    static const char* frag_result_string(FragResult result) {
+        if (result == FRAG_TOO_MANY_LOST) {
+            return "More fragments lost than redundancy packets";
+        }
+        return FragmentationSession::frag_result_string(result);
+    }
+
+    /**
+     * Number of bytes a parity-check matrix with one byte per coefficient (redundancy x NumberOfFragments)
+     * would take up for these options, for comparison with get_memory_usage()
+     */
+    static size_t get_byte_matrix_size(FragmentationSessionOpts_t opts) {
+        return (size_t)opts.RedundancyPackets * opts.NumberOfFragments;
+    }
+
+private:
+    FragResult allocate() {
+        if (_opts.NumberOfFragments == 0 || _opts.FragmentSize == 0) {
+            return FRAG_SIZE_INCORRECT;
+        }
+
+        _received = (frag_bits_t*)calloc(frag_bits_words(_opts.NumberOfFragments), sizeof(frag_bits_t));
+        _line = (frag_bits_t*)calloc(frag_bits_words(_opts.NumberOfFragments), sizeof(frag_bits_t));
+        _buffer = (uint8_t*)malloc(_opts.FragmentSize);
+        _scratch = (uint8_t*)malloc(_opts.FragmentSize);
+
+        if (!_received || !_line || !_buffer || !_scratch) {
+            return FRAG_NO_MEMORY;
+        }
+
+        return FRAG_OK;
+    }
+
+    /**
+     * Freeze the set of lost fragments and allocate the lost x lost matrix, plus one row to build incoming rows in
+     */
+    FragResult start_coding() {
+        _lost = _opts.NumberOfFragments - _received_count;
+
+        if (_lost > _opts.RedundancyPackets) {
+            debug("FragmentationDecoder: %d fragments lost, but only %d redundancy packets\n", _lost, _opts.RedundancyPackets);
+            return FRAG_TOO_MANY_LOST;
+        }
+
+        _lost_index = (uint16_t*)malloc(_lost * sizeof(uint16_t));
+        _has_pivot = (frag_bits_t*)calloc(frag_bits_words(_lost), sizeof(frag_bits_t));
+
+        if (!_lost_index || !_has_pivot || !_matrix.allocate(_lost + 1, _lost)) {
+            return FRAG_NO_MEMORY;
+        }
+
+        uint16_t lost = 0;
+        for (uint16_t ix = 0; ix < _opts.NumberOfFragments; ix++) {
+            if (!frag_bits_get(_received, ix)) {
+                _lost_index[lost++] = ix;
+            }
+        }
+
+        _coding = true;
+        return FRAG_OK;
+    }
+
+    /**
+     * Reduce the row that was built in matrix row `_lost` (payload in `_buffer`) against the pivot rows,
+     * and store it as the pivot row for the first column that is left.
+     */
+    FragResult add_row() {
+        const size_t size = _opts.FragmentSize;
+        const uint16_t row = _lost;
+
+        int col = _matrix.find_first(row);
+        while (col != FRAG_BITS_NONE && frag_bits_get(_has_pivot, col)) {
+            // pivot row `col` has no coefficients before `col`
+            _matrix.xor_row(row, col, col);
+
+            if (_flash->read(_scratch, get_slot_address(col), size) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+            _xor(_buffer, _scratch, size);
+
+            col = _matrix.find_first(row, col + 1);
+        }
+
+        if (col == FRAG_BITS_NONE) {
+            // linear combination of rows we already have
+            return FRAG_OK;
+        }
+
+        if (_flash->program(_buffer, get_slot_address(col), size) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        _matrix.copy_row(col, row);
+
+        if (_journal && _journal->store_row(col, _matrix.row(col)) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        frag_bits_set(_has_pivot, col);
+        _pivot_count++;
+
+        if (_pivot_count < _lost) {
+            return FRAG_OK;
+        }
+
+        return complete(_lost - 1);
+    }
+
+    /**
+     * Run back-substitution (if needed) and mark the session as complete
+     *
+     * @param from_col Last column that still needs back-substitution, or FRAG_BITS_NONE
+     */
+    FragResult complete(int from_col) {
+        if (from_col != FRAG_BITS_NONE) {
+            if (_journal && _journal->set_solving(from_col) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+
+            FragResult r = back_substitute(from_col);
+            if (r != FRAG_OK) return r;
+        }
+
+        if (_journal && _journal->set_state(FRAG_JOURNAL_COMPLETE) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        _complete = true;
+        return FRAG_COMPLETE;
+    }
+
+    /**
+     * Every column has a pivot and the matrix is upper triangular, solve from `from_col` up to the first lost fragment.
+     * A solved column can't be solved again, so every solution goes to the journal before it is programmed,
+     * and progress after.
+     */
+    FragResult back_substitute(int from_col) {
+        const size_t size = _opts.FragmentSize;
+
+        for (int col = from_col; col >= 0; col--) {
+            int other = _matrix.find_first(col, col + 1);
+            if (other == FRAG_BITS_NONE) continue;
+
+            if (_flash->read(_buffer, get_slot_address(col), size) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+
+            while (other != FRAG_BITS_NONE) {
+                if (_flash->read(_scratch, get_slot_address(other), size) != BD_ERROR_OK) {
+                    return FRAG_FLASH_WRITE_ERROR;
+                }
+                _xor(_buffer, _scratch, size);
+
+                other = _matrix.find_first(col, other + 1);
+            }
+
+            if (_journal && _journal->store_solution(col, _buffer) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+
+            if (_flash->program(_buffer, get_slot_address(col), size) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+
+            if (_journal && _journal->set_solving(col - 1) != BD_ERROR_OK) {
+                return FRAG_FLASH_WRITE_ERROR;
+            }
+        }
+
+        return FRAG_OK;
+    }
+
+    /**
+     * Column in the matrix for a lost fragment
+     */
+    uint16_t get_lost_column(uint16_t fragment) {
+        uint16_t lo = 0, hi = _lost;
+        while (lo < hi) {
+            uint16_t mid = lo + ((hi - lo) / 2);
+            if (_lost_index[mid] < fragment) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    bd_addr_t get_fragment_address(uint16_t fragment) {
+        return _opts.FlashOffset + ((bd_addr_t)fragment * _opts.FragmentSize);
+    }
+
+    bd_addr_t get_slot_address(uint16_t slot) {
+        return get_fragment_address(_lost_index[slot]);
+    }
+
+    FragmentationBlockDeviceWrapper* _flash;
+    FragmentationSessionOpts_t _opts;
+    FragmentationJournal* _journal;
+    frag_xor_fn _xor;
+    FragmentationVerifier* _verifier;
+
+    frag_bits_t* _received;         // bitmap of uncoded fragments that were received
+    frag_bits_t* _line;             // scratch for matrix_line
+    uint8_t* _buffer;               // FragmentSize
+    uint8_t* _scratch;              // FragmentSize
+    uint16_t _received_count;
+    bool _coding;                   // set when the first redundancy frame came in
+    bool _complete;
+
+    uint16_t _lost;                 // number of lost fragments, fixed when coding starts
+    uint16_t* _lost_index;          // column -> fragment index
+    frag_bits_t* _has_pivot;        // columns that have a pivot row
+    uint16_t _pivot_count;
+    FragmentationBitMatrix _matrix; // (lost + 1) x lost, last row is where incoming rows are built
+};
+
+#endif // _FRAGMENTATION_DECODER_H_
@@ -0,0 +1,116 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_DECOMPRESS_H_
+#define _FRAGMENTATION_DECOMPRESS_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "FragmentationDecompressCore.h"
+
+/**
+ * Streaming decompressor for compressed firmware. Reads the compressed data from flash and programs the output to
+ * flash every time the window fills up, so RAM use is the window and the read buffer, whatever the size of the
+ * firmware. The format is described in FragmentationDecompressCore.
+ */
+class FragmentationDecompress : public FragmentationDecompressCore {
+public:
+    /**
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param window Window buffer, size must be a power of 2
+     * @param window_size Size of the window buffer
+     * @param read_buffer Buffer to read the compressed data into
+     * @param read_buffer_size Size of the read buffer
+     */
+    FragmentationDecompress(FragmentationBlockDeviceWrapper* flash, uint8_t* window, size_t window_size,
+                            uint8_t* read_buffer, size_t read_buffer_size)
+        : FragmentationDecompressCore(window, window_size), _flash(flash), _window(window), _window_size(window_size),
+          _read(read_buffer), _read_size(read_buffer_size), _src_offset(0), _src_end(0), _target_offset(0), _written(0)
+    {
+    }
+
+    /**
+     * Decompress
+     *
+     * @param src_offset Address of the compressed data in flash
+     * @param src_size Size of the compressed data
+     * @param target_offset Address in flash to write the output to, must not overlap the compressed data
+     * @param target_max Size of the region at target_offset
+     * @param out_size Receives the size of the output
+     */
+    FragmentationDecompressResult inflate(bd_addr_t src_offset, size_t src_size,
+                                          bd_addr_t target_offset, size_t target_max, size_t* out_size) {
+        _src_offset = src_offset;
+        _src_end = src_offset + src_size;
+        _target_offset = target_offset;
+        _written = 0;
+
+        FragmentationDecompressResult r = FragmentationDecompressCore::inflate(target_max, out_size);
+
+        if (r == FRAG_DECOMPRESS_WINDOW) {
+            debug("FragmentationDecompress: needs a window of 2^%u bytes, have %u bytes\n", get_window_bits(), _window_size);
+        }
+        else if (r == FRAG_DECOMPRESS_TOO_LARGE) {
+            debug("FragmentationDecompress: output is %lu bytes, only %u bytes available\n", get_output_size(), target_max);
+        }
+
+        return r;
+    }
+
+    /**
+     * Copy a region of flash through the window, e.g. to move the compressed data out of the way of the output
+     */
+    FragmentationDecompressResult copy(bd_addr_t from, bd_addr_t to, size_t size) {
+        for (size_t offset = 0; offset < size; offset += _window_size) {
+            size_t len = size - offset < _window_size ? size - offset : _window_size;
+
+            if (_flash->read(_window, from + offset, len) != BD_ERROR_OK) return FRAG_DECOMPRESS_FLASH_ERROR;
+            if (_flash->program(_window, to + offset, len) != BD_ERROR_OK) return FRAG_DECOMPRESS_FLASH_ERROR;
+        }
+        return FRAG_DECOMPRESS_OK;
+    }
+
+protected:
+    virtual FragmentationDecompressResult refill(const uint8_t** data, size_t* size) {
+        *size = _src_end - _src_offset < _read_size ? _src_end - _src_offset : _read_size;
+        *data = _read;
+
+        if (*size > 0 && _flash->read(_read, _src_offset, *size) != BD_ERROR_OK) return FRAG_DECOMPRESS_FLASH_ERROR;
+        _src_offset += *size;
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    virtual FragmentationDecompressResult flush(const uint8_t* data, size_t size) {
+        if (_flash->program(data, _target_offset + _written, size) != BD_ERROR_OK) return FRAG_DECOMPRESS_FLASH_ERROR;
+        _written += size;
+        return FRAG_DECOMPRESS_OK;
+    }
+
+private:
+    FragmentationBlockDeviceWrapper* _flash;
+    uint8_t* _window;
+    size_t _window_size;
+    uint8_t* _read;
+    size_t _read_size;
+    bd_addr_t _src_offset;      // next address to read the compressed data from
+    bd_addr_t _src_end;
+    bd_addr_t _target_offset;
+    size_t _written;
+};
+
+#endif // _FRAGMENTATION_DECOMPRESS_H_
@@ -0,0 +1,220 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_DECOMPRESS_CORE_H_
+#define _FRAGMENTATION_DECOMPRESS_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum FragmentationDecompressResult {
+    FRAG_DECOMPRESS_OK = 0,
+    FRAG_DECOMPRESS_FLASH_ERROR = -1,   // reading the compressed data or programming the output failed
+    FRAG_DECOMPRESS_CORRUPT = -2,       // truncated data, or a match before the start of the output
+    FRAG_DECOMPRESS_TOO_LARGE = -3,     // the output does not fit in the target region
+    FRAG_DECOMPRESS_WINDOW = -4         // the data was compressed with a larger window than we have
+};
+
+/**
+ * Decompressor for compressed firmware, without dependencies on Mbed OS so host tools (test-fw/verify-package)
+ * decompress exactly like the device. The output goes through a window (ring buffer), which also holds the history
+ * that matches copy from, and is handed to flush() every time the window fills up. The compressed data comes in
+ * through refill(). See FragmentationDecompress for the device, which reads from and writes to flash.
+ *
+ * The data starts with the size of the output (unsigned LEB128, see FragmentationPatchCore) and a byte with the log2
+ * of the window that the compressor used. Then follow LZ4 style sequences until the output is complete:
+ *
+ *     token                high nibble is the literal length, low nibble the match length - 4 (15 means more follows)
+ *     [length bytes]       literal length - 15, in bytes of 255 and a final byte < 255
+ *     literals
+ *     offset               2 bytes, little endian, the distance back into the output (1 .. window size)
+ *     [length bytes]       match length - 19, as above
+ *
+ * The last sequence has literals only. Matches may overlap the bytes they produce (offset < length).
+ */
+class FragmentationDecompressCore {
+public:
+    /**
+     * @param window Window buffer, size must be a power of 2
+     * @param window_size Size of the window buffer
+     */
+    FragmentationDecompressCore(uint8_t* window, size_t window_size)
+        : _window(window), _window_size(window_size), _input(NULL), _input_pos(0), _input_len(0), _window_pos(0),
+          _size(0), _window_bits(0)
+    {
+    }
+
+    virtual ~FragmentationDecompressCore() {
+    }
+
+    /**
+     * Decompress everything refill() returns
+     *
+     * @param target_max Maximum size of the output
+     * @param out_size Receives the size of the output
+     */
+    FragmentationDecompressResult inflate(size_t target_max, size_t* out_size) {
+        _input_pos = _input_len = 0;
+        _window_pos = 0;
+
+        FragmentationDecompressResult r;
+        if ((r = read_number(&_size)) != FRAG_DECOMPRESS_OK) return r;
+        if ((r = read_byte(&_window_bits)) != FRAG_DECOMPRESS_OK) return r;
+
+        if (_window_bits > 16 || (1UL << _window_bits) > _window_size) return FRAG_DECOMPRESS_WINDOW;
+
+        if (_size > target_max) return FRAG_DECOMPRESS_TOO_LARGE;
+
+        const uint32_t size = _size;
+        size_t total = 0;
+        const size_t mask = _window_size - 1;
+
+        while (true) {
+            uint8_t token;
+            uint32_t len;
+            if ((r = read_byte(&token)) != FRAG_DECOMPRESS_OK) return r;
+
+            if ((r = read_length(token >> 4, &len)) != FRAG_DECOMPRESS_OK) return r;
+            if (len > size - total) return FRAG_DECOMPRESS_CORRUPT;
+
+            for (uint32_t ix = 0; ix < len; ix++) {
+                if ((r = read_byte(&_window[_window_pos])) != FRAG_DECOMPRESS_OK) return r;
+                if ((r = advance()) != FRAG_DECOMPRESS_OK) return r;
+            }
+            total += len;
+
+            if (total == size) break;
+
+            uint8_t offset_bytes[2];
+            if ((r = read_byte(&offset_bytes[0])) != FRAG_DECOMPRESS_OK) return r;
+            if ((r = read_byte(&offset_bytes[1])) != FRAG_DECOMPRESS_OK) return r;
+            size_t offset = offset_bytes[0] | (offset_bytes[1] << 8);
+
+            if ((r = read_length(token & 0x0f, &len)) != FRAG_DECOMPRESS_OK) return r;
+            len += 4;
+
+            if (offset == 0 || offset > total || offset > _window_size || len > size - total) return FRAG_DECOMPRESS_CORRUPT;
+
+            for (uint32_t ix = 0; ix < len; ix++) {
+                _window[_window_pos] = _window[(_window_pos - offset) & mask];
+                if ((r = advance()) != FRAG_DECOMPRESS_OK) return r;
+            }
+            total += len;
+        }
+
+        // trailing data means the stream is not what the compressor wrote
+        if (_input_pos != _input_len) return FRAG_DECOMPRESS_CORRUPT;
+        if ((r = refill(&_input, &_input_len)) != FRAG_DECOMPRESS_OK) return r;
+        if (_input_len != 0) return FRAG_DECOMPRESS_CORRUPT;
+
+        if (_window_pos > 0 && (r = flush(_window, _window_pos)) != FRAG_DECOMPRESS_OK) return r;
+
+        *out_size = size;
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    /**
+     * Size of the output as stored in the compressed data, valid once inflate() got past the header
+     */
+    uint32_t get_output_size() {
+        return _size;
+    }
+
+    /**
+     * Log2 of the window that the data was compressed with, valid once inflate() got past the header
+     */
+    uint8_t get_window_bits() {
+        return _window_bits;
+    }
+
+protected:
+    /**
+     * Get the next part of the compressed data
+     *
+     * @param data Receives a pointer to the data, which stays valid until the next call
+     * @param size Receives the size of the data, 0 once all compressed data was returned
+     */
+    virtual FragmentationDecompressResult refill(const uint8_t** data, size_t* size) = 0;
+
+    /**
+     * Take the next part of the output
+     */
+    virtual FragmentationDecompressResult flush(const uint8_t* data, size_t size) = 0;
+
+private:
+    FragmentationDecompressResult read_byte(uint8_t* b) {
+        if (_input_pos == _input_len) {
+            _input_pos = 0;
+            FragmentationDecompressResult r = refill(&_input, &_input_len);
+            if (r != FRAG_DECOMPRESS_OK) return r;
+
+            if (_input_len == 0) return FRAG_DECOMPRESS_CORRUPT;
+        }
+
+        *b = _input[_input_pos++];
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    FragmentationDecompressResult read_number(uint32_t* value) {
+        *value = 0;
+        for (int shift = 0; shift < 32; shift += 7) {
+            uint8_t b;
+            FragmentationDecompressResult r = read_byte(&b);
+            if (r != FRAG_DECOMPRESS_OK) return r;
+
+            *value |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return FRAG_DECOMPRESS_OK;
+        }
+        return FRAG_DECOMPRESS_CORRUPT;
+    }
+
+    // a nibble of 15 is followed by bytes that are added, until one is < 255
+    FragmentationDecompressResult read_length(uint8_t nibble, uint32_t* len) {
+        *len = nibble;
+        if (nibble < 15) return FRAG_DECOMPRESS_OK;
+
+        uint8_t b;
+        do {
+            FragmentationDecompressResult r = read_byte(&b);
+            if (r != FRAG_DECOMPRESS_OK) return r;
+            *len += b;
+            if (*len > 0xffffff) return FRAG_DECOMPRESS_CORRUPT;
+        } while (b == 255);
+
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    // move to the next byte of the window, hand out the window when it's full
+    FragmentationDecompressResult advance() {
+        if (++_window_pos == _window_size) {
+            _window_pos = 0;
+            return flush(_window, _window_size);
+        }
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    uint8_t* _window;
+    size_t _window_size;
+    const uint8_t* _input;
+    size_t _input_pos;
+    size_t _input_len;
+    size_t _window_pos;
+    uint32_t _size;
+    uint8_t _window_bits;
+};
+
+#endif // _FRAGMENTATION_DECOMPRESS_CORE_H_
@@ -0,0 +1,221 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_ECDSA_H_
+#define _FRAGMENTATION_ECDSA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "mbedtls/ecp.h"
+#include "mbedtls/bignum.h"
+#ifdef MBEDTLS_ASN1_PARSE_C
+#include "mbedtls/asn1.h"
+#endif
+
+// Raw P-256 public key (X || Y) and signature (r || s)
+#define FRAG_ECDSA_RAW_KEY_LENGTH   64
+#define FRAG_ECDSA_RAW_SIG_LENGTH   64
+
+// DER encoded P-256 signature is at most 72 bytes
+#define FRAG_ECDSA_MAX_SIGNATURE    72
+
+enum FragmentationEcdsaResult {
+    FRAG_ECDSA_VALID = 0,
+    FRAG_ECDSA_IN_PROGRESS,
+    FRAG_ECDSA_INVALID,
+    FRAG_ECDSA_ERROR
+};
+
+/**
+ * ECDSA P-256 verification against a raw public key, with raw (r || s) or DER signatures.
+ *
+ * start_raw() or start() check the signature and calculate the scalars, step() does the point multiplication and
+ * the comparison in one go. FragmentationEcdsaRestartable runs the same verification in time slices on the device.
+ * Has no dependencies on Mbed OS (only mbed TLS), so host tools verify packages with the same code as the device.
+ */
+class FragmentationEcdsa {
+public:
+    /**
+     * @param pubkey Raw P-256 public key, X followed by Y (64 bytes, big endian)
+     */
+    FragmentationEcdsa(const uint8_t pubkey[FRAG_ECDSA_RAW_KEY_LENGTH]) : _started(false)
+    {
+        mbedtls_ecp_group_init(&_grp);
+        mbedtls_ecp_point_init(&_q);
+        mbedtls_ecp_point_init(&_R);
+        mbedtls_mpi_init(&_r);
+        mbedtls_mpi_init(&_s);
+        mbedtls_mpi_init(&_u1);
+        mbedtls_mpi_init(&_u2);
+
+        // the point is read straight into the coordinates, the same as an uncompressed point (0x04 || X || Y)
+        _key_ok = mbedtls_ecp_group_load(&_grp, MBEDTLS_ECP_DP_SECP256R1) == 0
+               && mbedtls_mpi_read_binary(&_q.X, pubkey, 32) == 0
+               && mbedtls_mpi_read_binary(&_q.Y, pubkey + 32, 32) == 0
+               && mbedtls_mpi_lset(&_q.Z, 1) == 0
+               && mbedtls_ecp_check_pubkey(&_grp, &_q) == 0;
+    }
+
+    ~FragmentationEcdsa() {
+        mbedtls_mpi_free(&_u2);
+        mbedtls_mpi_free(&_u1);
+        mbedtls_mpi_free(&_s);
+        mbedtls_mpi_free(&_r);
+        mbedtls_ecp_point_free(&_R);
+        mbedtls_ecp_point_free(&_q);
+        mbedtls_ecp_group_free(&_grp);
+    }
+
+    /**
+     * Start a verification with a raw signature
+     *
+     * @param hash SHA256 hash of the firmware (32 bytes)
+     * @param signature r followed by s (64 bytes, big endian)
+     *
+     * @returns FRAG_ECDSA_IN_PROGRESS, FRAG_ECDSA_INVALID if r or s is out of range,
+     *          or FRAG_ECDSA_ERROR if the key is not valid
+     */
+    FragmentationEcdsaResult start_raw(const unsigned char hash[32], const unsigned char signature[FRAG_ECDSA_RAW_SIG_LENGTH]) {
+        _started = false;
+        if (!_key_ok) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        if (mbedtls_mpi_read_binary(&_r, signature, 32) != 0 || mbedtls_mpi_read_binary(&_s, signature + 32, 32) != 0) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        return prepare(hash);
+    }
+
+#ifdef MBEDTLS_ASN1_PARSE_C
+    /**
+     * Start a verification with a DER encoded signature
+     *
+     * @param hash SHA256 hash of the firmware (32 bytes)
+     * @param signature DER encoded signature
+     * @param signature_length Length of the signature
+     *
+     * @returns FRAG_ECDSA_IN_PROGRESS, FRAG_ECDSA_INVALID if the signature is malformed,
+     *          or FRAG_ECDSA_ERROR if the key is not valid
+     */
+    FragmentationEcdsaResult start(const unsigned char hash[32], const unsigned char* signature, size_t signature_length) {
+        _started = false;
+        if (!_key_ok) {
+            return FRAG_ECDSA_ERROR;
+        }
+        if (signature_length > FRAG_ECDSA_MAX_SIGNATURE) {
+            return FRAG_ECDSA_INVALID;
+        }
+
+        unsigned char der[FRAG_ECDSA_MAX_SIGNATURE];
+        memcpy(der, signature, signature_length);
+
+        unsigned char* p = der;
+        const unsigned char* end = der + signature_length;
+        size_t len;
+
+        if (mbedtls_asn1_get_tag(&p, end, &len, MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE) != 0 || p + len != end
+            || mbedtls_asn1_get_mpi(&p, end, &_r) != 0 || mbedtls_asn1_get_mpi(&p, end, &_s) != 0 || p != end) {
+            return FRAG_ECDSA_INVALID;
+        }
+
+        return prepare(hash);
+    }
+#endif
+
+    /**
+     * Finish a started verification in one go
+     *
+     * @returns FRAG_ECDSA_VALID or FRAG_ECDSA_INVALID, or FRAG_ECDSA_ERROR if no verification was started
+     */
+    FragmentationEcdsaResult step() {
+        if (!_started) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        // R = u1 * G + u2 * Q
+        return finish(mbedtls_ecp_muladd(&_grp, &_R, &_u1, &_grp.G, &_u2, &_q));
+    }
+
+protected:
+    /**
+     * Check the range of r and s, and calculate the scalars u1 = e / s and u2 = r / s (mod n)
+     */
+    FragmentationEcdsaResult prepare(const unsigned char hash[32]) {
+        if (mbedtls_mpi_cmp_int(&_r, 1) < 0 || mbedtls_mpi_cmp_mpi(&_r, &_grp.N) >= 0
+            || mbedtls_mpi_cmp_int(&_s, 1) < 0 || mbedtls_mpi_cmp_mpi(&_s, &_grp.N) >= 0) {
+            return FRAG_ECDSA_INVALID;
+        }
+
+        mbedtls_mpi e, s_inv;
+        mbedtls_mpi_init(&e);
+        mbedtls_mpi_init(&s_inv);
+
+        // the hash is as long as n, so e is the hash reduced mod n
+        int r = mbedtls_mpi_read_binary(&e, hash, 32);
+        if (r == 0) r = mbedtls_mpi_mod_mpi(&e, &e, &_grp.N);
+        if (r == 0) r = mbedtls_mpi_inv_mod(&s_inv, &_s, &_grp.N);
+        if (r == 0) r = mbedtls_mpi_mul_mpi(&_u1, &e, &s_inv);
+        if (r == 0) r = mbedtls_mpi_mod_mpi(&_u1, &_u1, &_grp.N);
+        if (r == 0) r = mbedtls_mpi_mul_mpi(&_u2, &_r, &s_inv);
+        if (r == 0) r = mbedtls_mpi_mod_mpi(&_u2, &_u2, &_grp.N);
+
+        mbedtls_mpi_free(&s_inv);
+        mbedtls_mpi_free(&e);
+
+        if (r != 0) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        _started = true;
+        return FRAG_ECDSA_IN_PROGRESS;
+    }
+
+    /**
+     * Compare R with r once the point multiplication is done
+     *
+     * @param muladd_result Return value of the (restartable) muladd
+     */
+    FragmentationEcdsaResult finish(int muladd_result) {
+        _started = false;
+
+        // the signature is valid if R is not zero, and R.x mod n equals r
+        if (muladd_result != 0 || mbedtls_ecp_is_zero(&_R)) {
+            return FRAG_ECDSA_INVALID;
+        }
+        if (mbedtls_mpi_mod_mpi(&_R.X, &_R.X, &_grp.N) != 0) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        return mbedtls_mpi_cmp_mpi(&_R.X, &_r) == 0 ? FRAG_ECDSA_VALID : FRAG_ECDSA_INVALID;
+    }
+
+    bool _key_ok;
+    bool _started;
+
+    mbedtls_ecp_group _grp;
+    mbedtls_ecp_point _q;       // public key
+    mbedtls_ecp_point _R;
+    mbedtls_mpi _r;
+    mbedtls_mpi _s;
+    mbedtls_mpi _u1;
+    mbedtls_mpi _u2;
+};
+
+#endif // _FRAGMENTATION_ECDSA_H_
@@ -0,0 +1,248 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_ECDSA_RESTARTABLE_H_
+#define _FRAGMENTATION_ECDSA_RESTARTABLE_H_
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "mbedtls/version.h"
+#include "FragmentationEcdsa.h"
+#include "FragmentationEcpMuladd.h"
+
+// Restartable ECP came with mbed TLS 2.16, older versions ignore MBEDTLS_ECP_RESTARTABLE and use FragmentationEcpMuladd
+#if defined(MBEDTLS_ECP_RESTARTABLE) && MBEDTLS_VERSION_NUMBER >= 0x02100000
+#define FRAG_ECDSA_RESTARTABLE      1
+#else
+#define FRAG_ECDSA_RESTARTABLE      0
+#endif
+
+// Peak of what mbed TLS allocates during one verification, in bytes. Measured on a host against mbed TLS 2.28 with the
+// block headers of MBEDTLS_MEMORY_BUFFER_ALLOC_C added: 1.85 KB in 23 blocks for FragmentationEcpMuladd, 6.9 KB in 73
+// blocks when mbed TLS multiplies with its comb tables. The crypto pool has to be at least this large
+#if FRAG_ECDSA_RESTARTABLE
+#define FRAG_ECDSA_HEAP_PEAK        7168
+#else
+#define FRAG_ECDSA_HEAP_PEAK        2048
+#endif
+
+// Number of basic ECC operations per slice (see mbedtls_ecp_set_max_ops and FragmentationEcpMuladd)
+#ifndef FRAG_ECDSA_MAX_OPS
+#define FRAG_ECDSA_MAX_OPS          500
+#endif
+
+/**
+ * Time-sliced ECDSA P-256 verification on top of FragmentationEcdsa.
+ *
+ * A single ECDSA verification blocks for seconds on a 32 MHz MCU. This runs it through mbedtls restartable ECP
+ * (mbed TLS 2.16 or later with MBEDTLS_ECP_RESTARTABLE) or else through FragmentationEcpMuladd instead: every call to
+ * step() does at most `max_ops` basic operations and returns, so the application can service the radio and the
+ * watchdog between slices. run() drives the steps from an EventQueue, every slice is a separate event, so other
+ * events on the same queue are dispatched in between.
+ *
+ * The public key is the raw 64 byte point (see test-fw/create-certs-h.js), so no PEM, base64 or ASN.1 parsing is
+ * done on the device. Signatures are raw 64 byte r || s as well (start_raw), or DER encoded (start) if
+ * MBEDTLS_ASN1_PARSE_C is enabled. Parsing and the scalars come from FragmentationEcdsa, which host tools use as well.
+ */
+class FragmentationEcdsaRestartable : public FragmentationEcdsa {
+public:
+    /**
+     * @param pubkey Raw P-256 public key, X followed by Y (64 bytes, big endian)
+     * @param max_ops Number of basic ECC operations per slice
+     */
+    FragmentationEcdsaRestartable(const uint8_t pubkey[FRAG_ECDSA_RAW_KEY_LENGTH], unsigned max_ops = FRAG_ECDSA_MAX_OPS)
+        : FragmentationEcdsa(pubkey), _max_ops(max_ops), _queue(NULL), _slices(0), _max_slice_us(0), _total_us(0)
+    {
+#if FRAG_ECDSA_RESTARTABLE
+        mbedtls_ecp_restart_init(&_rs_ctx);
+#endif
+    }
+
+    ~FragmentationEcdsaRestartable() {
+#if FRAG_ECDSA_RESTARTABLE
+        mbedtls_ecp_restart_free(&_rs_ctx);
+#endif
+    }
+
+    /**
+     * Start a verification with a raw signature, see FragmentationEcdsa::start_raw
+     */
+    FragmentationEcdsaResult start_raw(const unsigned char hash[32], const unsigned char signature[FRAG_ECDSA_RAW_SIG_LENGTH]) {
+        reset();
+        return begin(FragmentationEcdsa::start_raw(hash, signature));
+    }
+
+#ifdef MBEDTLS_ASN1_PARSE_C
+    /**
+     * Start a verification with a DER encoded signature, see FragmentationEcdsa::start
+     */
+    FragmentationEcdsaResult start(const unsigned char hash[32], const unsigned char* signature, size_t signature_length) {
+        reset();
+        return begin(FragmentationEcdsa::start(hash, signature, signature_length));
+    }
+#endif
+
+    /**
+     * Run one slice of the verification
+     *
+     * @returns FRAG_ECDSA_IN_PROGRESS if step() needs to be called again, otherwise the result of the verification
+     */
+    FragmentationEcdsaResult step() {
+        if (!_started) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        Timer t;
+        t.start();
+
+        // R = u1 * G + u2 * Q
+#if FRAG_ECDSA_RESTARTABLE
+        // the limit is global, don't leave it set for other users of ECP
+        mbedtls_ecp_set_max_ops(_max_ops);
+        int r = mbedtls_ecp_muladd_restartable(&_grp, &_R, &_u1, &_grp.G, &_u2, &_q, &_rs_ctx);
+        mbedtls_ecp_set_max_ops(0);
+#else
+        int r = _muladd.step(_max_ops, &_R);
+#endif
+
+        t.stop();
+
+        uint32_t us = t.read_us();
+        _slices++;
+        _total_us += us;
+        if (us > _max_slice_us) {
+            _max_slice_us = us;
+        }
+
+#if FRAG_ECDSA_RESTARTABLE
+        if (r == MBEDTLS_ERR_ECP_IN_PROGRESS) {
+            return FRAG_ECDSA_IN_PROGRESS;
+        }
+#else
+        if (r == FRAG_ECP_IN_PROGRESS) {
+            return FRAG_ECDSA_IN_PROGRESS;
+        }
+#endif
+
+        return finish(r);
+    }
+
+    /**
+     * Run a started verification in slices that are posted to an event queue, one slice per event
+     *
+     * @param queue Event queue to post the slices to
+     * @param cb Called from the queue with the result (FRAG_ECDSA_VALID or FRAG_ECDSA_INVALID)
+     *
+     * @returns FRAG_ECDSA_IN_PROGRESS, or FRAG_ECDSA_ERROR if no verification was started
+     */
+    FragmentationEcdsaResult run(EventQueue* queue, Callback<void(FragmentationEcdsaResult)> cb) {
+        if (!_started) {
+            return FRAG_ECDSA_ERROR;
+        }
+
+        _queue = queue;
+        _cb = cb;
+
+        if (_queue->call(callback(this, &FragmentationEcdsaRestartable::run_slice)) == 0) {
+            _started = false;
+            return FRAG_ECDSA_ERROR;
+        }
+
+        return FRAG_ECDSA_IN_PROGRESS;
+    }
+
+    /**
+     * Number of slices of the last verification
+     */
+    uint32_t get_slices() {
+        return _slices;
+    }
+
+    /**
+     * Longest slice of the last verification, this is how long the application is blocked at most
+     */
+    uint32_t get_max_slice_us() {
+        return _max_slice_us;
+    }
+
+    /**
+     * Time spent in all slices of the last verification
+     */
+    uint32_t get_total_us() {
+        return _total_us;
+    }
+
+private:
+    /**
+     * Start over with a fresh restart context and statistics
+     */
+    void reset() {
+#if FRAG_ECDSA_RESTARTABLE
+        mbedtls_ecp_restart_free(&_rs_ctx);
+        mbedtls_ecp_restart_init(&_rs_ctx);
+#endif
+
+        _slices = 0;
+        _max_slice_us = 0;
+        _total_us = 0;
+    }
+
+    /**
+     * Set up the sliced multiplication once the scalars are there
+     */
+    FragmentationEcdsaResult begin(FragmentationEcdsaResult r) {
+#if !FRAG_ECDSA_RESTARTABLE
+        if (r == FRAG_ECDSA_IN_PROGRESS && _muladd.start(&_grp, &_u1, &_grp.G, &_u2, &_q) != 0) {
+            _started = false;
+            return FRAG_ECDSA_ERROR;
+        }
+#endif
+        return r;
+    }
+
+    void run_slice() {
+        FragmentationEcdsaResult r = step();
+
+        if (r == FRAG_ECDSA_IN_PROGRESS) {
+            if (_queue->call(callback(this, &FragmentationEcdsaRestartable::run_slice)) != 0) {
+                return;
+            }
+            _started = false;
+            r = FRAG_ECDSA_ERROR;
+        }
+
+        if (_cb) {
+            _cb(r);
+        }
+    }
+
+#if FRAG_ECDSA_RESTARTABLE
+    mbedtls_ecp_restart_ctx _rs_ctx;
+#else
+    FragmentationEcpMuladd _muladd;
+#endif
+    unsigned _max_ops;
+
+    EventQueue* _queue;
+    Callback<void(FragmentationEcdsaResult)> _cb;
+
+    uint32_t _slices;
+    uint32_t _max_slice_us;
+    uint32_t _total_us;
+};
+
+#endif // _FRAGMENTATION_ECDSA_RESTARTABLE_H_
@@ -0,0 +1,364 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_ECP_MULADD_H_
+#define _FRAGMENTATION_ECP_MULADD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbedtls/ecp.h"
+#include "mbedtls/bignum.h"
+
+// step() returns this while there are bits left
+#define FRAG_ECP_IN_PROGRESS        1
+
+// Cost of the operations in basic ECC operations, the same units as mbedtls_ecp_set_max_ops
+#define FRAG_ECP_OPS_DBL            8
+#define FRAG_ECP_OPS_ADD            11
+#define FRAG_ECP_OPS_INV            120
+
+/**
+ * R = m * P + n * Q in slices, for mbed TLS versions without restartable ECP (before 2.16).
+ *
+ * Shamir's trick: one pass over the bits of both scalars, doubling R for every bit and adding P, Q or P + Q (which is
+ * calculated first). Points are kept in Jacobian coordinates, so the only inversions are for P + Q and for R at the
+ * end. Every step() does at most `max_ops` basic operations, counted like mbed TLS does, so the same
+ * fragmentation-ecdsa-max-ops gives slices of about the same length either way.
+ *
+ * Only built on the public bignum functions. The doubling assumes a = -3, which holds for the NIST curves (the
+ * signature is always P-256). Scalars and points are not copied, they have to stay around until the last step.
+ * This is for verification only, it does not run in constant time.
+ */
+class FragmentationEcpMuladd {
+public:
+    FragmentationEcpMuladd() : _grp(NULL), _m(NULL), _P(NULL), _n(NULL), _Q(NULL), _state(STATE_IDLE), _bit(0)
+    {
+        mbedtls_ecp_point_init(&_PQ);
+    }
+
+    ~FragmentationEcpMuladd() {
+        mbedtls_ecp_point_free(&_PQ);
+    }
+
+    /**
+     * Start a multiplication
+     *
+     * @param grp Group, with a = -3
+     * @param m First scalar
+     * @param P First point, normalized (Z = 1)
+     * @param n Second scalar
+     * @param Q Second point, normalized (Z = 1)
+     *
+     * @returns 0, or an mbed TLS error
+     */
+    int start(const mbedtls_ecp_group* grp, const mbedtls_mpi* m, const mbedtls_ecp_point* P,
+              const mbedtls_mpi* n, const mbedtls_ecp_point* Q) {
+        _grp = grp;
+        _m = m;
+        _P = P;
+        _n = n;
+        _Q = Q;
+
+        size_t bits = mbedtls_mpi_bitlen(m) > mbedtls_mpi_bitlen(n) ? mbedtls_mpi_bitlen(m) : mbedtls_mpi_bitlen(n);
+        _bit = (int)bits - 1;
+        _state = STATE_PRECOMPUTE;
+        return 0;
+    }
+
+    /**
+     * Run the next slice
+     *
+     * @param max_ops Number of basic operations in this slice, 0 to finish in one go (at least one bit is done)
+     * @param R Receives the result, normalized (Z = 1, or Z = 0 for zero). Has to be the same point for every step
+     *
+     * @returns FRAG_ECP_IN_PROGRESS if step() needs to be called again, 0 if R holds the result, or an mbed TLS error
+     */
+    int step(unsigned max_ops, mbedtls_ecp_point* R) {
+        if (_state == STATE_IDLE) {
+            return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+        }
+
+        unsigned ops = 0;
+        int r = 0;
+
+        while (r == 0 && _state != STATE_IDLE) {
+            unsigned cost = next_cost();
+            if (max_ops > 0 && ops > 0 && ops + cost > max_ops) {
+                return FRAG_ECP_IN_PROGRESS;
+            }
+            ops += cost;
+
+            switch (_state) {
+                case STATE_PRECOMPUTE:
+                    // P + Q, R starts at zero
+                    r = copy_point(&_PQ, _P);
+                    if (r == 0) r = add_mixed(&_PQ, _Q);
+                    if (r == 0) r = normalize(&_PQ);
+                    if (r == 0) r = mbedtls_mpi_lset(&R->X, 1);
+                    if (r == 0) r = mbedtls_mpi_lset(&R->Y, 1);
+                    if (r == 0) r = mbedtls_mpi_lset(&R->Z, 0);
+                    _state = STATE_BITS;
+                    break;
+
+                case STATE_BITS:
+                    if (_bit < 0) {
+                        _state = STATE_NORMALIZE;
+                        break;
+                    }
+                    r = double_jac(R);
+                    if (r == 0) r = add_bit(R, mbedtls_mpi_get_bit(_m, _bit), mbedtls_mpi_get_bit(_n, _bit));
+                    _bit--;
+                    break;
+
+                case STATE_NORMALIZE:
+                    r = normalize(R);
+                    _state = STATE_IDLE;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        _state = STATE_IDLE;
+        return r;
+    }
+
+private:
+    enum {
+        STATE_IDLE,
+        STATE_PRECOMPUTE,
+        STATE_BITS,
+        STATE_NORMALIZE
+    };
+
+    unsigned next_cost() {
+        switch (_state) {
+            case STATE_PRECOMPUTE:  return FRAG_ECP_OPS_ADD + FRAG_ECP_OPS_INV;
+            case STATE_BITS:        return _bit < 0 ? 0 : FRAG_ECP_OPS_DBL + FRAG_ECP_OPS_ADD;
+            case STATE_NORMALIZE:   return FRAG_ECP_OPS_INV;
+            default:                return 0;
+        }
+    }
+
+    /**
+     * R += P, Q or P + Q, depending on the bits of the scalars
+     */
+    int add_bit(mbedtls_ecp_point* R, int m_bit, int n_bit) {
+        if (m_bit && n_bit) {
+            // P + Q is zero when Q = -P
+            return is_zero(&_PQ) ? 0 : add_mixed(R, &_PQ);
+        }
+        if (m_bit) return add_mixed(R, _P);
+        if (n_bit) return add_mixed(R, _Q);
+        return 0;
+    }
+
+    static bool is_zero(const mbedtls_ecp_point* pt) {
+        return mbedtls_mpi_cmp_int(&pt->Z, 0) == 0;
+    }
+
+    static int copy_point(mbedtls_ecp_point* dst, const mbedtls_ecp_point* src) {
+        int r = mbedtls_mpi_copy(&dst->X, &src->X);
+        if (r == 0) r = mbedtls_mpi_copy(&dst->Y, &src->Y);
+        if (r == 0) r = mbedtls_mpi_copy(&dst->Z, &src->Z);
+        return r;
+    }
+
+    /**
+     * Reduce mod p, with the fast reduction of the curve if mbed TLS has one (MBEDTLS_ECP_NIST_OPTIM)
+     */
+    int mod(mbedtls_mpi* x) {
+        if (_grp->modp == NULL) {
+            return mbedtls_mpi_mod_mpi(x, x, &_grp->P);
+        }
+
+        // only products of reduced numbers get here, so x is positive and fits the fast reduction
+        int r = _grp->modp(x);
+        while (r == 0 && mbedtls_mpi_cmp_int(x, 0) < 0) {
+            r = mbedtls_mpi_add_mpi(x, x, &_grp->P);
+        }
+        while (r == 0 && mbedtls_mpi_cmp_mpi(x, &_grp->P) >= 0) {
+            r = mbedtls_mpi_sub_mpi(x, x, &_grp->P);
+        }
+        return r;
+    }
+
+    int mul(mbedtls_mpi* x, const mbedtls_mpi* a, const mbedtls_mpi* b) {
+        int r = mbedtls_mpi_mul_mpi(x, a, b);
+        return r == 0 ? mod(x) : r;
+    }
+
+    int add(mbedtls_mpi* x, const mbedtls_mpi* a, const mbedtls_mpi* b) {
+        int r = mbedtls_mpi_add_mpi(x, a, b);
+        if (r == 0 && mbedtls_mpi_cmp_mpi(x, &_grp->P) >= 0) {
+            r = mbedtls_mpi_sub_mpi(x, x, &_grp->P);
+        }
+        return r;
+    }
+
+    int sub(mbedtls_mpi* x, const mbedtls_mpi* a, const mbedtls_mpi* b) {
+        int r = mbedtls_mpi_sub_mpi(x, a, b);
+        if (r == 0 && mbedtls_mpi_cmp_int(x, 0) < 0) {
+            r = mbedtls_mpi_add_mpi(x, x, &_grp->P);
+        }
+        return r;
+    }
+
+    /**
+     * R = 2 * R, Jacobian coordinates with a = -3 (dbl-2001-b)
+     */
+    int double_jac(mbedtls_ecp_point* R) {
+        mbedtls_mpi delta, gamma, beta, alpha, t;
+        mbedtls_mpi_init(&delta);
+        mbedtls_mpi_init(&gamma);
+        mbedtls_mpi_init(&beta);
+        mbedtls_mpi_init(&alpha);
+        mbedtls_mpi_init(&t);
+
+        // alpha = 3 * (X - delta) * (X + delta)
+        int r = mul(&delta, &R->Z, &R->Z);
+        if (r == 0) r = mul(&gamma, &R->Y, &R->Y);
+        if (r == 0) r = mul(&beta, &R->X, &gamma);
+        if (r == 0) r = sub(&t, &R->X, &delta);
+        if (r == 0) r = add(&alpha, &R->X, &delta);
+        if (r == 0) r = mul(&alpha, &alpha, &t);
+        if (r == 0) r = add(&t, &alpha, &alpha);
+        if (r == 0) r = add(&alpha, &alpha, &t);
+
+        // Z = (Y + Z)^2 - gamma - delta
+        if (r == 0) r = add(&t, &R->Y, &R->Z);
+        if (r == 0) r = mul(&R->Z, &t, &t);
+        if (r == 0) r = sub(&R->Z, &R->Z, &gamma);
+        if (r == 0) r = sub(&R->Z, &R->Z, &delta);
+
+        // X = alpha^2 - 8 * beta
+        if (r == 0) r = add(&beta, &beta, &beta);
+        if (r == 0) r = add(&beta, &beta, &beta);
+        if (r == 0) r = add(&t, &beta, &beta);
+        if (r == 0) r = mul(&R->X, &alpha, &alpha);
+        if (r == 0) r = sub(&R->X, &R->X, &t);
+
+        // Y = alpha * (4 * beta - X) - 8 * gamma^2
+        if (r == 0) r = sub(&beta, &beta, &R->X);
+        if (r == 0) r = mul(&beta, &beta, &alpha);
+        if (r == 0) r = mul(&gamma, &gamma, &gamma);
+        if (r == 0) r = add(&gamma, &gamma, &gamma);
+        if (r == 0) r = add(&gamma, &gamma, &gamma);
+        if (r == 0) r = add(&gamma, &gamma, &gamma);
+        if (r == 0) r = sub(&R->Y, &beta, &gamma);
+
+        mbedtls_mpi_free(&t);
+        mbedtls_mpi_free(&alpha);
+        mbedtls_mpi_free(&beta);
+        mbedtls_mpi_free(&gamma);
+        mbedtls_mpi_free(&delta);
+        return r;
+    }
+
+    /**
+     * R = R + A, with R in Jacobian coordinates and A normalized and not zero
+     */
+    int add_mixed(mbedtls_ecp_point* R, const mbedtls_ecp_point* A) {
+        if (is_zero(R)) {
+            return copy_point(R, A);
+        }
+
+        mbedtls_mpi h, rr, t1, t2;
+        mbedtls_mpi_init(&h);
+        mbedtls_mpi_init(&rr);
+        mbedtls_mpi_init(&t1);
+        mbedtls_mpi_init(&t2);
+
+        // H = X2 * Z1^2 - X1, r = Y2 * Z1^3 - Y1
+        int r = mul(&t1, &R->Z, &R->Z);
+        if (r == 0) r = mul(&t2, &t1, &R->Z);
+        if (r == 0) r = mul(&t1, &t1, &A->X);
+        if (r == 0) r = mul(&t2, &t2, &A->Y);
+        if (r == 0) r = sub(&h, &t1, &R->X);
+        if (r == 0) r = sub(&rr, &t2, &R->Y);
+
+        bool done = false;
+        if (r == 0 && mbedtls_mpi_cmp_int(&h, 0) == 0) {
+            // the same x, so either the same point or the opposite
+            r = mbedtls_mpi_cmp_int(&rr, 0) == 0 ? double_jac(R) : mbedtls_mpi_lset(&R->Z, 0);
+            done = true;
+        }
+
+        if (r == 0 && !done) {
+            // Z = Z1 * H, t1 = X1 * H^2, t2 = H^3
+            r = mul(&R->Z, &R->Z, &h);
+            if (r == 0) r = mul(&t1, &h, &h);
+            if (r == 0) r = mul(&t2, &t1, &h);
+            if (r == 0) r = mul(&t1, &t1, &R->X);
+
+            // X = r^2 - H^3 - 2 * X1 * H^2
+            if (r == 0) r = mul(&R->X, &rr, &rr);
+            if (r == 0) r = sub(&R->X, &R->X, &t2);
+            if (r == 0) r = sub(&R->X, &R->X, &t1);
+            if (r == 0) r = sub(&R->X, &R->X, &t1);
+
+            // Y = r * (X1 * H^2 - X) - Y1 * H^3
+            if (r == 0) r = sub(&t1, &t1, &R->X);
+            if (r == 0) r = mul(&t1, &t1, &rr);
+            if (r == 0) r = mul(&t2, &t2, &R->Y);
+            if (r == 0) r = sub(&R->Y, &t1, &t2);
+        }
+
+        mbedtls_mpi_free(&t2);
+        mbedtls_mpi_free(&t1);
+        mbedtls_mpi_free(&rr);
+        mbedtls_mpi_free(&h);
+        return r;
+    }
+
+    /**
+     * Back to affine coordinates (Z = 1), zero stays zero
+     */
+    int normalize(mbedtls_ecp_point* pt) {
+        if (is_zero(pt)) {
+            return 0;
+        }
+
+        mbedtls_mpi zi, zz;
+        mbedtls_mpi_init(&zi);
+        mbedtls_mpi_init(&zz);
+
+        int r = mbedtls_mpi_inv_mod(&zi, &pt->Z, &_grp->P);
+        if (r == 0) r = mul(&zz, &zi, &zi);
+        if (r == 0) r = mul(&pt->X, &pt->X, &zz);
+        if (r == 0) r = mul(&zz, &zz, &zi);
+        if (r == 0) r = mul(&pt->Y, &pt->Y, &zz);
+        if (r == 0) r = mbedtls_mpi_lset(&pt->Z, 1);
+
+        mbedtls_mpi_free(&zz);
+        mbedtls_mpi_free(&zi);
+        return r;
+    }
+
+    const mbedtls_ecp_group* _grp;
+    const mbedtls_mpi* _m;
+    const mbedtls_ecp_point* _P;
+    const mbedtls_mpi* _n;
+    const mbedtls_ecp_point* _Q;
+
+    mbedtls_ecp_point _PQ;      // P + Q, normalized
+    int _state;
+    int _bit;                   // next bit of the scalars, from the top
+};
+
+#endif // _FRAGMENTATION_ECP_MULADD_H_
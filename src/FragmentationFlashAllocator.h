@@ -0,0 +1,181 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_FLASH_ALLOCATOR_H_
+#define _FRAGMENTATION_FLASH_ALLOCATOR_H_
+
+#include "mbed.h"
+
+#define FRAG_ALLOCATOR_MAX_REGIONS      8
+#define FRAG_ADDRESS_NONE               ((bd_addr_t)-1)
+
+/**
+ * First-fit allocator for regions of external flash, so several fragmentation sessions
+ * (and their journals) can share the block device. All regions are aligned to the erase size.
+ * Only the bookkeeping lives here, nothing is written to flash.
+ */
+class FragmentationFlashAllocator {
+public:
+    /**
+     * @param start First address that can be handed out
+     * @param end Address after the last byte that can be handed out
+     * @param alignment Alignment (and size granularity) of regions, normally the erase size of the block device
+     */
+    FragmentationFlashAllocator(bd_addr_t start, bd_addr_t end, bd_size_t alignment)
+        : _start(start), _end(end), _alignment(alignment == 0 ? 1 : alignment), _count(0)
+    {
+    }
+
+    /**
+     * Allocate a region
+     *
+     * @returns Address of the region, or FRAG_ADDRESS_NONE if there is no gap large enough
+     */
+    bd_addr_t allocate(bd_size_t size) {
+        size = align(size);
+
+        bd_addr_t candidate = _start;
+        for (size_t ix = 0; ix <= _count; ix++) {
+            bd_addr_t gap_end = ix < _count ? _regions[ix].address : _end;
+            if (candidate + size <= gap_end) {
+                return insert(ix, candidate, size) ? candidate : FRAG_ADDRESS_NONE;
+            }
+            if (ix < _count) {
+                candidate = _regions[ix].address + _regions[ix].size;
+            }
+        }
+
+        return FRAG_ADDRESS_NONE;
+    }
+
+    /**
+     * Allocate a region at the end of the last gap that is large enough, so the gaps at the start stay as large as
+     * possible (e.g. to stage data that is written back to the start later)
+     *
+     * @returns Address of the region, or FRAG_ADDRESS_NONE if there is no gap large enough
+     */
+    bd_addr_t allocate_top(bd_size_t size) {
+        size = align(size);
+
+        bd_addr_t gap_end = _end;
+        for (size_t ix = _count + 1; ix-- > 0;) {
+            bd_addr_t gap_start = ix > 0 ? _regions[ix - 1].address + _regions[ix - 1].size : _start;
+            if (gap_start + size <= gap_end) {
+                // the end of the gap is aligned when it's the start of a region, not necessarily when it's _end
+                bd_addr_t candidate = gap_start + ((gap_end - size - gap_start) / _alignment) * _alignment;
+                return insert(ix, candidate, size) ? candidate : FRAG_ADDRESS_NONE;
+            }
+            if (ix > 0) {
+                gap_end = _regions[ix - 1].address;
+            }
+        }
+
+        return FRAG_ADDRESS_NONE;
+    }
+
+    /**
+     * Allocate a region at a fixed address, e.g. where the bootloader expects the firmware
+     *
+     * @returns true if the region was free
+     */
+    bool allocate_at(bd_addr_t address, bd_size_t size) {
+        size = align(size);
+
+        if (address < _start || address + size > _end) {
+            return false;
+        }
+
+        size_t ix = 0;
+        while (ix < _count && _regions[ix].address < address) ix++;
+
+        if (ix > 0 && _regions[ix - 1].address + _regions[ix - 1].size > address) return false;
+        if (ix < _count && address + size > _regions[ix].address) return false;
+
+        return insert(ix, address, size);
+    }
+
+    /**
+     * Release the region starting at address
+     */
+    void free(bd_addr_t address) {
+        for (size_t ix = 0; ix < _count; ix++) {
+            if (_regions[ix].address != address) continue;
+
+            memmove(&_regions[ix], &_regions[ix + 1], (_count - ix - 1) * sizeof(_regions[0]));
+            _count--;
+            return;
+        }
+    }
+
+    /**
+     * Number of bytes that are free from address up to the next region
+     *
+     * @returns The size of the gap, 0 if address is in a region or outside of [start, end)
+     */
+    bd_size_t get_free_size_at(bd_addr_t address) {
+        if (address < _start || address >= _end) {
+            return 0;
+        }
+
+        for (size_t ix = 0; ix < _count; ix++) {
+            if (_regions[ix].address + _regions[ix].size <= address) continue;
+
+            return _regions[ix].address > address ? _regions[ix].address - address : 0;
+        }
+        return _end - address;
+    }
+
+    /**
+     * Number of bytes that are not handed out (not necessarily contiguous)
+     */
+    bd_size_t get_free_size() {
+        bd_size_t used = 0;
+        for (size_t ix = 0; ix < _count; ix++) {
+            used += _regions[ix].size;
+        }
+        return (_end - _start) - used;
+    }
+
+private:
+    bd_size_t align(bd_size_t size) {
+        return ((size + _alignment - 1) / _alignment) * _alignment;
+    }
+
+    bool insert(size_t ix, bd_addr_t address, bd_size_t size) {
+        if (_count == FRAG_ALLOCATOR_MAX_REGIONS) {
+            return false;
+        }
+
+        memmove(&_regions[ix + 1], &_regions[ix], (_count - ix) * sizeof(_regions[0]));
+        _regions[ix].address = address;
+        _regions[ix].size = size;
+        _count++;
+        return true;
+    }
+
+    struct {
+        bd_addr_t address;
+        bd_size_t size;
+    } _regions[FRAG_ALLOCATOR_MAX_REGIONS];     // sorted by address
+
+    bd_addr_t _start;
+    bd_addr_t _end;
+    bd_size_t _alignment;
+    size_t _count;
+};
+
+#endif // _FRAGMENTATION_FLASH_ALLOCATOR_H_
@@ -0,0 +1,458 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_JOURNAL_H_
+#define _FRAGMENTATION_JOURNAL_H_
+
+#include "mbed.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "update-client-common/arm_uc_utilities.h"
+#include "FragmentationBitMatrix.h"
+#include "FragmentationPageBuffer.h"
+
+#define FRAG_JOURNAL_MAGIC          0x4e524a46 // 'FJRN'
+#define FRAG_JOURNAL_VERSION        2
+
+// Received fragments that wait for their page to leave the page buffer
+#ifndef FRAG_JOURNAL_MAX_PENDING
+#define FRAG_JOURNAL_MAX_PENDING    8
+#endif
+
+enum FragmentationJournalState {
+    FRAG_JOURNAL_RECEIVING = 1,     // receiving uncoded fragments
+    FRAG_JOURNAL_CODING = 2,        // set of lost fragments is fixed, receiving redundancy frames
+    FRAG_JOURNAL_SOLVING = 3,       // back-substitution is rewriting the lost fragments in flash
+    FRAG_JOURNAL_COMPLETE = 4       // all fragments are in flash
+};
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t state;                  // FragmentationJournalState
+    uint8_t fragment_size;
+    uint32_t generation;            // incremented on every new session, so rows from old sessions are ignored
+    uint16_t number_of_fragments;
+    uint16_t redundancy_packets;
+    uint8_t padding;
+    uint8_t solve_pending;          // the solution for solve_col is in the journal, but maybe not in its slot yet
+    uint16_t lost;                  // number of lost fragments, valid from FRAG_JOURNAL_CODING
+    int16_t solve_col;              // next column for back-substitution (-1 when none is left), valid in FRAG_JOURNAL_SOLVING
+    uint32_t flash_offset;
+    uint32_t crc;                   // CRC32 over all fields above
+} FragmentationJournalHeader_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t generation;
+} FragmentationJournalRow_t;        // followed by the row bits
+
+/**
+ * Journal of a fragmentation session in external flash, so a session can be resumed after a reset.
+ *
+ * Layout, starting at `offset`:
+ *  - FragmentationJournalHeader_t, holding the session options.
+ *  - Received fragment bitmap, one bit per fragment.
+ *  - One record per lost fragment, holding the pivot row for that column (once coding has started).
+ *  - One fragment, holding the solution of the column that back-substitution is writing.
+ *
+ * Fragment payloads and reduced rows are already in the fragment storage, so only the bookkeeping is
+ * written here. Everything is written after the data it describes, so a reset in between only loses
+ * that one frame. Bitmaps are stored in little endian byte order.
+ *
+ * With a FragmentationPageBuffer the data might only be in RAM. A fragment is then only marked as received
+ * once its page was programmed, and other records are written after a sync of the page buffer. Journal
+ * writes themselves bypass the buffer.
+ */
+class FragmentationJournal {
+public:
+    /**
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param offset Address in flash where the journal starts, must not overlap with the fragment storage
+     * @param size Number of bytes reserved for the journal, or 0 if not limited
+     * @param page_buffer Page buffer below `flash`, if there is one
+     */
+    FragmentationJournal(FragmentationBlockDeviceWrapper* flash, bd_addr_t offset, size_t size = 0,
+                         FragmentationPageBuffer* page_buffer = NULL)
+        : _flash(flash), _offset(offset), _size(size), _page_buffer(page_buffer), _received(NULL), _pending_count(0)
+    {
+        memset(&_header, 0, sizeof(_header));
+    }
+
+    /**
+     * Read the header from flash
+     *
+     * @returns true if flash holds a valid journal
+     */
+    bool load() {
+        if (_flash->read(&_header, _offset, sizeof(_header)) != BD_ERROR_OK) {
+            return false;
+        }
+
+        return _header.magic == FRAG_JOURNAL_MAGIC
+            && _header.version == FRAG_JOURNAL_VERSION
+            && _header.crc == header_crc();
+    }
+
+    /**
+     * Get the session options from the journal, only valid after load() returned true
+     */
+    FragmentationSessionOpts_t get_opts() {
+        FragmentationSessionOpts_t opts;
+        opts.NumberOfFragments = _header.number_of_fragments;
+        opts.FragmentSize = _header.fragment_size;
+        opts.Padding = _header.padding;
+        opts.RedundancyPackets = _header.redundancy_packets;
+        opts.FlashOffset = _header.flash_offset;
+        return opts;
+    }
+
+    /**
+     * Whether the journal holds a session with these options, only valid after load() returned true
+     */
+    bool matches(FragmentationSessionOpts_t opts) {
+        return _header.number_of_fragments == opts.NumberOfFragments
+            && _header.fragment_size == opts.FragmentSize
+            && _header.padding == opts.Padding
+            && _header.redundancy_packets == opts.RedundancyPackets
+            && _header.flash_offset == opts.FlashOffset;
+    }
+
+    FragmentationJournalState get_state() {
+        return (FragmentationJournalState)_header.state;
+    }
+
+    uint16_t get_lost() {
+        return _header.lost;
+    }
+
+    int get_solve_col() {
+        return _header.solve_col;
+    }
+
+    bool is_solution_pending() {
+        return _header.solve_pending != 0;
+    }
+
+    /**
+     * Start a new journal for a session, any previous session is discarded
+     *
+     * @returns BD_ERROR_OK if succeeded
+     */
+    int start(FragmentationSessionOpts_t opts) {
+        _pending_count = 0;
+
+        // continue from the generation in flash even if the journal was cleared, so rows of the old session don't match
+        load();
+        uint32_t generation = _header.generation + 1;
+
+        memset(&_header, 0, sizeof(_header));
+        _header.magic = FRAG_JOURNAL_MAGIC;
+        _header.version = FRAG_JOURNAL_VERSION;
+        _header.state = FRAG_JOURNAL_RECEIVING;
+        _header.generation = generation;
+        _header.number_of_fragments = opts.NumberOfFragments;
+        _header.fragment_size = opts.FragmentSize;
+        _header.padding = opts.Padding;
+        _header.redundancy_packets = opts.RedundancyPackets;
+        _header.flash_offset = opts.FlashOffset;
+
+        // clear the received bitmap, before the header makes it valid. When the size of the journal is known
+        // clear the rows too, the region might have held the journal of another session with the same generation.
+        uint8_t zeros[32] = { 0 };
+        size_t clear_size = _size != 0 ? _size - sizeof(_header) : get_bitmap_size();
+        for (size_t ix = 0; ix < clear_size; ix += sizeof(zeros)) {
+            size_t len = clear_size - ix < sizeof(zeros) ? clear_size - ix : sizeof(zeros);
+            int r = program(zeros, get_bitmap_address() + ix, len);
+            if (r != BD_ERROR_OK) return r;
+        }
+
+        return write_header();
+    }
+
+    /**
+     * Mark a fragment as received
+     *
+     * @param received Received bitmap of the session, with the bit for `index` already set. Needs to stay
+     *                 valid, as the mark might be written later when there is a page buffer.
+     */
+    int mark_received(const frag_bits_t* received, uint16_t index) {
+        const uint8_t* bytes = (const uint8_t*)received;
+
+        if (!_page_buffer) {
+            return _flash->program(&bytes[index / 8], get_bitmap_address() + (index / 8), 1);
+        }
+
+        _received = received;
+
+        if (_pending_count == FRAG_JOURNAL_MAX_PENDING) {
+            int r = barrier();
+            if (r != BD_ERROR_OK) return r;
+        }
+        _pending[_pending_count++] = index;
+
+        return commit(false);
+    }
+
+    /**
+     * Load the received bitmap
+     */
+    int load_received(frag_bits_t* received) {
+        return _flash->read(received, get_bitmap_address(), get_bitmap_size());
+    }
+
+    /**
+     * Record that the set of lost fragments is fixed
+     *
+     * @returns BD_ERROR_OK, or BD_ERROR_DEVICE_ERROR if the rows for this many lost fragments don't fit in the journal
+     */
+    int start_coding(uint16_t lost) {
+        if (_size != 0 && get_size(get_opts(), lost) > _size) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+
+        _header.lost = lost;
+        return set_state(FRAG_JOURNAL_CODING);
+    }
+
+    /**
+     * Record how far back-substitution got, once the columns above `col` are programmed
+     *
+     * @param col Next column to solve, or -1 when every column is solved
+     */
+    int set_solving(int col) {
+        _header.solve_col = col;
+        _header.solve_pending = 0;
+        return set_state(FRAG_JOURNAL_SOLVING);
+    }
+
+    /**
+     * Keep the solution for a column before it overwrites the reduced row in its slot. A reset while the slot
+     * is programmed can leave it half old and half new, resuming copies the solution over it again.
+     *
+     * @param col Column that is solved
+     * @param payload Solution, fragment_size bytes
+     */
+    int store_solution(int col, const uint8_t* payload) {
+        int r = program(payload, get_solution_address(), _header.fragment_size);
+        if (r != BD_ERROR_OK) return r;
+
+        _header.solve_col = col;
+        _header.solve_pending = 1;
+        return set_state(FRAG_JOURNAL_SOLVING);
+    }
+
+    /**
+     * Load the solution stored by store_solution(), only valid if is_solution_pending()
+     *
+     * @param payload Buffer of fragment_size bytes
+     */
+    int load_solution(uint8_t* payload) {
+        return _flash->read(payload, get_solution_address(), _header.fragment_size);
+    }
+
+    int set_state(FragmentationJournalState state) {
+        int r = barrier();
+        if (r != BD_ERROR_OK) return r;
+
+        _header.state = state;
+        return write_header();
+    }
+
+    /**
+     * Store the pivot row for a column
+     *
+     * @param col Column (index in the lost fragments)
+     * @param row Row bits, `lost` bits long
+     */
+    int store_row(uint16_t col, const frag_bits_t* row) {
+        FragmentationJournalRow_t record = { _header.generation };
+
+        int r = barrier();
+        if (r != BD_ERROR_OK) return r;
+
+        bd_addr_t address = get_row_address(col);
+        r = program(row, address + sizeof(record), get_row_bits_size());
+        if (r != BD_ERROR_OK) return r;
+
+        return program(&record, address, sizeof(record));
+    }
+
+    /**
+     * Load the pivot row for a column
+     *
+     * @param row Buffer for the row bits, frag_bits_words(lost) words long
+     *
+     * @returns true if the journal has a pivot row for this column
+     */
+    bool load_row(uint16_t col, frag_bits_t* row) {
+        FragmentationJournalRow_t record;
+
+        bd_addr_t address = get_row_address(col);
+        if (_flash->read(&record, address, sizeof(record)) != BD_ERROR_OK) {
+            return false;
+        }
+
+        if (record.generation != _header.generation) {
+            return false;
+        }
+
+        memset(row, 0, frag_bits_words(_header.lost) * sizeof(frag_bits_t));
+        if (_flash->read(row, address + sizeof(record), get_row_bits_size()) != BD_ERROR_OK) {
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Invalidate the journal, e.g. after the update was verified
+     */
+    int clear() {
+        _pending_count = 0;
+
+        uint32_t generation = load() ? _header.generation : 0;
+
+        memset(&_header, 0, sizeof(_header));
+        _header.generation = generation;
+        return program(&_header, _offset, sizeof(_header));
+    }
+
+    /**
+     * Number of bytes in flash a journal takes up for a session
+     */
+    static size_t get_size(FragmentationSessionOpts_t opts, uint16_t lost) {
+        return sizeof(FragmentationJournalHeader_t)
+            + ((opts.NumberOfFragments + 7) / 8)
+            + (lost * (sizeof(FragmentationJournalRow_t) + ((lost + 7) / 8)))
+            + opts.FragmentSize;
+    }
+
+private:
+    uint32_t header_crc() {
+        return arm_uc_crc32((const uint8_t*)&_header, offsetof(FragmentationJournalHeader_t, crc));
+    }
+
+    int write_header() {
+        _header.crc = header_crc();
+        return program(&_header, _offset, sizeof(_header));
+    }
+
+    /**
+     * Write to flash, past the page buffer
+     */
+    int program(const void* buffer, bd_addr_t address, bd_size_t size) {
+        if (!_page_buffer) {
+            return _flash->program(buffer, address, size);
+        }
+
+        _page_buffer->set_write_through(true);
+        int r = _flash->program(buffer, address, size);
+        _page_buffer->set_write_through(false);
+        return r;
+    }
+
+    /**
+     * Make sure all data written so far is in flash, and mark the pending fragments
+     */
+    int barrier() {
+        if (!_page_buffer) {
+            return BD_ERROR_OK;
+        }
+
+        int r = _page_buffer->sync();
+        if (r != BD_ERROR_OK) return r;
+
+        return commit(true);
+    }
+
+    /**
+     * Mark the pending fragments whose page was programmed
+     *
+     * @param all Mark all pending fragments, only after a sync of the page buffer
+     */
+    int commit(bool all) {
+        uint16_t done[FRAG_JOURNAL_MAX_PENDING];
+        uint8_t done_count = 0;
+        uint8_t keep_count = 0;
+
+        for (uint8_t ix = 0; ix < _pending_count; ix++) {
+            uint16_t index = _pending[ix];
+            bd_addr_t address = _header.flash_offset + ((bd_addr_t)index * _header.fragment_size);
+
+            if (all || !_page_buffer->is_dirty(address, _header.fragment_size)) {
+                done[done_count++] = index;
+            }
+            else {
+                _pending[keep_count++] = index;
+            }
+        }
+        _pending_count = keep_count;
+
+        // fragments that are still pending don't get their bit yet, even if they share the byte
+        const uint8_t* bytes = (const uint8_t*)_received;
+        for (uint8_t ix = 0; ix < done_count; ix++) {
+            uint16_t byte = done[ix] / 8;
+
+            bool written = false;
+            for (uint8_t jx = 0; jx < ix; jx++) {
+                if (done[jx] / 8 == byte) written = true;
+            }
+            if (written) continue;
+
+            uint8_t value = bytes[byte];
+            for (uint8_t jx = 0; jx < _pending_count; jx++) {
+                if (_pending[jx] / 8 == byte) value &= ~(1 << (_pending[jx] % 8));
+            }
+
+            int r = program(&value, get_bitmap_address() + byte, 1);
+            if (r != BD_ERROR_OK) return r;
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    size_t get_bitmap_size() {
+        return (_header.number_of_fragments + 7) / 8;
+    }
+
+    size_t get_row_bits_size() {
+        return (_header.lost + 7) / 8;
+    }
+
+    bd_addr_t get_bitmap_address() {
+        return _offset + sizeof(FragmentationJournalHeader_t);
+    }
+
+    bd_addr_t get_row_address(uint16_t col) {
+        return get_bitmap_address() + get_bitmap_size()
+            + (col * (sizeof(FragmentationJournalRow_t) + get_row_bits_size()));
+    }
+
+    bd_addr_t get_solution_address() {
+        return get_row_address(_header.lost);
+    }
+
+    FragmentationBlockDeviceWrapper* _flash;
+    bd_addr_t _offset;
+    size_t _size;
+    FragmentationPageBuffer* _page_buffer;
+    const frag_bits_t* _received;
+    uint16_t _pending[FRAG_JOURNAL_MAX_PENDING];
+    uint8_t _pending_count;
+    FragmentationJournalHeader_t _header;
+};
+
+#endif // _FRAGMENTATION_JOURNAL_H_
@@ -0,0 +1,67 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_MATRIX_LINE_H_
+#define _FRAGMENTATION_MATRIX_LINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "FragmentationBitMatrix.h"
+
+/**
+ * Parity-check matrix generator from the LoRaWAN fragmentation proposal.
+ * It has no dependencies on Mbed OS, so the host encoder (test-fw/encode-file) shares it with the
+ * device and creates the redundancy frames with the same matrix.
+ */
+
+/**
+ * One step of the PRBS23 pseudo-random generator
+ */
+static inline uint32_t frag_prbs23(uint32_t x) {
+    uint32_t b0 = x & 1;
+    uint32_t b1 = (x & 32) >> 5;
+    return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+/**
+ * Generate line `line_number` (1-based, so frame counter - NumberOfFragments) of the parity-check matrix
+ *
+ * @param line_number Redundancy line number, starting at 1
+ * @param line_length Number of fragments (columns)
+ * @param bits Packed bitset of at least frag_bits_words(line_length) words, set bits mark
+ *             fragments that are XOR'ed into this redundancy frame
+ */
+static inline void frag_matrix_line(uint32_t line_number, uint16_t line_length, frag_bits_t* bits) {
+    memset(bits, 0, frag_bits_words(line_length) * sizeof(frag_bits_t));
+
+    // make sure the modulo also hits the last column when the length is a power of 2
+    uint32_t m = (line_length != 0 && (line_length & (line_length - 1)) == 0) ? 1 : 0;
+
+    uint32_t x = 1 + (1001 * line_number);
+
+    for (uint16_t nb_coefficient = 0; nb_coefficient < line_length / 2; nb_coefficient++) {
+        uint32_t r = 1 << 16;
+        while (r >= line_length) {
+            x = frag_prbs23(x);
+            r = x % (line_length + m);
+        }
+        frag_bits_set(bits, r);
+    }
+}
+
+#endif // _FRAGMENTATION_MATRIX_LINE_H_
@@ -0,0 +1,386 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_PAGE_BUFFER_H_
+#define _FRAGMENTATION_PAGE_BUFFER_H_
+
+#include "mbed.h"
+#include "BlockDevice.h"
+
+// A 204 byte fragment touches at most two 528 byte pages
+#ifndef FRAG_PAGE_BUFFER_PAGES
+#define FRAG_PAGE_BUFFER_PAGES      2
+#endif
+
+#ifndef FRAG_PAGE_BUFFER_READ_PAGES
+#define FRAG_PAGE_BUFFER_READ_PAGES 0
+#endif
+
+/**
+ * Flash traffic below the page buffer, to see what a session costs on the SPI bus
+ */
+typedef struct {
+    uint32_t read_bytes;        // bytes read from the block device
+    uint32_t program_bytes;     // bytes programmed to the block device
+    uint32_t page_reads;        // read calls on the block device
+    uint32_t page_programs;     // program calls on the block device
+    uint32_t read_hits;         // pages (or parts of pages) read from the buffer
+    uint32_t read_misses;       // pages (or parts of pages) read from the block device
+} FragmentationPageBufferStats_t;
+
+/**
+ * Write-back page buffer that sits below FragmentationBlockDeviceWrapper.
+ *
+ * Fragments straddle the flash pages, so every fragment is a read-modify-write of one or two pages in the wrapper.
+ * This holds the last pages that were written in RAM, and only programs a page when it is evicted (by a write to
+ * another page, normally because the page is complete) or on sync(). Reads are served from the buffered pages first,
+ * so the decoder always reads its own writes.
+ *
+ * Extra read pages turn it into an LRU read cache as well: pages that are read are kept, so back-substitution
+ * (which reads the same fragments over and over) and hashing in small chunks don't read a page for every access.
+ * At most `pages` pages hold unwritten data, so reads never push out a page that is still being filled.
+ *
+ * Data in the buffer is not in flash yet, so anything that describes it (the journal, the session table) should be
+ * written after a sync(), in write-through mode. See FragmentationJournal.
+ *
+ * With 0 pages everything is passed through, which is useful to compare the stats.
+ */
+class FragmentationPageBuffer : public BlockDevice {
+public:
+    /**
+     * @param bd Block device to wrap, its erase size is used as page size
+     * @param pages Number of pages to buffer writes in
+     * @param read_pages Number of extra pages to cache reads in
+     */
+    FragmentationPageBuffer(BlockDevice* bd, size_t pages = FRAG_PAGE_BUFFER_PAGES,
+                            size_t read_pages = FRAG_PAGE_BUFFER_READ_PAGES)
+        : _bd(bd), _page_count(pages + read_pages), _write_pages(pages), _page_size(0), _pages(NULL), _data(NULL),
+          _tick(0), _write_through(false)
+    {
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    ~FragmentationPageBuffer() {
+        free(_pages);
+        free(_data);
+    }
+
+    virtual int init() {
+        int r = _bd->init();
+        if (r != BD_ERROR_OK) return r;
+
+        if (_page_count == 0 || _pages) {
+            return BD_ERROR_OK;
+        }
+
+        _page_size = _bd->get_erase_size();
+
+        _pages = (page_t*)calloc(_page_count, sizeof(page_t));
+        _data = (uint8_t*)malloc(_page_count * _page_size);
+        if (!_pages || !_data) {
+            free(_pages);
+            free(_data);
+            _pages = NULL;
+            _data = NULL;
+            return BD_ERROR_DEVICE_ERROR;
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    virtual int deinit() {
+        int r = sync();
+        if (r != BD_ERROR_OK) return r;
+
+        return _bd->deinit();
+    }
+
+    /**
+     * Program all buffered pages that were changed
+     */
+    virtual int sync() {
+        for (size_t ix = 0; ix < _page_count && _pages; ix++) {
+            int r = flush(&_pages[ix]);
+            if (r != BD_ERROR_OK) return r;
+        }
+
+        return _bd->sync();
+    }
+
+    virtual int read(void* buffer, bd_addr_t addr, bd_size_t size) {
+        uint8_t* out = (uint8_t*)buffer;
+
+        while (size > 0) {
+            bd_size_t len = size;
+            page_t* page = NULL;
+
+            if (_pages) {
+                bd_addr_t page_addr = addr - (addr % _page_size);
+                len = page_addr + _page_size - addr;
+                if (len > size) len = size;
+
+                page = find(page_addr);
+                if (page) {
+                    _stats.read_hits++;
+                }
+                else {
+                    _stats.read_misses++;
+
+                    int r = load(page_addr, true, false, &page);
+                    if (r != BD_ERROR_OK) return r;
+                }
+            }
+
+            if (page) {
+                memcpy(out, get_data(page) + (addr - page->address), len);
+                page->used = ++_tick;
+            }
+            else {
+                int r = device_read(out, addr, len);
+                if (r != BD_ERROR_OK) return r;
+            }
+
+            out += len;
+            addr += len;
+            size -= len;
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+        const uint8_t* in = (const uint8_t*)buffer;
+
+        if (!_pages) {
+            return device_program(in, addr, size);
+        }
+
+        while (size > 0) {
+            bd_addr_t page_addr = addr - (addr % _page_size);
+            bd_size_t len = page_addr + _page_size - addr;
+            if (len > size) len = size;
+
+            page_t* page = find(page_addr);
+
+            if (_write_through || _write_pages == 0) {
+                // keep a cached copy up to date, but don't take a page for it
+                if (page) memcpy(get_data(page) + (addr - page_addr), in, len);
+
+                int r = device_program(in, addr, len);
+                if (r != BD_ERROR_OK) return r;
+            }
+            else {
+                if (!page) {
+                    int r = load(page_addr, len != _page_size, true, &page);
+                    if (r != BD_ERROR_OK) return r;
+                }
+                else if (!page->dirty && get_dirty_count() >= _write_pages) {
+                    // a cached page becomes a write page, make room for it
+                    int r = flush(find_victim(true));
+                    if (r != BD_ERROR_OK) return r;
+                }
+
+                memcpy(get_data(page) + (addr - page_addr), in, len);
+                page->dirty = true;
+                page->used = ++_tick;
+            }
+
+            in += len;
+            addr += len;
+            size -= len;
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    virtual int erase(bd_addr_t addr, bd_size_t size) {
+        // buffered pages in the range hold data from before the erase, changes that were not programmed yet
+        // included, so drop them all. Programming a dirty page later would put the old data back.
+        for (size_t ix = 0; ix < _page_count && _pages; ix++) {
+            page_t* page = &_pages[ix];
+            if (page->valid && page->address >= addr && page->address < addr + size) {
+                page->valid = false;
+                page->dirty = false;
+            }
+        }
+
+        return _bd->erase(addr, size);
+    }
+
+    virtual bd_size_t get_read_size() const {
+        return _bd->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const {
+        return _bd->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const {
+        return _bd->get_erase_size();
+    }
+
+    virtual bd_size_t size() const {
+        return _bd->size();
+    }
+
+    /**
+     * Whether part of this range is only in the buffer, and not in flash yet
+     */
+    bool is_dirty(bd_addr_t addr, bd_size_t size) {
+        for (size_t ix = 0; ix < _page_count && _pages; ix++) {
+            page_t* page = &_pages[ix];
+            if (page->valid && page->dirty && page->address < addr + size && addr < page->address + _page_size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * In write-through mode programs go straight to the block device (e.g. for the journal)
+     */
+    void set_write_through(bool write_through) {
+        _write_through = write_through;
+    }
+
+    void get_stats(FragmentationPageBufferStats_t* stats) {
+        *stats = _stats;
+    }
+
+private:
+    typedef struct {
+        bd_addr_t address;
+        uint32_t used;          // tick of the last access, for LRU eviction
+        bool valid;
+        bool dirty;
+    } page_t;
+
+    uint8_t* get_data(page_t* page) {
+        return _data + ((page - _pages) * _page_size);
+    }
+
+    page_t* find(bd_addr_t page_addr) {
+        for (size_t ix = 0; ix < _page_count; ix++) {
+            if (_pages[ix].valid && _pages[ix].address == page_addr) {
+                return &_pages[ix];
+            }
+        }
+        return NULL;
+    }
+
+    size_t get_dirty_count() {
+        size_t count = 0;
+        for (size_t ix = 0; ix < _page_count; ix++) {
+            if (_pages[ix].valid && _pages[ix].dirty) count++;
+        }
+        return count;
+    }
+
+    /**
+     * Least recently used page that holds unwritten data (`dirty`), or that can be reused without writing it
+     */
+    page_t* find_victim(bool dirty) {
+        page_t* victim = NULL;
+        for (size_t ix = 0; ix < _page_count; ix++) {
+            page_t* page = &_pages[ix];
+            if (!page->valid) {
+                if (!dirty) return page;
+                continue;
+            }
+            if (page->dirty != dirty) continue;
+
+            if (!victim || page->used < victim->used) {
+                victim = page;
+            }
+        }
+        return victim;
+    }
+
+    /**
+     * Take a page for `page_addr`, evicting the least recently used page
+     *
+     * @param fill Read the page from flash, not needed when the whole page is overwritten
+     * @param write Whether the page is taken for a write, a read never evicts a page that holds unwritten data
+     * @param out Receives the page, or NULL if a read could not get one
+     */
+    int load(bd_addr_t page_addr, bool fill, bool write, page_t** out) {
+        page_t* page = NULL;
+        if (!write || get_dirty_count() < _write_pages) {
+            page = find_victim(false);
+        }
+        if (!page && write) {
+            page = find_victim(true);
+        }
+        if (!page) {
+            *out = NULL;
+            return BD_ERROR_OK;
+        }
+
+        int r = flush(page);
+        if (r != BD_ERROR_OK) return r;
+
+        page->valid = false;
+
+        if (fill) {
+            r = device_read(get_data(page), page_addr, _page_size);
+            if (r != BD_ERROR_OK) return r;
+        }
+
+        page->address = page_addr;
+        page->valid = true;
+        page->dirty = false;
+        page->used = ++_tick;
+        *out = page;
+        return BD_ERROR_OK;
+    }
+
+    int flush(page_t* page) {
+        if (!page->valid || !page->dirty) {
+            return BD_ERROR_OK;
+        }
+
+        int r = device_program(get_data(page), page->address, _page_size);
+        if (r != BD_ERROR_OK) return r;
+
+        page->dirty = false;
+        return BD_ERROR_OK;
+    }
+
+    int device_read(void* buffer, bd_addr_t addr, bd_size_t size) {
+        _stats.read_bytes += size;
+        _stats.page_reads++;
+        return _bd->read(buffer, addr, size);
+    }
+
+    int device_program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+        _stats.program_bytes += size;
+        _stats.page_programs++;
+        return _bd->program(buffer, addr, size);
+    }
+
+    BlockDevice* _bd;
+    size_t _page_count;
+    size_t _write_pages;
+    bd_size_t _page_size;
+    page_t* _pages;
+    uint8_t* _data;
+    uint32_t _tick;
+    bool _write_through;
+    FragmentationPageBufferStats_t _stats;
+};
+
+#endif // _FRAGMENTATION_PAGE_BUFFER_H_
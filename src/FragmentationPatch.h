@@ -0,0 +1,119 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_PATCH_H_
+#define _FRAGMENTATION_PATCH_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "FragmentationPatchCore.h"
+
+/**
+ * Streaming patch applier for delta updates. Reads the old image from memory (the running application, in internal
+ * flash), the patch from external flash, and writes the new image to external flash a page at a time. RAM use is the
+ * two buffers that are passed in, whatever the size of the images. The format is described in FragmentationPatchCore.
+ */
+class FragmentationPatch : public FragmentationPatchCore {
+public:
+    /**
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param page_buffer Buffer that the new image is gathered in, programmed when full (use the page size)
+     * @param page_buffer_size Size of the page buffer
+     * @param read_buffer Buffer to read the patch into
+     * @param read_buffer_size Size of the read buffer
+     */
+    FragmentationPatch(FragmentationBlockDeviceWrapper* flash, uint8_t* page_buffer, size_t page_buffer_size,
+                       uint8_t* read_buffer, size_t read_buffer_size)
+        : FragmentationPatchCore(page_buffer, page_buffer_size), _flash(flash), _page(page_buffer),
+          _page_size(page_buffer_size), _read(read_buffer), _read_size(read_buffer_size), _patch_offset(0), _patch_end(0),
+          _target_offset(0), _written(0)
+    {
+    }
+
+    /**
+     * Apply a patch
+     *
+     * @param old_image The old image
+     * @param old_size Size of the old image
+     * @param patch_offset Address of the patch in flash
+     * @param patch_size Size of the patch
+     * @param target_offset Address in flash to write the new image to, must not overlap the patch
+     * @param target_max Size of the region at target_offset
+     * @param new_size Receives the size of the new image
+     */
+    FragmentationPatchResult apply(const uint8_t* old_image, size_t old_size, bd_addr_t patch_offset, size_t patch_size,
+                                   bd_addr_t target_offset, size_t target_max, size_t* new_size) {
+        _patch_offset = patch_offset;
+        _patch_end = patch_offset + patch_size;
+        _target_offset = target_offset;
+        _written = 0;
+
+        FragmentationPatchResult r = FragmentationPatchCore::apply(old_image, old_size, target_max, new_size);
+
+        if (r == FRAG_PATCH_TOO_LARGE) {
+            debug("FragmentationPatch: new image is %lu bytes, only %u bytes available\n", get_new_size(), target_max);
+        }
+        else if (r == FRAG_PATCH_CORRUPT) {
+            debug("FragmentationPatch: patch is corrupt\n");
+        }
+
+        return r;
+    }
+
+    /**
+     * Copy a region of flash through the page buffer, e.g. to move the patch out of the way of the new image
+     */
+    FragmentationPatchResult copy(bd_addr_t from, bd_addr_t to, size_t size) {
+        for (size_t offset = 0; offset < size; offset += _page_size) {
+            size_t len = size - offset < _page_size ? size - offset : _page_size;
+
+            if (_flash->read(_page, from + offset, len) != BD_ERROR_OK) return FRAG_PATCH_FLASH_ERROR;
+            if (_flash->program(_page, to + offset, len) != BD_ERROR_OK) return FRAG_PATCH_FLASH_ERROR;
+        }
+        return FRAG_PATCH_OK;
+    }
+
+protected:
+    virtual FragmentationPatchResult refill(const uint8_t** data, size_t* size) {
+        *size = _patch_end - _patch_offset < _read_size ? _patch_end - _patch_offset : _read_size;
+        *data = _read;
+
+        if (*size > 0 && _flash->read(_read, _patch_offset, *size) != BD_ERROR_OK) return FRAG_PATCH_FLASH_ERROR;
+        _patch_offset += *size;
+        return FRAG_PATCH_OK;
+    }
+
+    virtual FragmentationPatchResult flush(const uint8_t* data, size_t size) {
+        if (_flash->program(data, _target_offset + _written, size) != BD_ERROR_OK) return FRAG_PATCH_FLASH_ERROR;
+        _written += size;
+        return FRAG_PATCH_OK;
+    }
+
+private:
+    FragmentationBlockDeviceWrapper* _flash;
+    uint8_t* _page;
+    size_t _page_size;
+    uint8_t* _read;
+    size_t _read_size;
+    bd_addr_t _patch_offset;    // next address to read the patch from
+    bd_addr_t _patch_end;
+    bd_addr_t _target_offset;
+    size_t _written;
+};
+
+#endif // _FRAGMENTATION_PATCH_H_
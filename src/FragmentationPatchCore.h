@@ -0,0 +1,208 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_PATCH_CORE_H_
+#define _FRAGMENTATION_PATCH_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Patch commands, see FragmentationPatchCore
+#define FRAG_PATCH_COPY         0x00
+#define FRAG_PATCH_INSERT       0x01
+#define FRAG_PATCH_SEEK         0x02
+
+enum FragmentationPatchResult {
+    FRAG_PATCH_OK = 0,
+    FRAG_PATCH_FLASH_ERROR = -1,        // reading the patch or programming the new image failed
+    FRAG_PATCH_CORRUPT = -2,            // unknown command, truncated patch, or a copy outside of the old image
+    FRAG_PATCH_TOO_LARGE = -3           // the new image does not fit in the target region
+};
+
+/**
+ * Patch applier for delta updates, without dependencies on Mbed OS so host tools (test-fw/verify-package) patch
+ * exactly like the device. The old image is in memory, the patch comes in through refill(), and the new image is
+ * gathered in a page buffer that is handed to flush() every time it fills up. See FragmentationPatch for the device,
+ * which reads the patch from and writes the new image to flash.
+ *
+ * The patch starts with the size of the new image, followed by commands until the new image is complete.
+ * Numbers are unsigned LEB128 (7 bits per byte, least significant first, top bit set if more bytes follow).
+ *
+ *     FRAG_PATCH_COPY   <length>           copy `length` bytes from the old image, at the old position, which moves along
+ *     FRAG_PATCH_INSERT <length> <bytes>   write `length` bytes from the patch
+ *     FRAG_PATCH_SEEK   <offset>           move the old position, the offset is zigzag encoded (0, -1, 1, -2, ...)
+ */
+class FragmentationPatchCore {
+public:
+    /**
+     * @param page_buffer Buffer that the new image is gathered in
+     * @param page_buffer_size Size of the page buffer
+     */
+    FragmentationPatchCore(uint8_t* page_buffer, size_t page_buffer_size)
+        : _page(page_buffer), _page_size(page_buffer_size), _page_len(0), _input(NULL), _input_pos(0), _input_len(0),
+          _size(0)
+    {
+    }
+
+    virtual ~FragmentationPatchCore() {
+    }
+
+    /**
+     * Apply the patch that refill() returns
+     *
+     * @param old_image The old image
+     * @param old_size Size of the old image
+     * @param target_max Maximum size of the new image
+     * @param new_size Receives the size of the new image
+     */
+    FragmentationPatchResult apply(const uint8_t* old_image, size_t old_size, size_t target_max, size_t* new_size) {
+        _input_pos = _input_len = 0;
+        _page_len = 0;
+
+        FragmentationPatchResult r;
+        if ((r = read_number(&_size)) != FRAG_PATCH_OK) return r;
+
+        if (_size > target_max) return FRAG_PATCH_TOO_LARGE;
+
+        const uint32_t size = _size;
+        size_t old_pos = 0;
+        size_t out_size = 0;
+
+        while (out_size < size) {
+            uint8_t command;
+            uint32_t arg;
+            if ((r = read_byte(&command)) != FRAG_PATCH_OK) return r;
+            if ((r = read_number(&arg)) != FRAG_PATCH_OK) return r;
+
+            switch (command) {
+                case FRAG_PATCH_COPY:
+                    if (arg > old_size - old_pos || arg > size - out_size) return FRAG_PATCH_CORRUPT;
+
+                    if ((r = write(old_image + old_pos, arg)) != FRAG_PATCH_OK) return r;
+                    old_pos += arg;
+                    out_size += arg;
+                    break;
+
+                case FRAG_PATCH_INSERT:
+                    if (arg > size - out_size) return FRAG_PATCH_CORRUPT;
+
+                    for (uint32_t ix = 0; ix < arg; ix++) {
+                        uint8_t b;
+                        if ((r = read_byte(&b)) != FRAG_PATCH_OK) return r;
+                        if ((r = write(&b, 1)) != FRAG_PATCH_OK) return r;
+                    }
+                    out_size += arg;
+                    break;
+
+                case FRAG_PATCH_SEEK: {
+                    // zigzag, so small negative offsets stay short
+                    int32_t offset = (arg & 1) ? -(int32_t)(arg >> 1) - 1 : (int32_t)(arg >> 1);
+                    if ((offset < 0 && (size_t)(-(int64_t)offset) > old_pos) || (offset > 0 && (size_t)offset > old_size - old_pos)) {
+                        return FRAG_PATCH_CORRUPT;
+                    }
+                    old_pos += offset;
+                    break;
+                }
+
+                default:
+                    return FRAG_PATCH_CORRUPT;
+            }
+        }
+
+        if (_page_len > 0 && (r = flush(_page, _page_len)) != FRAG_PATCH_OK) return r;
+        _page_len = 0;
+
+        *new_size = size;
+        return FRAG_PATCH_OK;
+    }
+
+    /**
+     * Size of the new image as stored in the patch, valid once apply() got past the header
+     */
+    uint32_t get_new_size() {
+        return _size;
+    }
+
+protected:
+    /**
+     * Get the next part of the patch
+     *
+     * @param data Receives a pointer to the data, which stays valid until the next call
+     * @param size Receives the size of the data, 0 once the whole patch was returned
+     */
+    virtual FragmentationPatchResult refill(const uint8_t** data, size_t* size) = 0;
+
+    /**
+     * Take the next part of the new image
+     */
+    virtual FragmentationPatchResult flush(const uint8_t* data, size_t size) = 0;
+
+private:
+    FragmentationPatchResult read_byte(uint8_t* b) {
+        if (_input_pos == _input_len) {
+            _input_pos = 0;
+            FragmentationPatchResult r = refill(&_input, &_input_len);
+            if (r != FRAG_PATCH_OK) return r;
+
+            if (_input_len == 0) return FRAG_PATCH_CORRUPT;
+        }
+
+        *b = _input[_input_pos++];
+        return FRAG_PATCH_OK;
+    }
+
+    FragmentationPatchResult read_number(uint32_t* value) {
+        *value = 0;
+        for (int shift = 0; shift < 32; shift += 7) {
+            uint8_t b;
+            FragmentationPatchResult r = read_byte(&b);
+            if (r != FRAG_PATCH_OK) return r;
+
+            *value |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return FRAG_PATCH_OK;
+        }
+        return FRAG_PATCH_CORRUPT;
+    }
+
+    FragmentationPatchResult write(const uint8_t* data, size_t len) {
+        while (len > 0) {
+            size_t chunk = _page_size - _page_len < len ? _page_size - _page_len : len;
+            memcpy(_page + _page_len, data, chunk);
+            _page_len += chunk;
+            data += chunk;
+            len -= chunk;
+
+            if (_page_len == _page_size) {
+                _page_len = 0;
+                FragmentationPatchResult r = flush(_page, _page_size);
+                if (r != FRAG_PATCH_OK) return r;
+            }
+        }
+        return FRAG_PATCH_OK;
+    }
+
+    uint8_t* _page;
+    size_t _page_size;
+    size_t _page_len;
+    const uint8_t* _input;
+    size_t _input_pos;
+    size_t _input_len;
+    uint32_t _size;
+};
+
+#endif // _FRAGMENTATION_PATCH_CORE_H_
@@ -0,0 +1,265 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_REPLAY_H_
+#define _FRAGMENTATION_REPLAY_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_lorawan_frag_lib.h"
+
+// Map replay files from a file system, where there is one (the simulator, or a native build)
+#ifndef FRAG_REPLAY_MMAP
+#if defined(TARGET_SIMULATOR) || defined(__unix__) || defined(__APPLE__)
+#define FRAG_REPLAY_MMAP    1
+#else
+#define FRAG_REPLAY_MMAP    0
+#endif
+#endif
+
+#if FRAG_REPLAY_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// 'FRPL', little endian
+#define FRAG_REPLAY_MAGIC       0x4c505246
+#define FRAG_REPLAY_VERSION     1
+
+/**
+ * Header of a replay file, written by test-fw/create-packets-h.js --replay. All fields are little endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                 // FRAG_REPLAY_MAGIC
+    uint16_t version;               // FRAG_REPLAY_VERSION
+    uint16_t header_size;           // sizeof(FragmentationReplayHeader_t), later versions may add fields
+    uint32_t file_size;
+    uint16_t number_of_fragments;   // session opts, as in the FragSessionSetupReq
+    uint8_t  fragment_size;
+    uint8_t  padding;
+    uint32_t frame_count;           // uncoded fragments and redundancy frames
+    uint16_t frame_size;            // every frame is the DataFragment command: id, 2 bytes index and N, payload
+    uint16_t loss_mask_count;
+    uint64_t crc64;                 // CRC64 of the package, normally retrieved from the network
+    uint32_t frames_offset;         // frame_count * frame_size bytes
+    uint32_t timestamps_offset;     // frame_count uint32_t, ms since the first frame, 0 if there are none
+    uint32_t loss_masks_offset;     // loss_mask_count bitmaps of (frame_count + 7) / 8 bytes, 0 if there are none
+    uint32_t reserved;
+} FragmentationReplayHeader_t;
+
+enum FragmentationReplayResult {
+    FRAG_REPLAY_OK = 0,
+    FRAG_REPLAY_OPEN_ERROR = -1,    // the file could not be opened or mapped
+    FRAG_REPLAY_INVALID = -2,       // not a replay file, or the tables do not fit in it
+    FRAG_REPLAY_NEWER_VERSION = -3  // written by a newer version of the tools
+};
+
+/**
+ * Reader for replay files: the fragments of a package as they are sent, with the session opts and the CRC64, and
+ * optionally the time every frame came in and masks with the frames that were lost in captured sessions.
+ *
+ * The file is mapped (or passed in memory) and frames are handed out as pointers into it, nothing is copied, so
+ * images of several megabytes can be replayed against the same binary without building them into flash.
+ */
+class FragmentationReplay {
+public:
+    FragmentationReplay() : _data(NULL), _size(0), _mapped(false), _header(NULL)
+    {
+    }
+
+    ~FragmentationReplay() {
+        close();
+    }
+
+    /**
+     * Map a replay file
+     *
+     * @param path Path of the file
+     */
+    FragmentationReplayResult open(const char* path) {
+        close();
+
+#if FRAG_REPLAY_MMAP
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            debug("FragmentationReplay could not open %s\n", path);
+            return FRAG_REPLAY_OPEN_ERROR;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            debug("FragmentationReplay could not stat %s\n", path);
+            ::close(fd);
+            return FRAG_REPLAY_OPEN_ERROR;
+        }
+
+        if (st.st_size < (off_t)sizeof(FragmentationReplayHeader_t)) {
+            ::close(fd);
+            return FRAG_REPLAY_INVALID;
+        }
+
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            debug("FragmentationReplay could not map %s\n", path);
+            return FRAG_REPLAY_OPEN_ERROR;
+        }
+
+        _mapped = true;
+        return attach((const uint8_t*)data, st.st_size);
+#else
+        (void)path;
+        return FRAG_REPLAY_OPEN_ERROR;
+#endif
+    }
+
+    /**
+     * Use a replay file that is already in memory, it needs to stay there until close()
+     *
+     * @param data Start of the file, 4 byte aligned
+     * @param size Size of the file
+     */
+    FragmentationReplayResult open(const void* data, size_t size) {
+        close();
+        return attach((const uint8_t*)data, size);
+    }
+
+    void close() {
+#if FRAG_REPLAY_MMAP
+        if (_mapped) {
+            munmap((void*)_data, _size);
+        }
+#endif
+        _data = NULL;
+        _size = 0;
+        _mapped = false;
+        _header = NULL;
+    }
+
+    /**
+     * Session opts from the header, FlashOffset is not part of the file
+     */
+    void get_opts(FragmentationSessionOpts_t* opts) const {
+        opts->NumberOfFragments = _header->number_of_fragments;
+        opts->FragmentSize = _header->fragment_size;
+        opts->Padding = _header->padding;
+        opts->RedundancyPackets = _header->frame_count - _header->number_of_fragments;
+    }
+
+    uint64_t get_crc64() const {
+        return _header->crc64;
+    }
+
+    size_t get_frame_count() const {
+        return _header->frame_count;
+    }
+
+    size_t get_frame_size() const {
+        return _header->frame_size;
+    }
+
+    /**
+     * The DataFragment command of a frame, points into the file
+     */
+    const uint8_t* get_frame(size_t ix) const {
+        return _data + _header->frames_offset + ix * _header->frame_size;
+    }
+
+    bool has_timestamps() const {
+        return _header->timestamps_offset != 0;
+    }
+
+    /**
+     * Time the frame came in, in ms since the first frame (0 if the file has no timestamps)
+     */
+    uint32_t get_timestamp(size_t ix) const {
+        if (!has_timestamps()) return 0;
+        return ((const uint32_t*)(_data + _header->timestamps_offset))[ix];
+    }
+
+    size_t get_loss_mask_count() const {
+        return _header->loss_mask_count;
+    }
+
+    /**
+     * Whether a frame was lost in a captured session
+     *
+     * @param mask Index of the loss mask, frames are never lost for a mask that is not in the file (e.g. -1)
+     * @param ix Index of the frame
+     */
+    bool is_lost(int mask, size_t ix) const {
+        if (mask < 0 || (size_t)mask >= _header->loss_mask_count) return false;
+
+        const uint8_t* bitmap = _data + _header->loss_masks_offset + mask * get_mask_size();
+        return (bitmap[ix / 8] >> (ix % 8)) & 1;
+    }
+
+private:
+    size_t get_mask_size() const {
+        return (_header->frame_count + 7) / 8;
+    }
+
+    /**
+     * Check that the header is ours and that every table lies within the file
+     */
+    FragmentationReplayResult attach(const uint8_t* data, size_t size) {
+        _data = data;
+        _size = size;
+
+        const FragmentationReplayHeader_t* header = (const FragmentationReplayHeader_t*)data;
+        FragmentationReplayResult result = FRAG_REPLAY_OK;
+
+        if (size < sizeof(FragmentationReplayHeader_t) || header->magic != FRAG_REPLAY_MAGIC) {
+            result = FRAG_REPLAY_INVALID;
+        }
+        else if (header->version > FRAG_REPLAY_VERSION) {
+            result = FRAG_REPLAY_NEWER_VERSION;
+        }
+        else if (header->header_size < sizeof(FragmentationReplayHeader_t) || header->file_size != size
+                 || header->frame_size < 3 || header->frame_count < header->number_of_fragments
+                 || header->frame_count - header->number_of_fragments > 0xffff
+                 || !fits(header->frames_offset, (uint64_t)header->frame_count * header->frame_size)
+                 || (header->timestamps_offset && (header->timestamps_offset % 4
+                     || !fits(header->timestamps_offset, (uint64_t)header->frame_count * 4)))
+                 || (header->loss_mask_count && !fits(header->loss_masks_offset,
+                     (uint64_t)header->loss_mask_count * ((header->frame_count + 7) / 8)))) {
+            result = FRAG_REPLAY_INVALID;
+        }
+
+        if (result != FRAG_REPLAY_OK) {
+            debug("FragmentationReplay file is not valid (%d)\n", result);
+            close();
+            return result;
+        }
+
+        _header = header;
+        return FRAG_REPLAY_OK;
+    }
+
+    bool fits(uint32_t offset, uint64_t len) const {
+        return offset >= sizeof(FragmentationReplayHeader_t) && offset + len <= _size;
+    }
+
+    const uint8_t* _data;
+    size_t _size;
+    bool _mapped;
+    const FragmentationReplayHeader_t* _header;
+};
+
+#endif // _FRAGMENTATION_REPLAY_H_
@@ -0,0 +1,108 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_SCRATCH_H_
+#define _FRAGMENTATION_SCRATCH_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include <new>
+
+#ifndef FRAG_SCRATCH_SIZE
+#define FRAG_SCRATCH_SIZE           1024
+#endif
+
+#if (FRAG_SCRATCH_SIZE % 8) != 0
+#error "FRAG_SCRATCH_SIZE must be a multiple of 8"
+#endif
+
+// Every allocation is rounded up to 8 bytes, use this to add up the size of a stage for the build-time check
+#define FRAG_SCRATCH_ALIGN(size)    (((size) + 7) & ~((size_t)7))
+
+/**
+ * Statically sized arena for the stages after reception (hashing, signature verification, writing the header).
+ *
+ * Allocations are taken from the top like a stack. A stage takes a mark, allocates what it needs, and releases back to
+ * the mark when it's done, so the next stage reuses the same memory. Nothing goes through the heap, so the
+ * verification does not leave holes behind that break the allocations of the next session.
+ *
+ * Objects are created with placement new, and their destructor is called before releasing:
+ *
+ *     size_t mark = scratch.get_mark();
+ *     Foo* foo = new (scratch.alloc(sizeof(Foo))) Foo();
+ *     ...
+ *     foo->~Foo();
+ *     scratch.release(mark);
+ *
+ * Add up the FRAG_SCRATCH_ALIGN'ed sizes of a stage and check them against FRAG_SCRATCH_SIZE with MBED_STATIC_ASSERT,
+ * so a stage that does not fit fails the build rather than the update.
+ */
+class FragmentationScratch {
+public:
+    FragmentationScratch() : _top(0), _peak(0) {
+    }
+
+    /**
+     * Allocate `size` bytes, 8 byte aligned
+     *
+     * @returns Pointer to the memory, or NULL if the arena is full
+     */
+    void* alloc(size_t size) {
+        size = FRAG_SCRATCH_ALIGN(size);
+        if (size > FRAG_SCRATCH_SIZE - _top) {
+            debug("FragmentationScratch: no room for %u bytes (%u of %u used)\n", size, _top, FRAG_SCRATCH_SIZE);
+            return NULL;
+        }
+
+        void* ptr = (uint8_t*)_buffer + _top;
+        _top += size;
+        if (_top > _peak) {
+            _peak = _top;
+        }
+        return ptr;
+    }
+
+    /**
+     * Current top of the arena, to release to when a stage is done
+     */
+    size_t get_mark() {
+        return _top;
+    }
+
+    /**
+     * Release everything that was allocated after `mark`
+     */
+    void release(size_t mark) {
+        if (mark < _top) {
+            _top = mark;
+        }
+    }
+
+    /**
+     * Most bytes that were in use at the same time
+     */
+    size_t get_peak() {
+        return _peak;
+    }
+
+private:
+    uint64_t _buffer[FRAG_SCRATCH_SIZE / 8];
+    size_t _top;
+    size_t _peak;
+};
+
+#endif // _FRAGMENTATION_SCRATCH_H_
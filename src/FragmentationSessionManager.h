@@ -0,0 +1,369 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_SESSION_MANAGER_H_
+#define _FRAGMENTATION_SESSION_MANAGER_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "update-client-common/arm_uc_utilities.h"
+#include "FragmentationDecoder.h"
+#include "FragmentationFlashAllocator.h"
+#include "FragmentationJournal.h"
+#include "FragmentationPageBuffer.h"
+
+// LoRaWAN fragmentation allows for four concurrent sessions, selected through FragIndex
+#define FRAG_SESSION_MAX                4
+
+#define FRAG_SESSION_TABLE_MAGIC        0x42545346 // 'FSTB'
+#define FRAG_SESSION_TABLE_VERSION      1
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t in_use;
+    uint8_t reserved[3];
+    uint32_t storage_offset;
+    uint32_t storage_size;
+    uint32_t journal_offset;
+    uint32_t journal_size;
+} FragmentationSessionTableEntry_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    FragmentationSessionTableEntry_t sessions[FRAG_SESSION_MAX];
+    uint32_t crc;                       // CRC32 over all fields above
+} FragmentationSessionTable_t;
+
+/**
+ * Runs up to FRAG_SESSION_MAX fragmentation sessions at the same time (e.g. firmware and a configuration blob).
+ *
+ * Flash for the fragments and the journal of every session is handed out by a FragmentationFlashAllocator.
+ * Where every session lives is kept in a small table in flash, so all sessions can be resumed after a reset.
+ * Frames are routed to their session on the FragIndex bits of the fragment header.
+ */
+class FragmentationSessionManager {
+public:
+    /**
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param start First address in flash that sessions can use
+     * @param end Address after the last byte that sessions can use
+     * @param table_offset Address in flash of the session table, outside of [start, end)
+     * @param alignment Alignment of the regions handed out, normally the erase size of the block device
+     * @param page_buffer Page buffer below `flash`, if there is one
+     */
+    FragmentationSessionManager(FragmentationBlockDeviceWrapper* flash, bd_addr_t start, bd_addr_t end,
+                                bd_addr_t table_offset, bd_size_t alignment, FragmentationPageBuffer* page_buffer = NULL)
+        : _flash(flash), _allocator(start, end, alignment), _table_offset(table_offset), _page_buffer(page_buffer)
+    {
+        memset(&_table, 0, sizeof(_table));
+        memset(_sessions, 0, sizeof(_sessions));
+        memset(_journals, 0, sizeof(_journals));
+    }
+
+    /**
+     * Frees the sessions from RAM, their state in flash is kept
+     */
+    ~FragmentationSessionManager() {
+        for (uint8_t ix = 0; ix < FRAG_SESSION_MAX; ix++) {
+            close(ix);
+        }
+    }
+
+    /**
+     * Resume all sessions in the session table. Sessions that can't be resumed are dropped.
+     *
+     * @returns FRAG_OK, or an error code
+     */
+    FragResult resume() {
+        if (_flash->read(&_table, _table_offset, sizeof(_table)) != BD_ERROR_OK) {
+            return FRAG_FLASH_WRITE_ERROR;
+        }
+
+        if (_table.magic != FRAG_SESSION_TABLE_MAGIC || _table.version != FRAG_SESSION_TABLE_VERSION
+                || _table.crc != table_crc()) {
+            memset(&_table, 0, sizeof(_table));
+            return FRAG_OK;
+        }
+
+        for (uint8_t ix = 0; ix < FRAG_SESSION_MAX; ix++) {
+            FragmentationSessionTableEntry_t* entry = &_table.sessions[ix];
+            if (!entry->in_use) continue;
+
+            if (!_allocator.allocate_at(entry->storage_offset, entry->storage_size)) {
+                debug("FragmentationSessionManager: session %d overlaps with another session, dropping it\n", ix);
+                memset(entry, 0, sizeof(*entry));
+                continue;
+            }
+            if (!_allocator.allocate_at(entry->journal_offset, entry->journal_size)) {
+                debug("FragmentationSessionManager: session %d overlaps with another session, dropping it\n", ix);
+                _allocator.free(entry->storage_offset);
+                memset(entry, 0, sizeof(*entry));
+                continue;
+            }
+
+            _journals[ix] = new FragmentationJournal(_flash, entry->journal_offset, entry->journal_size, _page_buffer);
+            if (!_journals[ix]->load()) {
+                debug("FragmentationSessionManager: session %d has no journal, dropping it\n", ix);
+                release(ix);
+                continue;
+            }
+
+            _sessions[ix] = new FragmentationDecoder(_flash, _journals[ix]->get_opts(), _journals[ix]);
+
+            FragResult r = _sessions[ix]->resume();
+            if (r != FRAG_OK && r != FRAG_COMPLETE) {
+                debug("FragmentationSessionManager: session %d could not be resumed (%d)\n", ix, r);
+                release(ix);
+            }
+        }
+
+        return write_table() == BD_ERROR_OK ? FRAG_OK : FRAG_FLASH_WRITE_ERROR;
+    }
+
+    /**
+     * Set up a new session, replacing any session with the same FragIndex
+     *
+     * @param frag_index FragIndex of the session (0..3)
+     * @param opts Options for the session, FlashOffset is set to the region that was allocated
+     * @param address Place the fragments at this address (e.g. where the bootloader looks for firmware),
+     *                or FRAG_ADDRESS_NONE to place them anywhere
+     *
+     * @returns FRAG_OK, FRAG_NO_MEMORY if there is not enough RAM or flash, or an error code
+     */
+    FragResult setup_session(uint8_t frag_index, FragmentationSessionOpts_t* opts, bd_addr_t address = FRAG_ADDRESS_NONE) {
+        if (frag_index >= FRAG_SESSION_MAX) {
+            return FRAG_SIZE_INCORRECT;
+        }
+
+        if (_table.sessions[frag_index].in_use) {
+            release(frag_index);
+        }
+
+        FragmentationSessionTableEntry_t* entry = &_table.sessions[frag_index];
+
+        // rows for more lost fragments than there are redundancy packets are never needed
+        entry->storage_size = opts->NumberOfFragments * opts->FragmentSize;
+        entry->journal_size = FragmentationJournal::get_size(*opts, opts->RedundancyPackets);
+
+        if (address == FRAG_ADDRESS_NONE) {
+            address = _allocator.allocate(entry->storage_size);
+            if (address == FRAG_ADDRESS_NONE) return setup_failed(frag_index, FRAG_NO_MEMORY);
+        }
+        else if (!_allocator.allocate_at(address, entry->storage_size)) {
+            return setup_failed(frag_index, FRAG_NO_MEMORY);
+        }
+        entry->storage_offset = address;
+
+        bd_addr_t journal_offset = _allocator.allocate(entry->journal_size);
+        if (journal_offset == FRAG_ADDRESS_NONE) {
+            _allocator.free(entry->storage_offset);
+            return setup_failed(frag_index, FRAG_NO_MEMORY);
+        }
+        entry->journal_offset = journal_offset;
+
+        entry->in_use = 1;
+        opts->FlashOffset = entry->storage_offset;
+
+        _journals[frag_index] = new FragmentationJournal(_flash, entry->journal_offset, entry->journal_size, _page_buffer);
+        _sessions[frag_index] = new FragmentationDecoder(_flash, *opts, _journals[frag_index]);
+
+        FragResult r = _sessions[frag_index]->initialize();
+        if (r != FRAG_OK) {
+            release(frag_index);
+            return setup_failed(frag_index, r);
+        }
+
+        return write_table() == BD_ERROR_OK ? FRAG_OK : FRAG_FLASH_WRITE_ERROR;
+    }
+
+    /**
+     * Delete a session, its flash region is released
+     */
+    FragResult delete_session(uint8_t frag_index) {
+        if (frag_index >= FRAG_SESSION_MAX || !_table.sessions[frag_index].in_use) {
+            return FRAG_OK;
+        }
+
+        release(frag_index);
+
+        return write_table() == BD_ERROR_OK ? FRAG_OK : FRAG_FLASH_WRITE_ERROR;
+    }
+
+    /**
+     * Process a data fragment
+     *
+     * @param index_and_n The 16-bit Index&N field of the DataFragment command, FragIndex in the top 2 bits
+     *                    and the frame counter in the lower 14 bits
+     * @param buffer Frame payload, without the fragmentation header
+     * @param size Size of the buffer
+     *
+     * @returns Result of the session, FRAG_OK if there is no session for this FragIndex
+     */
+    FragResult process_frame(uint16_t index_and_n, uint8_t* buffer, size_t size) {
+        FragmentationDecoder* session = _sessions[index_and_n >> 14];
+        if (!session) {
+            return FRAG_OK;
+        }
+
+        return session->process_frame(index_and_n & 0x3fff, buffer, size);
+    }
+
+    /**
+     * Get a session
+     *
+     * @returns The session, or NULL if there is no session for this FragIndex
+     */
+    FragmentationDecoder* get_session(uint8_t frag_index) {
+        return frag_index < FRAG_SESSION_MAX ? _sessions[frag_index] : NULL;
+    }
+
+    /**
+     * Get the options of a session
+     *
+     * @returns true if there is a session for this FragIndex
+     */
+    bool get_opts(uint8_t frag_index, FragmentationSessionOpts_t* opts) {
+        if (frag_index >= FRAG_SESSION_MAX || !_journals[frag_index]) {
+            return false;
+        }
+
+        *opts = _journals[frag_index]->get_opts();
+        return true;
+    }
+
+    /**
+     * Address of the session table when it takes the last `blocks` erase blocks of the device, so the layout follows
+     * the flash that is actually fitted. Call after the block device was initialized.
+     *
+     * @returns The address, or FRAG_ADDRESS_NONE if the device is smaller than that
+     */
+    static bd_addr_t get_table_offset(BlockDevice* bd, bd_size_t blocks) {
+        bd_size_t size = blocks * bd->get_erase_size();
+        if (size < sizeof(FragmentationSessionTable_t) || size > bd->size()) {
+            return FRAG_ADDRESS_NONE;
+        }
+
+        return bd->size() - size;
+    }
+
+    /**
+     * Allocate a region that does not belong to a session, e.g. to stage data while a package is post-processed.
+     * It's not in the session table, so it's gone after a reset.
+     *
+     * @param size Size of the region
+     * @param address Place the region at this address, or FRAG_ADDRESS_NONE to place it at the end of the free space
+     *
+     * @returns Address of the region, or FRAG_ADDRESS_NONE if there is no room
+     */
+    bd_addr_t allocate_scratch(bd_size_t size, bd_addr_t address = FRAG_ADDRESS_NONE) {
+        if (address == FRAG_ADDRESS_NONE) {
+            return _allocator.allocate_top(size);
+        }
+
+        return _allocator.allocate_at(address, size) ? address : FRAG_ADDRESS_NONE;
+    }
+
+    /**
+     * Release a region from allocate_scratch()
+     */
+    void free_scratch(bd_addr_t address) {
+        _allocator.free(address);
+    }
+
+    /**
+     * Number of bytes that are free from address up to the next region in use
+     */
+    bd_size_t get_free_size_at(bd_addr_t address) {
+        return _allocator.get_free_size_at(address);
+    }
+
+    /**
+     * Free the RAM of a session, its state in flash is kept (so it is resumed after a reset)
+     */
+    void close(uint8_t frag_index) {
+        if (frag_index >= FRAG_SESSION_MAX) {
+            return;
+        }
+
+        if (_sessions[frag_index]) {
+            delete _sessions[frag_index];
+            _sessions[frag_index] = NULL;
+        }
+        if (_journals[frag_index]) {
+            delete _journals[frag_index];
+            _journals[frag_index] = NULL;
+        }
+    }
+
+    /**
+     * Invalidate the session table, so no session is resumed after the next reset
+     */
+    static int clear(FragmentationBlockDeviceWrapper* flash, bd_addr_t table_offset) {
+        uint32_t magic = 0;
+        return flash->program(&magic, table_offset, sizeof(magic));
+    }
+
+private:
+    /**
+     * Free the RAM and flash of a session
+     */
+    void release(uint8_t frag_index) {
+        FragmentationSessionTableEntry_t* entry = &_table.sessions[frag_index];
+
+        close(frag_index);
+        _allocator.free(entry->storage_offset);
+        _allocator.free(entry->journal_offset);
+        memset(entry, 0, sizeof(*entry));
+    }
+
+    /**
+     * Drop the entry of a session that could not be set up, the session it replaced is gone too
+     */
+    FragResult setup_failed(uint8_t frag_index, FragResult result) {
+        memset(&_table.sessions[frag_index], 0, sizeof(_table.sessions[frag_index]));
+        write_table();
+        return result;
+    }
+
+    uint32_t table_crc() {
+        return arm_uc_crc32((const uint8_t*)&_table, offsetof(FragmentationSessionTable_t, crc));
+    }
+
+    int write_table() {
+        _table.magic = FRAG_SESSION_TABLE_MAGIC;
+        _table.version = FRAG_SESSION_TABLE_VERSION;
+        _table.crc = table_crc();
+
+        // the table only points at regions, it does not need to wait for the data in the page buffer
+        if (_page_buffer) _page_buffer->set_write_through(true);
+        int r = _flash->program(&_table, _table_offset, sizeof(_table));
+        if (_page_buffer) _page_buffer->set_write_through(false);
+        return r;
+    }
+
+    FragmentationBlockDeviceWrapper* _flash;
+    FragmentationFlashAllocator _allocator;
+    bd_addr_t _table_offset;
+    FragmentationPageBuffer* _page_buffer;
+    FragmentationSessionTable_t _table;
+    FragmentationDecoder* _sessions[FRAG_SESSION_MAX];      // indexed by FragIndex
+    FragmentationJournal* _journals[FRAG_SESSION_MAX];
+};
+
+#endif // _FRAGMENTATION_SESSION_MANAGER_H_
@@ -0,0 +1,232 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_VERIFIED_BLOCK_DEVICE_H_
+#define _FRAGMENTATION_VERIFIED_BLOCK_DEVICE_H_
+
+#include "mbed.h"
+#include "mbed_debug.h"
+#include "BlockDevice.h"
+
+// Number of times a program is retried when the read-back does not match
+#ifndef FRAG_VERIFY_RETRIES
+#define FRAG_VERIFY_RETRIES         3
+#endif
+
+// Time between two read-backs (or ready checks) while the device might still be writing the page
+#ifndef FRAG_VERIFY_POLL_US
+#define FRAG_VERIFY_POLL_US         250
+#endif
+
+// Longest a program can take, longer than the page erase and program time of the AT45
+#ifndef FRAG_VERIFY_TIMEOUT_US
+#define FRAG_VERIFY_TIMEOUT_US      40000
+#endif
+
+// The ready callback did not report ready within FRAG_VERIFY_TIMEOUT_US
+#define FRAG_VERIFY_ERROR_BUSY      -4100
+
+#define FRAG_VERIFY_CHUNK_SIZE      32
+
+/**
+ * Block device that only returns from program() once the data is in flash.
+ *
+ * After every program the device is synced and the data is read back, until it matches. On the AT45 a program
+ * returns while the page is still being written, and a read-modify-write of the next frame would read the page before
+ * it was done (which corrupted the image without a delay between frames). Waiting for the data makes the next
+ * operation wait for the device instead.
+ *
+ * With a ready callback (e.g. the RDY/BUSY bit in the status register of the AT45) the data is compared once the device
+ * reports ready. Without one the data is read back every FRAG_VERIFY_POLL_US, and only when it still does not match
+ * after FRAG_VERIFY_TIMEOUT_US (when any program is done) the page is programmed again.
+ *
+ * The underlying device needs to allow programming a page that was programmed before (like the AT45 and the
+ * simulator do), so a failed program can be retried.
+ *
+ * Reading every page back costs SPI traffic and time per program (see get_read_back_bytes() and get_verify_us()), so
+ * with `verify` off programs are passed straight through, for drivers that wait for the device themselves.
+ */
+class FragmentationVerifiedBlockDevice : public BlockDevice {
+public:
+    /**
+     * @param bd Block device to wrap
+     * @param verify Whether to read back every program, if false programs are passed straight through
+     * @param ready Optional callback that returns whether the device finished the last program
+     */
+    FragmentationVerifiedBlockDevice(BlockDevice* bd, bool verify = true, Callback<bool()> ready = NULL)
+        : _bd(bd), _verify(verify), _ready(ready), _polls(0), _retries(0), _read_back_bytes(0), _verify_us(0)
+    {
+    }
+
+    virtual int init() {
+        return _bd->init();
+    }
+
+    virtual int deinit() {
+        return _bd->deinit();
+    }
+
+    virtual int sync() {
+        return _bd->sync();
+    }
+
+    virtual int read(void* buffer, bd_addr_t addr, bd_size_t size) {
+        return _bd->read(buffer, addr, size);
+    }
+
+    virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+        if (!_verify) {
+            return _bd->program(buffer, addr, size);
+        }
+
+        for (size_t attempt = 0; attempt <= FRAG_VERIFY_RETRIES; attempt++) {
+            int r = _bd->program(buffer, addr, size);
+            if (r != BD_ERROR_OK) return r;
+
+            r = _bd->sync();
+            if (r != BD_ERROR_OK) return r;
+
+            Timer t;
+            t.start();
+            r = wait_for_data((const uint8_t*)buffer, addr, size);
+            t.stop();
+            _verify_us += t.read_us();
+
+            if (r != BD_ERROR_DEVICE_ERROR) return r;
+
+            _retries++;
+            debug("FragmentationVerifiedBlockDevice: read-back of %u bytes at 0x%x failed, retrying\n", (unsigned int)size, (unsigned int)addr);
+        }
+
+        return BD_ERROR_DEVICE_ERROR;
+    }
+
+    virtual int erase(bd_addr_t addr, bd_size_t size) {
+        return _bd->erase(addr, size);
+    }
+
+    virtual bd_size_t get_read_size() const {
+        return _bd->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const {
+        return _bd->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const {
+        return _bd->get_erase_size();
+    }
+
+    virtual bd_size_t size() const {
+        return _bd->size();
+    }
+
+    /**
+     * Number of times a program had to wait for the device
+     */
+    uint32_t get_polls() {
+        return _polls;
+    }
+
+    /**
+     * Number of programs that had to be repeated
+     */
+    uint32_t get_retries() {
+        return _retries;
+    }
+
+    /**
+     * Whether programs are read back
+     */
+    bool is_verifying() {
+        return _verify;
+    }
+
+    /**
+     * Number of bytes that were read back to compare, SPI traffic on top of the programs
+     */
+    uint32_t get_read_back_bytes() {
+        return _read_back_bytes;
+    }
+
+    /**
+     * Time that programs spent waiting for the device and reading back
+     */
+    uint32_t get_verify_us() {
+        return _verify_us;
+    }
+
+private:
+    /**
+     * Wait until the device is done with the last program, and compare the data
+     *
+     * @returns BD_ERROR_OK if the data matches, BD_ERROR_DEVICE_ERROR if it does not while the device is ready
+     *          (so it can be programmed again), FRAG_VERIFY_ERROR_BUSY, or the error of a read
+     */
+    int wait_for_data(const uint8_t* buffer, bd_addr_t addr, bd_size_t size) {
+        Timer timer;
+        timer.start();
+
+        while (true) {
+            bool ready = _ready && _ready();
+
+            if (!_ready || ready) {
+                int r = verify(buffer, addr, size);
+                if (r != BD_ERROR_DEVICE_ERROR || ready) return r;
+            }
+
+            if (timer.read_us() >= FRAG_VERIFY_TIMEOUT_US) {
+                // without a callback the program is done by now
+                return _ready ? FRAG_VERIFY_ERROR_BUSY : BD_ERROR_DEVICE_ERROR;
+            }
+
+            _polls++;
+            wait_us(FRAG_VERIFY_POLL_US);
+        }
+    }
+
+    /**
+     * Compare flash against the buffer
+     *
+     * @returns BD_ERROR_OK if it matches, BD_ERROR_DEVICE_ERROR if not, or the error of the read
+     */
+    int verify(const uint8_t* buffer, bd_addr_t addr, bd_size_t size) {
+        uint8_t chunk[FRAG_VERIFY_CHUNK_SIZE];
+
+        for (bd_size_t ix = 0; ix < size; ix += FRAG_VERIFY_CHUNK_SIZE) {
+            bd_size_t len = size - ix < FRAG_VERIFY_CHUNK_SIZE ? size - ix : FRAG_VERIFY_CHUNK_SIZE;
+
+            int r = _bd->read(chunk, addr + ix, len);
+            if (r != BD_ERROR_OK) return r;
+            _read_back_bytes += len;
+
+            if (memcmp(chunk, buffer + ix, len) != 0) return BD_ERROR_DEVICE_ERROR;
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    BlockDevice* _bd;
+    bool _verify;
+    Callback<bool()> _ready;
+    uint32_t _polls;
+    uint32_t _retries;
+    uint32_t _read_back_bytes;
+    uint32_t _verify_us;
+};
+
+#endif // _FRAGMENTATION_VERIFIED_BLOCK_DEVICE_H_
@@ -0,0 +1,263 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_VERIFIER_H_
+#define _FRAGMENTATION_VERIFIER_H_
+
+#include "mbed.h"
+#include "mbed_lorawan_frag_lib.h"
+#include "mbedtls/sha256.h"
+#include "FragmentationCrc.h"
+#include "arm_uc_crypto.h"
+
+/**
+ * Verifies a package in flash in a single sweep: every chunk that is read goes into the CRC64 (whole package)
+ * and the SHA256 (everything but the trailer), and the trailer (the signature block at the end of the package)
+ * is copied out on the way. This reads the package from flash once, rather than once per digest.
+ *
+ * The sweep can also run while the package is coming in. Data that lands right at the watermark (the end of
+ * the contiguous prefix that was hashed so far) is hashed straight away through update_at(), and finish() only
+ * reads what comes after the watermark from flash. When fragments arrive in order that is nothing.
+ *
+ * An encrypted package is decrypted in place by the same sweep: the CRC64 is over the ciphertext (what was sent),
+ * every chunk is then decrypted in the read buffer, goes into the SHA256 as plaintext, and is programmed back to
+ * the same address. The trailer is not encrypted and stays as it is. There is no second copy of the firmware.
+ *
+ * The signature block can also be at the start of the package (a head manifest), it's then copied out from the first
+ * bytes and the SHA256 covers everything after it.
+ */
+class FragmentationVerifier {
+public:
+    /**
+     * @param flash An instance of FragmentationBlockDeviceWrapper
+     * @param buffer Buffer to read chunks into
+     * @param buffer_size Size of the buffer
+     */
+    FragmentationVerifier(FragmentationBlockDeviceWrapper* flash, uint8_t* buffer, size_t buffer_size)
+        : _flash(flash), _buffer(buffer), _buffer_size(buffer_size),
+          _offset(0), _size(0), _hashed_start(0), _hashed_end(0), _trailer(NULL), _cipher(NULL), _position(0), _crc(0), _started(false)
+    {
+        mbedtls_sha256_init(&_sha_ctx);
+    }
+
+    ~FragmentationVerifier() {
+        mbedtls_sha256_free(&_sha_ctx);
+    }
+
+    /**
+     * Start a sweep, the watermark is at the start of the package
+     *
+     * @param offset Address of the package in flash
+     * @param size Size of the package, including the trailer
+     * @param trailer Receives the last `trailer_size` bytes of the package (or the first, see trailer_at_head)
+     * @param trailer_size Number of bytes at the end of the package that are not part of the SHA256 hash
+     * @param cipher If set, decrypt everything but the trailer in place with this (AES-CTR) cipher. Data can then only
+     *               be hashed by finish(), as it needs to be read back to be decrypted.
+     * @param trailer_at_head The trailer is the first `trailer_size` bytes of the package (a head manifest)
+     *
+     * @returns BD_ERROR_OK, or BD_ERROR_DEVICE_ERROR if the trailer is larger than the package
+     */
+    int start(bd_addr_t offset, size_t size, void* trailer, size_t trailer_size, arm_uc_cipherHandle_t* cipher = NULL,
+              bool trailer_at_head = false) {
+        if (trailer_size > size) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+
+        _offset = offset;
+        _size = size;
+        _hashed_start = trailer_at_head ? trailer_size : 0;
+        _hashed_end = trailer_at_head ? size : size - trailer_size;
+        _trailer = (uint8_t*)trailer;
+        _cipher = cipher;
+        _position = 0;
+        _crc = 0;
+
+        mbedtls_sha256_starts(&_sha_ctx, 0 /* SHA-256 */);
+        _started = true;
+
+        return BD_ERROR_OK;
+    }
+
+    /**
+     * Data that was just written to flash. It's hashed if it starts at the watermark, otherwise
+     * it's left for finish() to read back.
+     *
+     * @returns true if the data was hashed
+     */
+    bool update_at(bd_addr_t address, const uint8_t* data, size_t size) {
+        if (!_started || _cipher || address != _offset + _position || _position == _size) {
+            return false;
+        }
+
+        // the last fragment holds padding beyond the end of the package
+        consume(data, _size - _position < size ? _size - _position : size);
+        return true;
+    }
+
+    /**
+     * Hash everything after the watermark, read from flash (and decrypt it, if a cipher was given)
+     *
+     * @param crc64 Receives the CRC64 over the whole package
+     * @param sha256 Receives the SHA256 hash of the package without the trailer (32 bytes), over the plaintext
+     *
+     * @returns BD_ERROR_OK if succeeded, the error of the block device, or BD_ERROR_DEVICE_ERROR if decryption failed
+     */
+    int finish(uint64_t* crc64, unsigned char sha256[32]) {
+        if (!_started) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+
+        int r = catch_up(_size);
+        if (r != BD_ERROR_OK) return r;
+
+        mbedtls_sha256_finish(&_sha_ctx, sha256);
+        _started = false;
+
+        *crc64 = _crc;
+        return BD_ERROR_OK;
+    }
+
+    /**
+     * Move the watermark up to `position`, reading from flash, e.g. over fragments that were received before the sweep
+     * was (re)started
+     *
+     * @returns BD_ERROR_OK if succeeded, the error of the block device, or BD_ERROR_DEVICE_ERROR if decryption failed
+     */
+    int catch_up(size_t position) {
+        if (!_started) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+
+        if (position > _size) {
+            position = _size;
+        }
+
+        while (_position < position) {
+            size_t len = position - _position < _buffer_size ? position - _position : _buffer_size;
+
+            int r = _flash->read(_buffer, _offset + _position, len);
+            if (r != BD_ERROR_OK) return r;
+
+            if (_cipher) {
+                r = decrypt_chunk(len);
+                if (r != BD_ERROR_OK) return r;
+            }
+            else {
+                consume(_buffer, len);
+            }
+        }
+
+        return BD_ERROR_OK;
+    }
+
+    /**
+     * Run the sweep over a package that is already in flash
+     *
+     * @returns BD_ERROR_OK if succeeded, or the error of the block device
+     */
+    int verify(bd_addr_t offset, size_t size, void* trailer, size_t trailer_size, uint64_t* crc64, unsigned char sha256[32]) {
+        int r = start(offset, size, trailer, trailer_size);
+        if (r != BD_ERROR_OK) return r;
+
+        return finish(crc64, sha256);
+    }
+
+    /**
+     * Number of bytes that were hashed so far
+     */
+    size_t get_position() {
+        return _position;
+    }
+
+private:
+    /**
+     * The chunk in the read buffer: CRC64 over the ciphertext, then decrypt the hashed part and program it back
+     */
+    int decrypt_chunk(size_t len) {
+        _crc = frag_crc64_update(_crc, _buffer, len);
+
+        size_t sha_start, sha_len;
+        hashed_part(len, &sha_start, &sha_len);
+        if (sha_len > 0) {
+            uint8_t* data = _buffer + sha_start;
+            arm_uc_buffer_t in_out = { (uint32_t)(_buffer_size - sha_start), (uint32_t)sha_len, data };
+            arm_uc_error_t err = ARM_UC_cryptoDecryptUpdate(_cipher, data, sha_len, &in_out);
+            if (err.error != ARM_UC_CU_ERR_NONE) {
+                debug("FragmentationVerifier: decrypt failed (%d)\n", err.error);
+                return BD_ERROR_DEVICE_ERROR;
+            }
+
+            int r = _flash->program(data, _offset + _position + sha_start, sha_len);
+            if (r != BD_ERROR_OK) return r;
+
+            mbedtls_sha256_update(&_sha_ctx, data, sha_len);
+        }
+        copy_trailer(_buffer, len, sha_start, sha_len);
+
+        _position += len;
+        return BD_ERROR_OK;
+    }
+
+    void consume(const uint8_t* data, size_t len) {
+        _crc = frag_crc64_update(_crc, data, len);
+
+        size_t sha_start, sha_len;
+        hashed_part(len, &sha_start, &sha_len);
+        if (sha_len > 0) {
+            mbedtls_sha256_update(&_sha_ctx, data + sha_start, sha_len);
+        }
+        copy_trailer(data, len, sha_start, sha_len);
+
+        _position += len;
+    }
+
+    // the data at the watermark can straddle the border between the hashed part and the trailer
+    void hashed_part(size_t len, size_t* sha_start, size_t* sha_len) {
+        size_t start = _position > _hashed_start ? _position : _hashed_start;
+        size_t end = _position + len < _hashed_end ? _position + len : _hashed_end;
+
+        *sha_start = start > _position + len ? len : start - _position;
+        *sha_len = end > start ? end - start : 0;
+    }
+
+    // everything that is not hashed is trailer, before or after the hashed part
+    void copy_trailer(const uint8_t* data, size_t len, size_t sha_start, size_t sha_len) {
+        if (sha_start > 0) {
+            memcpy(_trailer + _position, data, sha_start);
+        }
+        if (sha_start + sha_len < len) {
+            size_t from = sha_start + sha_len;
+            memcpy(_trailer + (_position + from - _hashed_end), data + from, len - from);
+        }
+    }
+
+    FragmentationBlockDeviceWrapper* _flash;
+    uint8_t* _buffer;
+    size_t _buffer_size;
+    bd_addr_t _offset;
+    size_t _size;
+    size_t _hashed_start;       // the SHA256 covers [_hashed_start, _hashed_end) of the package
+    size_t _hashed_end;
+    uint8_t* _trailer;
+    arm_uc_cipherHandle_t* _cipher;
+    size_t _position;           // watermark, everything before it is hashed
+    uint64_t _crc;
+    bool _started;
+    mbedtls_sha256_context _sha_ctx;
+};
+
+#endif // _FRAGMENTATION_VERIFIER_H_
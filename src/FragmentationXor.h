@@ -0,0 +1,170 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_XOR_H_
+#define _FRAGMENTATION_XOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * XOR kernels used to combine fragments when rebuilding lost frames from redundancy frames.
+ *
+ * The kernel is selected at compile time through FRAG_XOR_KERNEL. If not set, the widest kernel
+ * that the compiler supports is picked (AVX2 or SSE2 on host builds, 32-bit words everywhere else).
+ * All kernels accept unaligned buffers and any length.
+ */
+#define FRAG_XOR_KERNEL_BYTE    0
+#define FRAG_XOR_KERNEL_WORD    1
+#define FRAG_XOR_KERNEL_SSE2    2
+#define FRAG_XOR_KERNEL_AVX2    3
+
+#ifndef FRAG_XOR_KERNEL
+#if defined(__AVX2__)
+#define FRAG_XOR_KERNEL         FRAG_XOR_KERNEL_AVX2
+#elif defined(__SSE2__)
+#define FRAG_XOR_KERNEL         FRAG_XOR_KERNEL_SSE2
+#else
+#define FRAG_XOR_KERNEL         FRAG_XOR_KERNEL_WORD
+#endif
+#endif
+
+#if FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_AVX2
+#include <immintrin.h>
+#elif FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// Signature of an XOR kernel, dst[i] ^= src[i] for i in [0, len)
+typedef void (*frag_xor_fn)(uint8_t* dst, const uint8_t* src, size_t len);
+
+/**
+ * Reference kernel, one byte per iteration
+ */
+static inline void frag_xor_bytes(uint8_t* dst, const uint8_t* src, size_t len) {
+    for (size_t ix = 0; ix < len; ix++) {
+        dst[ix] ^= src[ix];
+    }
+}
+
+/**
+ * 32-bit word kernel, unrolled four times (16 bytes per iteration).
+ * Cortex-M3 supports unaligned LDR/STR, so the memcpy's below compile down to single word loads/stores.
+ */
+static inline void frag_xor_words(uint8_t* dst, const uint8_t* src, size_t len) {
+    uint32_t a0, a1, a2, a3, b0, b1, b2, b3;
+
+    while (len >= 16) {
+        memcpy(&a0, dst, 4);      memcpy(&b0, src, 4);
+        memcpy(&a1, dst + 4, 4);  memcpy(&b1, src + 4, 4);
+        memcpy(&a2, dst + 8, 4);  memcpy(&b2, src + 8, 4);
+        memcpy(&a3, dst + 12, 4); memcpy(&b3, src + 12, 4);
+        a0 ^= b0; a1 ^= b1; a2 ^= b2; a3 ^= b3;
+        memcpy(dst, &a0, 4);
+        memcpy(dst + 4, &a1, 4);
+        memcpy(dst + 8, &a2, 4);
+        memcpy(dst + 12, &a3, 4);
+
+        dst += 16;
+        src += 16;
+        len -= 16;
+    }
+
+    while (len >= 4) {
+        memcpy(&a0, dst, 4);
+        memcpy(&b0, src, 4);
+        a0 ^= b0;
+        memcpy(dst, &a0, 4);
+
+        dst += 4;
+        src += 4;
+        len -= 4;
+    }
+
+    frag_xor_bytes(dst, src, len);
+}
+
+#if FRAG_XOR_KERNEL >= FRAG_XOR_KERNEL_SSE2
+/**
+ * SSE2 kernel, 16 bytes per vector, the tail goes through the word kernel
+ */
+static inline void frag_xor_sse2(uint8_t* dst, const uint8_t* src, size_t len) {
+    while (len >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)dst);
+        __m128i b = _mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst, _mm_xor_si128(a, b));
+
+        dst += 16;
+        src += 16;
+        len -= 16;
+    }
+
+    frag_xor_words(dst, src, len);
+}
+#endif
+
+#if FRAG_XOR_KERNEL >= FRAG_XOR_KERNEL_AVX2
+/**
+ * AVX2 kernel, 32 bytes per vector, the tail goes through the SSE2 kernel
+ */
+static inline void frag_xor_avx2(uint8_t* dst, const uint8_t* src, size_t len) {
+    while (len >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)dst);
+        __m256i b = _mm256_loadu_si256((const __m256i*)src);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_xor_si256(a, b));
+
+        dst += 32;
+        src += 32;
+        len -= 32;
+    }
+
+    frag_xor_sse2(dst, src, len);
+}
+#endif
+
+/**
+ * XOR src into dst using the kernel selected through FRAG_XOR_KERNEL
+ */
+static inline void frag_xor(uint8_t* dst, const uint8_t* src, size_t len) {
+#if FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_AVX2
+    frag_xor_avx2(dst, src, len);
+#elif FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_SSE2
+    frag_xor_sse2(dst, src, len);
+#elif FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_WORD
+    frag_xor_words(dst, src, len);
+#else
+    frag_xor_bytes(dst, src, len);
+#endif
+}
+
+/**
+ * Name of the selected kernel, for logging
+ */
+static inline const char* frag_xor_kernel_name() {
+#if FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_AVX2
+    return "avx2";
+#elif FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_SSE2
+    return "sse2";
+#elif FRAG_XOR_KERNEL == FRAG_XOR_KERNEL_WORD
+    return "word32";
+#else
+    return "byte";
+#endif
+}
+
+#endif // _FRAGMENTATION_XOR_H_
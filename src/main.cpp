@@ -17,12 +17,24 @@
 
 #include "mbed.h"
 #include "mbed_lorawan_frag_lib.h"
-#include "packets.h"
 #include "update_params.h"
 #include "UpdateCerts.h"
 #include "mbed_debug.h"
 #include "mbed_stats.h"
 #include "arm_uc_metadata_header_v2.h"
+#include "FragmentationSessionManager.h"
+#include "FragmentationVerifiedBlockDevice.h"
+#include "FragmentationPageBuffer.h"
+#include "FragmentationVerifier.h"
+#include "FragmentationEcdsaRestartable.h"
+#include "FragmentationScratch.h"
+#include "FragmentationCryptoPool.h"
+#include "FragmentationPatch.h"
+#include "FragmentationDecompress.h"
+#include "FragmentationReplay.h"
+
+// `mbed test` builds the application sources together with the tests in TESTS/, which bring their own main()
+#ifndef MBED_TEST_MODE
 
 #ifdef TARGET_SIMULATOR
 // Initialize a persistent block device with 528 bytes block size, and 256 blocks (mimicks the at45, which also has 528 size blocks)
@@ -34,6 +46,19 @@ SimulatorBlockDevice bd("lorawan-frag-in-flash", 256 * 528, 528);
 AT45BlockDevice bd(SPI_MOSI, SPI_MISO, SPI_SCK, SPI_NSS);
 #endif
 
+// On the simulator the frames can come from a replay file (test-fw/create-packets-h.js --replay) rather than packets.h,
+// so large images and captured loss patterns run against the same binary
+#if defined(TARGET_SIMULATOR) && defined(MBED_CONF_APP_FRAGMENTATION_REPLAY_FILE)
+#define FRAGMENTATION_REPLAY    1
+static FragmentationReplay replay;
+#else
+#define FRAGMENTATION_REPLAY    0
+#include "packets.h"
+#endif
+
+// FragIndex of the firmware session, the top 2 bits of the frame counter in the packets
+#define FIRMWARE_FRAG_INDEX     0
+
 // Print heap statistics
 static void print_heap_stats(uint8_t prefix = 0) {
     mbed_stats_heap_t heap_stats;
@@ -45,6 +70,56 @@ static void print_heap_stats(uint8_t prefix = 0) {
     debug("Heap stats: %d / %d (max=%d)\n", heap_stats.current_size, heap_stats.reserved_size, heap_stats.max_size);
 }
 
+// Size of the chunks that the verifier reads from flash
+#define VERIFY_BUFFER_SIZE      128
+
+// Delta updates: the new image is programmed a page (AT45) at a time, the patch is read in small chunks
+#define PATCH_PAGE_SIZE         528
+#define PATCH_READ_SIZE         64
+
+// Compressed firmware: the output goes through a window in RAM, which has to be as large as the one of the compressor
+#define DECOMPRESS_WINDOW_SIZE  512
+#define DECOMPRESS_READ_SIZE    64
+
+// Everything that is needed after reception is allocated from the scratch arena, stage after stage. The package header
+// (with the signature, as a manifest so it also fits a head manifest) stays at the bottom until the signature is
+// verified, the other stages take turns above it.
+#define SCRATCH_STAGE_HASH      (FRAG_SCRATCH_ALIGN(sizeof(UpdateManifest_t)) + FRAG_SCRATCH_ALIGN(VERIFY_BUFFER_SIZE) \
+                                 + FRAG_SCRATCH_ALIGN(sizeof(FragmentationVerifier)) \
+                                 + FRAG_SCRATCH_ALIGN(sizeof(arm_uc_cipherHandle_t)) + FRAG_SCRATCH_ALIGN(16 /* AES-CTR counter */))
+#define SCRATCH_STAGE_PATCH     (FRAG_SCRATCH_ALIGN(sizeof(UpdateManifest_t)) + FRAG_SCRATCH_ALIGN(PATCH_PAGE_SIZE) \
+                                 + FRAG_SCRATCH_ALIGN(PATCH_READ_SIZE) + FRAG_SCRATCH_ALIGN(sizeof(FragmentationPatch)))
+#define SCRATCH_STAGE_DECOMPRESS (FRAG_SCRATCH_ALIGN(sizeof(UpdateManifest_t)) + FRAG_SCRATCH_ALIGN(DECOMPRESS_WINDOW_SIZE) \
+                                 + FRAG_SCRATCH_ALIGN(DECOMPRESS_READ_SIZE) + FRAG_SCRATCH_ALIGN(sizeof(FragmentationDecompress)))
+#define SCRATCH_STAGE_ECDSA     (FRAG_SCRATCH_ALIGN(sizeof(UpdateManifest_t)) \
+                                 + FRAG_SCRATCH_ALIGN(sizeof(FragmentationEcdsaRestartable)) \
+                                 + FRAG_SCRATCH_ALIGN(FOTALORA_MBEDTLS_POOL_SIZE))
+#define SCRATCH_STAGE_HEADER    (FRAG_SCRATCH_ALIGN(ARM_UC_EXTERNAL_HEADER_SIZE_V2))
+
+MBED_STATIC_ASSERT(SCRATCH_STAGE_HASH <= FRAG_SCRATCH_SIZE, "fragmentation-scratch-size is too small for hashing");
+MBED_STATIC_ASSERT(SCRATCH_STAGE_PATCH <= FRAG_SCRATCH_SIZE, "fragmentation-scratch-size is too small for applying a patch");
+MBED_STATIC_ASSERT(SCRATCH_STAGE_DECOMPRESS <= FRAG_SCRATCH_SIZE, "fragmentation-scratch-size is too small for decompressing");
+MBED_STATIC_ASSERT(SCRATCH_STAGE_ECDSA <= FRAG_SCRATCH_SIZE, "fragmentation-scratch-size is too small for the signature verification");
+MBED_STATIC_ASSERT(SCRATCH_STAGE_HEADER <= FRAG_SCRATCH_SIZE, "fragmentation-scratch-size is too small for the bootloader header");
+MBED_STATIC_ASSERT(FOTALORA_MBEDTLS_POOL_SIZE == 0 || FOTALORA_MBEDTLS_POOL_SIZE >= FRAG_ECDSA_HEAP_PEAK,
+                   "fragmentation-crypto-pool-size is too small for the signature verification");
+
+static FragmentationScratch scratch;
+
+// mbed TLS allocates from a pool in the scratch arena during the ECDSA stage (fragmentation-crypto-pool-size), with the
+// peak usage printed per stage
+static FragmentationCryptoPool crypto_pool;
+
+// Signature verification runs in slices from this queue, it only ever holds the next slice
+static unsigned char ecdsa_queue_buffer[4 * EVENTS_EVENT_SIZE];
+static EventQueue ecdsa_queue(sizeof(ecdsa_queue_buffer), ecdsa_queue_buffer);
+static FragmentationEcdsaResult ecdsa_result;
+
+static void ecdsa_done(FragmentationEcdsaResult result) {
+    ecdsa_result = result;
+    ecdsa_queue.break_dispatch();
+}
+
 static bool compare_buffers(uint8_t* buff1, const uint8_t* buff2, size_t size) {
     for (size_t ix = 0; ix < size; ix++) {
         if (buff1[ix] != buff2[ix]) return false;
@@ -52,6 +127,159 @@ static bool compare_buffers(uint8_t* buff1, const uint8_t* buff2, size_t size) {
     return true;
 }
 
+// First byte of diff_info, FOTA_DIFF_FLAG_*
+static uint8_t get_diff_flags(UpdateSignature_t* header) {
+    return ((uint8_t*)&header->diff_info)[0];
+}
+
+// Last three bytes of diff_info, the size of the application that the patch applies to (big endian)
+static size_t get_diff_old_size(UpdateSignature_t* header) {
+    uint8_t* info = (uint8_t*)&header->diff_info;
+    return (info[1] << 16) | (info[2] << 8) | info[3];
+}
+
+// Size of the region in internal flash that the application runs from, a patch cannot read beyond it
+#if defined(MBED_APP_START) && defined(MBED_APP_SIZE)
+#define APP_REGION_SIZE         (MBED_APP_SIZE)
+#elif defined(MBED_APP_START) && defined(MBED_CONF_APP_FLASH_START_ADDRESS) && defined(MBED_CONF_APP_FLASH_SIZE)
+#define APP_REGION_SIZE         (MBED_CONF_APP_FLASH_START_ADDRESS + MBED_CONF_APP_FLASH_SIZE - MBED_APP_START)
+#endif
+
+// Whether the manufacturer and device class UUIDs are the ones of this device
+static bool check_uuids(UpdateSignature_t* header) {
+    if (!compare_buffers(header->manufacturer_uuid, UPDATE_CERT_MANUFACTURER_UUID, 16)) {
+        debug("Manufacturer UUID does not match\n");
+        return false;
+    }
+
+    if (!compare_buffers(header->device_class_uuid, UPDATE_CERT_DEVICE_CLASS_UUID, 16)) {
+        debug("Device Class UUID does not match\n");
+        return false;
+    }
+
+    debug("Manufacturer and Device Class UUID match\n");
+    return true;
+}
+
+// Number of fragments at the start of the package that a head manifest is in
+static uint16_t get_manifest_fragments(FragmentationSessionOpts_t* opts) {
+    return (FOTA_MANIFEST_LENGTH + opts->FragmentSize - 1) / opts->FragmentSize;
+}
+
+// Whether the fragments that a head manifest would be in are in flash
+static bool is_manifest_received(FragmentationDecoder* session, FragmentationSessionOpts_t* opts) {
+    for (uint16_t ix = 0; ix < get_manifest_fragments(opts); ix++) {
+        if (!session->is_received(ix)) return false;
+    }
+    return true;
+}
+
+// Read a head manifest from the start of the package, returns false if the package does not start with one
+static bool read_head_manifest(FragmentationBlockDeviceWrapper* flash, bd_addr_t offset, size_t package_size, UpdateManifest_t* manifest) {
+    if (package_size < FOTA_MANIFEST_LENGTH || flash->read(manifest, offset, FOTA_MANIFEST_LENGTH) != BD_ERROR_OK) {
+        return false;
+    }
+
+    return manifest->magic == FOTA_MANIFEST_MAGIC
+        && manifest->crc32 == arm_uc_crc32((const uint8_t*)manifest, offsetof(UpdateManifest_t, crc32));
+}
+
+/**
+ * Check for a head manifest once the fragments it's in are received. If there is one, its UUIDs are checked and the
+ * sweep starts over with the manifest left out, which reads back the fragments that the manifest is in.
+ *
+ * @param checked Set once the fragments were received, the check is then done
+ * @param head_manifest Set if the package starts with a manifest
+ *
+ * @returns false if the package is not for this device (or the manifest fragments could not be read back)
+ */
+static bool check_head_manifest(FragmentationBlockDeviceWrapper* flash, FragmentationDecoder* session, FragmentationSessionOpts_t* opts,
+                                size_t package_size, FragmentationVerifier* verifier, UpdateManifest_t* manifest,
+                                bool* checked, bool* head_manifest) {
+    if (*checked || !is_manifest_received(session, opts)) {
+        return true;
+    }
+
+    *checked = true;
+    *head_manifest = read_head_manifest(flash, opts->FlashOffset, package_size, manifest);
+    if (!*head_manifest) {
+        return true;
+    }
+
+    debug("Package starts with a manifest\n");
+    if (!check_uuids(&manifest->signature)) {
+        return false;
+    }
+
+    verifier->start(opts->FlashOffset, package_size, manifest, FOTA_MANIFEST_LENGTH, NULL, true);
+    if (verifier->catch_up(get_manifest_fragments(opts) * opts->FragmentSize) != BD_ERROR_OK) {
+        debug("Failed to read the manifest fragments from flash\n");
+        return false;
+    }
+    return true;
+}
+
+static size_t get_frame_count() {
+#if FRAGMENTATION_REPLAY
+    return replay.get_frame_count();
+#else
+    return sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0]);
+#endif
+}
+
+static size_t get_frame_size() {
+#if FRAGMENTATION_REPLAY
+    return replay.get_frame_size();
+#else
+    return sizeof(FAKE_PACKETS[0]);
+#endif
+}
+
+static const uint8_t* get_frame(size_t ix) {
+#if FRAGMENTATION_REPLAY
+    return replay.get_frame(ix);
+#else
+    return FAKE_PACKETS[ix];
+#endif
+}
+
+// Frames lost in the captured session selected with fragmentation-replay-loss-mask are skipped
+static bool is_frame_lost(size_t ix) {
+#if FRAGMENTATION_REPLAY
+    return replay.is_lost(MBED_CONF_APP_FRAGMENTATION_REPLAY_LOSS_MASK, ix);
+#else
+    (void)ix;
+    return false;
+#endif
+}
+
+static uint64_t get_expected_crc64() {
+#if FRAGMENTATION_REPLAY
+    return replay.get_crc64();
+#else
+    return FAKE_PACKETS_CRC64_HASH;
+#endif
+}
+
+static void get_session_opts(FragmentationSessionOpts_t* opts) {
+#if FRAGMENTATION_REPLAY
+    replay.get_opts(opts);
+#else
+    opts->NumberOfFragments = (FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2];
+    opts->FragmentSize = FAKE_PACKETS_HEADER[4];
+    opts->Padding = FAKE_PACKETS_HEADER[6];
+    opts->RedundancyPackets = get_frame_count() - opts->NumberOfFragments;
+#endif
+}
+
+static bool compare_opts(FragmentationSessionOpts_t a, FragmentationSessionOpts_t b) {
+    return a.NumberOfFragments == b.NumberOfFragments
+        && a.FragmentSize == b.FragmentSize
+        && a.Padding == b.Padding
+        && a.RedundancyPackets == b.RedundancyPackets
+        && a.FlashOffset == b.FlashOffset;
+}
+
 static void print_buffer(void* buff, size_t size) {
     for (size_t ix = 0; ix < size; ix++) {
         debug("%02x ", ((uint8_t*)buff)[ix]);
@@ -59,8 +287,16 @@ static void print_buffer(void* buff, size_t size) {
 }
 
 int main() {
+    // With fragmentation-verify-writes, only return from a program once the data is read back from flash. The AT45
+    // driver does not expose its status register, so there is no ready callback and the read-back costs SPI traffic
+    FragmentationVerifiedBlockDevice vbd(&bd, MBED_CONF_APP_FRAGMENTATION_VERIFY_WRITES);
+
+    // Gather fragments in RAM and program every page once, rather than a read-modify-write per fragment,
+    // and cache the pages that are read over and over during decoding and hashing
+    FragmentationPageBuffer pbd(&vbd, MBED_CONF_APP_FRAGMENTATION_PAGE_BUFFER_PAGES, MBED_CONF_APP_FRAGMENTATION_READ_CACHE_PAGES);
+
     // Wrap the block device to allow for unaligned reads/writes
-    FragmentationBlockDeviceWrapper fbd(&bd);
+    FragmentationBlockDeviceWrapper fbd(&pbd);
 
     int bd_init;
     if ((bd_init = fbd.init()) != BD_ERROR_OK) {
@@ -68,151 +304,512 @@ int main() {
         return 1;
     }
 
+#if FRAGMENTATION_REPLAY
+    FragmentationReplayResult replay_result = replay.open(MBED_CONF_APP_FRAGMENTATION_REPLAY_FILE);
+    if (replay_result != FRAG_REPLAY_OK) {
+        debug("Failed to open replay file %s (%d)\n", MBED_CONF_APP_FRAGMENTATION_REPLAY_FILE, replay_result);
+        return 1;
+    }
+    debug("Replaying %u frames from %s\n", get_frame_count(), MBED_CONF_APP_FRAGMENTATION_REPLAY_FILE);
+#endif
+
     // This data is normally obtained from the FragSessionSetupReq
-    // comment out fragments in packets.h to simulate packet loss
+    // comment out fragments in packets.h, or pick a loss mask in the replay file, to simulate packet loss
     FragmentationSessionOpts_t opts;
-    opts.NumberOfFragments = (FAKE_PACKETS_HEADER[3] << 8) + FAKE_PACKETS_HEADER[2];
-    opts.FragmentSize = FAKE_PACKETS_HEADER[4];
-    opts.Padding = FAKE_PACKETS_HEADER[6];
-    opts.RedundancyPackets = (sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0])) - opts.NumberOfFragments;
+    get_session_opts(&opts);
     opts.FlashOffset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
 
     FragResult result;
 
-    // Declare the fragSession on the heap so we can free() it when CRC'ing the result in flash
-    FragmentationSession* fragSession = new FragmentationSession(&fbd, opts);
+    print_heap_stats(1);
 
-    if ((result = fragSession->initialize()) != FRAG_OK) {
-        debug("FragmentationSession initialize failed: %s\n", FragmentationSession::frag_result_string(result));
+    // Sessions and their journals get a region between the storage offset and the session table, so several sessions
+    // (e.g. firmware and a configuration blob) can run at the same time. Their bookkeeping is journaled to flash,
+    // so a reset during a session does not lose the fragments received so far.
+    // The session table takes the last erase blocks of the flash
+    const bd_addr_t journal_offset = FragmentationSessionManager::get_table_offset(&bd, MBED_CONF_APP_FRAGMENTATION_JOURNAL_BLOCKS);
+    if (journal_offset == FRAG_ADDRESS_NONE || journal_offset <= MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET) {
+        debug("External flash of %llu bytes has no room for sessions\n", bd.size());
         return 1;
     }
 
-    // Process the frames in the FAKE_PACKETS array
-    for (size_t ix = 0; ix < sizeof(FAKE_PACKETS) / sizeof(FAKE_PACKETS[0]); ix++) {
-        uint8_t* buffer = (uint8_t*)FAKE_PACKETS[ix];
+    // The manager lives until the update is written, post-processing below takes its staging regions in flash from it.
+    // It's deleted at the end, before the session table is cleared.
+    FragmentationSessionManager* sessions = new FragmentationSessionManager(&fbd,
+        MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET, journal_offset, journal_offset, bd.get_erase_size(), &pbd);
+
+    if ((result = sessions->resume()) != FRAG_OK) {
+        debug("FragmentationSessionManager resume failed: %s\n", FragmentationDecoder::frag_result_string(result));
+        return 1;
+    }
+
+    // In a LoRaWAN application the opts are not resent after a reset, get them from sessions->get_opts() instead.
+    // The firmware always goes to the storage offset, as that is where the bootloader looks for it.
+    FragmentationSessionOpts_t resumedOpts;
+    if (!sessions->get_opts(FIRMWARE_FRAG_INDEX, &resumedOpts) || !compare_opts(resumedOpts, opts)) {
+        result = sessions->setup_session(FIRMWARE_FRAG_INDEX, &opts, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
+        if (result != FRAG_OK) {
+            debug("FragmentationSession initialize failed: %s\n", FragmentationDecoder::frag_result_string(result));
+            return 1;
+        }
+    }
+
+    FragmentationDecoder* fragSession = sessions->get_session(FIRMWARE_FRAG_INDEX);
+    if (fragSession->is_complete()) {
+        debug("FragmentationSession was already complete before reset\n");
+        result = FRAG_COMPLETE;
+    }
+    else {
+        result = FRAG_OK;
+    }
+
+    // Hash the package while the fragments come in, after completion only what comes after the first gap is read back.
+    // The signature is the last FOTA_SIGNATURE_LENGTH bytes of the package, so it's not part of the SHA256 hash.
+    size_t package_size = (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding;
+    UpdateManifest_t* manifest = new (scratch.alloc(sizeof(UpdateManifest_t))) UpdateManifest_t();
+    UpdateSignature_t* header = &manifest->signature;
+    size_t stage_mark = scratch.get_mark();
+    uint8_t* verify_buffer = (uint8_t*)scratch.alloc(VERIFY_BUFFER_SIZE);
+    FragmentationVerifier* verifier = new (scratch.alloc(sizeof(FragmentationVerifier))) FragmentationVerifier(&fbd, verify_buffer, VERIFY_BUFFER_SIZE);
+    crypto_pool.start_stage("hash");
+    verifier->start(opts.FlashOffset, package_size, header, FOTA_SIGNATURE_LENGTH);
+    fragSession->set_verifier(verifier);
+
+    // Unless the package starts with a head manifest, which is checked as soon as the fragments it's in are received.
+    // A package for other hardware is then dropped right away, rather than after receiving all of it.
+    // In a LoRaWAN application, also stop listening on the multicast group of the session.
+    bool head_manifest = false;
+    bool manifest_checked = false;
+
+    size_t frames = 0;
+
+#if FRAGMENTATION_REPLAY && MBED_CONF_APP_FRAGMENTATION_REPLAY_REALTIME
+    // Frames come in at the time they were captured at, relative to the first frame. Lost frames keep their gap, and the
+    // time spent processing a frame is taken off the wait for the next one.
+    Timer replay_timer;
+    replay_timer.start();
+#endif
+
+    // Process the frames from packets.h or the replay file, fragments that were already received are skipped by the session
+    for (size_t ix = 0; result != FRAG_COMPLETE && ix < get_frame_count(); ix++) {
+        if (!check_head_manifest(&fbd, fragSession, &opts, package_size, verifier, manifest, &manifest_checked, &head_manifest)) {
+            debug("Dropping the session\n");
+            sessions->delete_session(FIRMWARE_FRAG_INDEX);
+            return 1;
+        }
+
+        if (is_frame_lost(ix)) {
+            continue;
+        }
+
+#if FRAGMENTATION_REPLAY && MBED_CONF_APP_FRAGMENTATION_REPLAY_REALTIME
+        int32_t ahead_ms = (int32_t)(replay.get_timestamp(ix) - replay.get_timestamp(0)) - replay_timer.read_ms();
+        if (ahead_ms > 0) {
+            wait_ms(ahead_ms);
+        }
+#endif
+
+        uint8_t* buffer = (uint8_t*)get_frame(ix);
         uint16_t frameCounter = (buffer[2] << 8) + buffer[1];
 
+        frames++;
+
         // Skip the first 3 bytes, as they contain metadata
-        if ((result = fragSession->process_frame(frameCounter, buffer + 3, sizeof(FAKE_PACKETS[0]) - 3)) != FRAG_OK) {
+        if ((result = sessions->process_frame(frameCounter, buffer + 3, get_frame_size() - 3)) != FRAG_OK) {
             if (result == FRAG_COMPLETE) {
                 debug("FragmentationSession is complete at frame %d\n", frameCounter);
                 break;
             }
             else {
                 debug("FragmentationSession process_frame %d failed: %s\n",
-                    frameCounter, FragmentationSession::frag_result_string(result));
+                    frameCounter, FragmentationDecoder::frag_result_string(result));
                 return 1;
             }
         }
 
         debug("Processed frame with frame counter %d\n", frameCounter);
-        wait_ms(50); // @todo: this is really weird, writing these in quick succession leads to corrupt image... need to investigate.
     }
 
-    // The data is now in flash. Free the fragSession
-    delete fragSession;
+    // the manifest fragments were only recovered when the session completed
+    if (!check_head_manifest(&fbd, fragSession, &opts, package_size, verifier, manifest, &manifest_checked, &head_manifest)) {
+        debug("Dropping the session\n");
+        sessions->delete_session(FIRMWARE_FRAG_INDEX);
+        return 1;
+    }
 
-    // Calculate the CRC of the data in flash to see if the file was unpacked correctly
+    // Bytes per session with the packed matrix, against a matrix with one byte per coefficient
+    print_heap_stats(2);
+    if (vbd.is_verifying()) {
+        debug("Flash writes waited %lu times for the device and needed %lu retries, read back %lu bytes in %lu ms\n",
+            vbd.get_polls(), vbd.get_retries(), vbd.get_read_back_bytes(), vbd.get_verify_us() / 1000);
+    }
+
+    // SPI traffic per frame, set fragmentation-page-buffer-pages to 0 to compare against no buffering
+    FragmentationPageBufferStats_t flash_stats;
+    pbd.get_stats(&flash_stats);
+    if (frames > 0) {
+        debug("Flash traffic for %u frames: %lu bytes read, %lu bytes programmed in %lu page programs (%lu SPI bytes per frame)\n",
+            frames, flash_stats.read_bytes, flash_stats.program_bytes, flash_stats.page_programs,
+            (flash_stats.read_bytes + flash_stats.program_bytes) / frames);
+        debug("Page cache: %lu hits, %lu misses\n", flash_stats.read_hits, flash_stats.read_misses);
+    }
+    debug("Session uses %u bytes (%u bytes with a byte-per-coefficient parity matrix)\n",
+        fragSession->get_memory_usage(), FragmentationDecoder::get_byte_matrix_size(opts));
+
+    // The data is now in flash (completing the session synced the page buffer). Free the session, its state in flash is kept.
+    // The manager stays, post-processing below gets its staging regions from it.
+    sessions->close(FIRMWARE_FRAG_INDEX);
+
+    // Finish the CRC64 and the SHA256 hash of the data in flash, and read the signature, in a single sweep over what was not hashed yet
+    // To get the same CRC64 and SHA256 on desktop, and check the signature, see 'test-fw/verify-package'
     uint64_t crc_res;
-    // To calculate the CRC on desktop see 'calculate-crc64/main.cpp'
+    unsigned char sha_out_buffer[32];
+
+    // Where the firmware is in the package, the manifest is at the start or the end (the trailer)
+    bd_addr_t firmware_offset = opts.FlashOffset + (head_manifest ? FOTA_MANIFEST_LENGTH : 0);
+    size_t firmware_size = package_size - (head_manifest ? FOTA_MANIFEST_LENGTH : FOTA_SIGNATURE_LENGTH);
+
+    // Region that holds the firmware once it was written in place or moved to the storage offset, until then it's in the session
+    bd_addr_t firmware_region = FRAG_ADDRESS_NONE;
     {
-        uint8_t crc_buffer[128];
+        debug("Hashed %u of %u bytes while receiving\n", verifier->get_position(), package_size);
+
+        // Whether the firmware is encrypted is only known from the manifest, so an encrypted package is swept again from the
+        // start: the CRC64 is over the ciphertext, and the firmware is decrypted in place, chunk by chunk, for the SHA256.
+        // The session is dropped before the first plaintext is written, as after a reset halfway it would be resumed as
+        // complete over part plaintext and part ciphertext. The package keeps its place in flash as a staging region.
+        arm_uc_cipherHandle_t* cipher = NULL;
+        int r = BD_ERROR_OK;
+        if (!head_manifest) {
+            r = fbd.read(header, opts.FlashOffset + package_size - FOTA_SIGNATURE_LENGTH, FOTA_SIGNATURE_LENGTH);
+        }
+        if (r == BD_ERROR_OK && (get_diff_flags(header) & FOTA_DIFF_FLAG_ENCRYPTED)) {
+            // the nonce is in the signature field, after the raw signature
+            if (header->signature_length != (FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH)) {
+                debug("Encrypted firmware needs a raw signature\n");
+                return 1;
+            }
+
+            // counter block is nonce || 64 bits block counter, starting at 0
+            uint8_t* cipher_iv = (uint8_t*)scratch.alloc(16);
+            memcpy(cipher_iv, header->signature + FRAG_ECDSA_RAW_SIG_LENGTH, FOTA_NONCE_LENGTH);
+            memset(cipher_iv + FOTA_NONCE_LENGTH, 0, 16 - FOTA_NONCE_LENGTH);
+
+            cipher = (arm_uc_cipherHandle_t*)scratch.alloc(sizeof(arm_uc_cipherHandle_t));
+            arm_uc_buffer_t key = { sizeof(UPDATE_CERT_FIRMWARE_KEY), sizeof(UPDATE_CERT_FIRMWARE_KEY), (uint8_t*)UPDATE_CERT_FIRMWARE_KEY };
+            arm_uc_buffer_t iv = { 16, 16, cipher_iv };
+            if (ARM_UC_cryptoDecryptSetup(cipher, &key, &iv, 256).error != ARM_UC_CU_ERR_NONE) {
+                debug("Failed to set up decryption\n");
+                return 1;
+            }
+
+            sessions->delete_session(FIRMWARE_FRAG_INDEX);
+            firmware_region = sessions->allocate_scratch(package_size, opts.FlashOffset);
+            if (firmware_region == FRAG_ADDRESS_NONE) {
+                debug("Failed to keep the package in flash for decryption\n");
+                return 1;
+            }
+
+            debug("Firmware is encrypted, decrypting in place\n");
+            if (head_manifest) {
+                verifier->start(opts.FlashOffset, package_size, manifest, FOTA_MANIFEST_LENGTH, cipher, true);
+            }
+            else {
+                verifier->start(opts.FlashOffset, package_size, header, FOTA_SIGNATURE_LENGTH, cipher);
+            }
+        }
 
-        FragmentationCrc64 crc64(&fbd, crc_buffer, sizeof(crc_buffer));
-        crc_res = crc64.calculate(opts.FlashOffset, (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding);
+        Timer sweep_timer;
+        sweep_timer.start();
+        if (r == BD_ERROR_OK) {
+            r = verifier->finish(&crc_res, sha_out_buffer);
+        }
+        sweep_timer.stop();
 
-        // This hash needs to be sent to the network to verify that the packet originated from the network
-        if (FAKE_PACKETS_CRC64_HASH == crc_res) {
-            debug("CRC64 Hash verification OK (%08llx)\n", crc_res);
+        if (cipher) {
+            debug("Decrypted %u bytes in %d ms\n", firmware_size, sweep_timer.read_ms());
+            ARM_UC_cryptoDecryptFinish(cipher, NULL);
         }
-        else {
-            debug("CRC64 Hash verification NOK, hash was %08llx, expected %08llx\n", crc_res, FAKE_PACKETS_CRC64_HASH);
+
+        verifier->~FragmentationVerifier();
+        scratch.release(stage_mark);
+        crypto_pool.end_stage();
+
+        if (r != BD_ERROR_OK) {
+            debug("Failed to read the package from flash (%d)\n", r);
             return 1;
         }
+
+        // the package is read in small chunks, most of them come from the page cache
+        FragmentationPageBufferStats_t hash_stats;
+        pbd.get_stats(&hash_stats);
+        debug("Verification read %lu bytes from flash (%lu cache hits, %lu misses)\n",
+            hash_stats.read_bytes - flash_stats.read_bytes,
+            hash_stats.read_hits - flash_stats.read_hits, hash_stats.read_misses - flash_stats.read_misses);
     }
 
-    wait_ms(1);
+    // This hash needs to be sent to the network to verify that the packet originated from the network
+    if (get_expected_crc64() == crc_res) {
+        debug("CRC64 Hash verification OK (%08llx)\n", crc_res);
+    }
+    else {
+        debug("CRC64 Hash verification NOK, hash was %08llx, expected %08llx\n", crc_res, get_expected_crc64());
+        return 1;
+    }
 
-    // the signature is the last FOTA_SIGNATURE_LENGTH bytes of the package
-    size_t signatureOffset = opts.FlashOffset + ((opts.NumberOfFragments * opts.FragmentSize) - opts.Padding) - FOTA_SIGNATURE_LENGTH;
+    // a head manifest was checked on reception
+    if (!head_manifest && !check_uuids(header)) {
+        return 1;
+    }
 
-    // Read out the header of the package...
-    UpdateSignature_t* header = new UpdateSignature_t();
-    fbd.read(header, signatureOffset, FOTA_SIGNATURE_LENGTH);
+    // The signature is over the new firmware, so if it's not what was sent it's hashed again at the end
+    bool rehash = false;
 
-    if (!compare_buffers(header->manufacturer_uuid, UPDATE_CERT_MANUFACTURER_UUID, 16)) {
-        debug("Manufacturer UUID does not match\n");
-        return 1;
+    // Compressed firmware (or patch): the output has to go to the storage offset, where the compressed data is, so that
+    // is moved to a staging region at the end of the free flash first.
+    if (get_diff_flags(header) & FOTA_DIFF_FLAG_COMPRESSED) {
+        size_t compressed_size = firmware_size;
+
+        bd_addr_t compressed_offset = sessions->allocate_scratch(compressed_size);
+        if (compressed_offset == FRAG_ADDRESS_NONE) {
+            debug("No room in flash to stage the compressed firmware of %u bytes\n", compressed_size);
+            return 1;
+        }
+
+        size_t decompress_mark = scratch.get_mark();
+        uint8_t* window = (uint8_t*)scratch.alloc(DECOMPRESS_WINDOW_SIZE);
+        uint8_t* read_buffer = (uint8_t*)scratch.alloc(DECOMPRESS_READ_SIZE);
+        FragmentationDecompress* decompress = new (scratch.alloc(sizeof(FragmentationDecompress)))
+            FragmentationDecompress(&fbd, window, DECOMPRESS_WINDOW_SIZE, read_buffer, DECOMPRESS_READ_SIZE);
+
+        debug("Decompressing %u bytes\n", compressed_size);
+
+        Timer decompress_timer;
+        decompress_timer.start();
+        FragmentationDecompressResult decompress_result = decompress->copy(firmware_offset, compressed_offset, compressed_size);
+
+        // Then the output gets everything from the storage offset up to the next region in use. What the compressed data
+        // came from is dropped, a reset from here on means the session has to be sent again.
+        bd_addr_t target_offset = FRAG_ADDRESS_NONE;
+        bd_size_t target_max = 0;
+        if (decompress_result == FRAG_DECOMPRESS_OK) {
+            if (firmware_region != FRAG_ADDRESS_NONE) {
+                sessions->free_scratch(firmware_region);
+            }
+            else {
+                sessions->delete_session(FIRMWARE_FRAG_INDEX);
+            }
+
+            target_max = sessions->get_free_size_at(MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
+            if (target_max > 0) {
+                target_offset = sessions->allocate_scratch(target_max, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
+            }
+            if (target_offset == FRAG_ADDRESS_NONE) {
+                decompress_result = FRAG_DECOMPRESS_TOO_LARGE;
+            }
+        }
+        if (decompress_result == FRAG_DECOMPRESS_OK) {
+            decompress_result = decompress->inflate(compressed_offset, compressed_size, target_offset, target_max, &firmware_size);
+        }
+        decompress_timer.stop();
+
+        decompress->~FragmentationDecompress();
+        scratch.release(decompress_mark);
+        sessions->free_scratch(compressed_offset);
+        firmware_region = target_offset;
+
+        if (decompress_result != FRAG_DECOMPRESS_OK) {
+            debug("Failed to decompress (%d)\n", decompress_result);
+            return 1;
+        }
+
+        debug("Decompressed to %u bytes, took %d ms\n", firmware_size, decompress_timer.read_ms());
+        firmware_offset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
+        rehash = true;
     }
 
-    if (!compare_buffers(header->device_class_uuid, UPDATE_CERT_DEVICE_CLASS_UUID, 16)) {
-        debug("Device Class UUID does not match\n");
+    // A delta update: the firmware is a patch against the running application. The patch is moved to a staging region
+    // at the end of the free flash first (it's small), and the new image is written to the storage offset.
+    if (get_diff_flags(header) & FOTA_DIFF_FLAG_DIFF) {
+#ifdef APP_REGION_SIZE
+        size_t patch_size = firmware_size;
+        size_t old_size = get_diff_old_size(header);
+        const uint8_t* old_image = (const uint8_t*)MBED_APP_START;
+
+        // diff_info comes from the package, don't let the patch read past the application
+        if (old_size > (size_t)APP_REGION_SIZE) {
+            debug("Patch is for an application of %u bytes, the application region is only %u bytes\n",
+                old_size, (size_t)APP_REGION_SIZE);
+            return 1;
+        }
+
+        bd_addr_t patch_offset = sessions->allocate_scratch(patch_size);
+        if (patch_offset == FRAG_ADDRESS_NONE) {
+            debug("No room in flash to stage the patch of %u bytes\n", patch_size);
+            return 1;
+        }
+
+        size_t patch_mark = scratch.get_mark();
+        uint8_t* page_buffer = (uint8_t*)scratch.alloc(PATCH_PAGE_SIZE);
+        uint8_t* read_buffer = (uint8_t*)scratch.alloc(PATCH_READ_SIZE);
+        FragmentationPatch* patch = new (scratch.alloc(sizeof(FragmentationPatch)))
+            FragmentationPatch(&fbd, page_buffer, PATCH_PAGE_SIZE, read_buffer, PATCH_READ_SIZE);
+
+        debug("Applying patch of %u bytes to the application (%u bytes)\n", patch_size, old_size);
+
+        Timer patch_timer;
+        patch_timer.start();
+        FragmentationPatchResult patch_result = patch->copy(firmware_offset, patch_offset, patch_size);
+
+        // Then the new image gets everything from the storage offset up to the next region in use. What the patch came
+        // from is dropped, a reset from here on means the session has to be sent again.
+        bd_addr_t target_offset = FRAG_ADDRESS_NONE;
+        bd_size_t target_max = 0;
+        if (patch_result == FRAG_PATCH_OK) {
+            if (firmware_region != FRAG_ADDRESS_NONE) {
+                sessions->free_scratch(firmware_region);
+            }
+            else {
+                sessions->delete_session(FIRMWARE_FRAG_INDEX);
+            }
+
+            target_max = sessions->get_free_size_at(MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
+            if (target_max > 0) {
+                target_offset = sessions->allocate_scratch(target_max, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
+            }
+            if (target_offset == FRAG_ADDRESS_NONE) {
+                patch_result = FRAG_PATCH_TOO_LARGE;
+            }
+        }
+        if (patch_result == FRAG_PATCH_OK) {
+            patch_result = patch->apply(old_image, old_size, patch_offset, patch_size, target_offset, target_max, &firmware_size);
+        }
+        patch_timer.stop();
+
+        patch->~FragmentationPatch();
+        scratch.release(patch_mark);
+        sessions->free_scratch(patch_offset);
+        firmware_region = target_offset;
+
+        if (patch_result != FRAG_PATCH_OK) {
+            debug("Failed to apply patch (%d)\n", patch_result);
+            return 1;
+        }
+
+        debug("Patched firmware is %u bytes, took %d ms\n", firmware_size, patch_timer.read_ms());
+        firmware_offset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
+        rehash = true;
+#else
+        debug("Delta updates need the application region in internal flash (MBED_APP_START, and MBED_APP_SIZE or flash-size)\n");
         return 1;
+#endif
     }
 
-    debug("Manufacturer and Device Class UUID match\n");
+    // Behind a head manifest and not moved by the steps above: move it down to the storage offset, where the bootloader
+    // looks for it. Going up through the firmware, every chunk is read before anything above it is overwritten.
+    if (firmware_offset != MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET) {
+        size_t move_mark = scratch.get_mark();
+        uint8_t* move_buffer = (uint8_t*)scratch.alloc(PATCH_PAGE_SIZE);
 
-    wait_ms(1);
+        int r = BD_ERROR_OK;
+        for (size_t offset = 0; r == BD_ERROR_OK && offset < firmware_size; offset += PATCH_PAGE_SIZE) {
+            size_t len = firmware_size - offset < PATCH_PAGE_SIZE ? firmware_size - offset : PATCH_PAGE_SIZE;
 
-    // Calculate the SHA256 hash of the file, and then verify whether the signature was signed with a trusted private key
-    unsigned char sha_out_buffer[32];
-    {
-        uint8_t sha_buffer[128];
+            r = fbd.read(move_buffer, firmware_offset + offset, len);
+            if (r == BD_ERROR_OK) {
+                r = fbd.program(move_buffer, MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET + offset, len);
+            }
+        }
+        scratch.release(move_mark);
 
-        // SHA256 requires a large buffer, alloc on heap instead of stack
-        FragmentationSha256* sha256 = new FragmentationSha256(&fbd, sha_buffer, sizeof(sha_buffer));
+        if (r != BD_ERROR_OK) {
+            debug("Failed to move the firmware to the storage offset (%d)\n", r);
+            return 1;
+        }
+        firmware_offset = MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET;
+    }
 
-        // // The last FOTA_SIGNATURE_LENGTH bytes are reserved for the sig, so don't use it for calculating the SHA256 hash
-        sha256->calculate(
-            opts.FlashOffset,
-            (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding - FOTA_SIGNATURE_LENGTH,
-            sha_out_buffer);
+    // Hash the new firmware, the trailer stays where it is (in the header)
+    if (rehash) {
+        size_t hash_mark = scratch.get_mark();
+        uint8_t* verify_buffer = (uint8_t*)scratch.alloc(VERIFY_BUFFER_SIZE);
+        FragmentationVerifier* firmware_verifier = new (scratch.alloc(sizeof(FragmentationVerifier)))
+            FragmentationVerifier(&fbd, verify_buffer, VERIFY_BUFFER_SIZE);
+        uint64_t firmware_crc;
+        int r = firmware_verifier->verify(MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET, firmware_size, NULL, 0, &firmware_crc, sha_out_buffer);
+        firmware_verifier->~FragmentationVerifier();
+        scratch.release(hash_mark);
+
+        if (r != BD_ERROR_OK) {
+            debug("Failed to read the new firmware from flash (%d)\n", r);
+            return 1;
+        }
+    }
 
+    wait_ms(1);
+
+    // Verify whether the signature over the SHA256 hash was signed with a trusted private key
+    {
         debug("SHA256 hash is: ");
         for (size_t ix = 0; ix < 32; ix++) {
             debug("%02x", sha_out_buffer[ix]);
         }
         debug("\n");
 
-        // now check that the signature is correct...
-        {
-            debug("ECDSA signature is: ");
-            for (size_t ix = 0; ix < header->signature_length; ix++) {
-                debug("%02x", header->signature[ix]);
-            }
-            debug("\n");
-            debug("Verifying signature...\n");
+        debug("ECDSA signature is: ");
+        for (size_t ix = 0; ix < (header->signature_length & ~FOTA_SIGNATURE_RAW); ix++) {
+            debug("%02x", header->signature[ix]);
+        }
+        debug("\n");
+        debug("Verifying signature...\n");
+
+        // The context and the crypto pool come from the scratch arena, the bignums and points from the crypto pool
+        // It runs in slices on ecdsa_queue, which only this step dispatches, so here nothing else runs in between.
+        // An application with a LoRaWAN stack passes that stack's queue to run(), so radio events run between slices
+        crypto_pool.start_stage("ecdsa", scratch.alloc(FOTALORA_MBEDTLS_POOL_SIZE), FOTALORA_MBEDTLS_POOL_SIZE);
+        FragmentationEcdsaRestartable* ecdsa = new (scratch.alloc(sizeof(FragmentationEcdsaRestartable)))
+            FragmentationEcdsaRestartable(UPDATE_CERT_PUBKEY_RAW);
+        if (header->signature_length == (FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH)) {
+            ecdsa_result = ecdsa->start_raw(sha_out_buffer, header->signature);
+        }
+        else {
+            ecdsa_result = ecdsa->start(sha_out_buffer, header->signature, header->signature_length);
+        }
+        if (ecdsa_result == FRAG_ECDSA_IN_PROGRESS) {
+            ecdsa_result = ecdsa->run(&ecdsa_queue, &ecdsa_done);
+        }
+        if (ecdsa_result == FRAG_ECDSA_IN_PROGRESS) {
+            ecdsa_queue.dispatch_forever();
+        }
 
-            // ECDSA requires a large buffer, alloc on heap instead of stack
-            FragmentationEcdsaVerify* ecdsa = new FragmentationEcdsaVerify(UPDATE_CERT_PUBKEY, UPDATE_CERT_LENGTH);
-            bool valid = ecdsa->verify(sha_out_buffer, header->signature, header->signature_length);
-            if (!valid) {
-                debug("ECDSA verification of firmware failed\n");
-                return 1;
-            }
-            else {
-                debug("ECDSA verification OK\n");
-            }
+        debug("ECDSA took %lu ms in %lu slices, longest slice %lu us\n",
+            ecdsa->get_total_us() / 1000, ecdsa->get_slices(), ecdsa->get_max_slice_us());
+        ecdsa->~FragmentationEcdsaRestartable();
+        crypto_pool.end_stage();
+
+        if (ecdsa_result != FRAG_ECDSA_VALID) {
+            debug("ECDSA verification of firmware failed\n");
+            return 1;
+        }
+        else {
+            debug("ECDSA verification OK\n");
         }
     }
 
     wait_ms(1);
 
-    free(header);
+    // The header is not needed anymore, this releases the whole arena
+    scratch.release(0);
 
     // Hash is matching, now write the header so the bootloader can flash the update
     arm_uc_firmware_details_t details;
     details.version = static_cast<uint64_t>(MBED_BUILD_TIMESTAMP) + 10; // should be timestamp that the fw was built, this is to get around this
-    details.size = (opts.NumberOfFragments * opts.FragmentSize) - opts.Padding - FOTA_SIGNATURE_LENGTH;
+    details.size = firmware_size;
     memcpy(details.hash, sha_out_buffer, 32); // SHA256 hash of the firmware
     memset(details.campaign, 0, ARM_UC_GUID_SIZE); // todo, add campaign info
     details.signatureSize = 0; // not sure what this is used for
 
-    uint8_t *fw_header_buff = (uint8_t*)malloc(ARM_UC_EXTERNAL_HEADER_SIZE_V2);
-    if (!fw_header_buff) {
-        debug("Could not allocate %d bytes for header\n", ARM_UC_EXTERNAL_HEADER_SIZE_V2);
-        return 1;
-    }
+    uint8_t *fw_header_buff = (uint8_t*)scratch.alloc(ARM_UC_EXTERNAL_HEADER_SIZE_V2);
 
     arm_uc_buffer_t buff = { ARM_UC_EXTERNAL_HEADER_SIZE_V2, ARM_UC_EXTERNAL_HEADER_SIZE_V2, fw_header_buff };
 
@@ -229,9 +826,24 @@ int main() {
         return 1;
     }
 
+    scratch.release(0);
+    debug("Scratch arena peak usage: %u of %u bytes\n", scratch.get_peak(), FRAG_SCRATCH_SIZE);
+
+    // The session is done, don't resume it after the reset
+    delete sessions;
+    FragmentationSessionManager::clear(&fbd, journal_offset);
+
+    // The header and the session table might still be in the page buffer
+    if ((r = pbd.sync()) != BD_ERROR_OK) {
+        debug("Failed to flush the page buffer: %d\n", r);
+        return 1;
+    }
+
     debug("Stored the update parameters in flash on 0x%x. Reset the board to apply update.\n", MBED_CONF_APP_FRAGMENTATION_STORAGE_OFFSET);
 
     bd.deinit();
 
     wait(osWaitForever);
 }
+
+#endif // MBED_TEST_MODE
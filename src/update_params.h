@@ -24,15 +24,32 @@
 
 // These values need to be the same between target application and bootloader!
 #define     FOTA_SIGNATURE_LENGTH  sizeof(UpdateSignature_t)    // Length of RSA signature + class UUIDs + diff struct (5 bytes) -> matches sizeof(UpdateSignature_t)
+#define     FOTA_SIGNATURE_RAW     0x80                         // Set in signature_length if the signature is a raw 64 byte r || s, rather than DER
+#define     FOTA_DIFF_FLAG_DIFF    0x01                         // Set in the first byte of diff_info if the firmware is a patch against the running application
+#define     FOTA_DIFF_FLAG_ENCRYPTED  0x02                      // Set in the first byte of diff_info if the firmware is encrypted with AES-256-CTR (raw signature only)
+#define     FOTA_DIFF_FLAG_COMPRESSED 0x04                      // Set in the first byte of diff_info if the firmware (or the patch) is compressed, see FragmentationDecompress
+#define     FOTA_NONCE_LENGTH      8                            // The nonce of an encrypted package is in the signature bytes after the raw signature
 
 // This structure contains the update header (which is the first FOTA_SIGNATURE_LENGTH bytes of a package)
 typedef struct __attribute__((__packed__)) {
-    uint8_t signature_length;           // Length of the ECDSA/SHA256 signature
-    unsigned char signature[72];        // ECDSA/SHA256 signature, signed with private key of the firmware (after applying patching), length is 70, 71 or 72
+    uint8_t signature_length;           // Length of the ECDSA/SHA256 signature, or FOTA_SIGNATURE_RAW | 64 for a raw signature
+    unsigned char signature[72];        // ECDSA/SHA256 signature, signed with private key of the firmware (after applying patching), DER (70, 71 or 72 bytes) or raw r || s
     uint8_t manufacturer_uuid[16];      // Manufacturer UUID
     uint8_t device_class_uuid[16];      // Device Class UUID
 
-    uint32_t diff_info;                 // first byte indicates whether this is a diff, last three bytes are the size of the *old* file
+    uint32_t diff_info;                 // first byte indicates whether this is a diff (and FOTA_DIFF_FLAG_ENCRYPTED, FOTA_DIFF_FLAG_COMPRESSED), last three bytes are the size of the *old* file (big endian)
 } UpdateSignature_t;
 
+// A package can also start with the signature block (a head manifest), so a device can reject a package for other
+// hardware as soon as the first fragment is in. It's recognized by the magic, and the CRC32 tells it apart from firmware
+// that happens to start with the same bytes. The firmware follows the manifest.
+#define     FOTA_MANIFEST_MAGIC    0x4d544f46                   // 'FOTM'
+#define     FOTA_MANIFEST_LENGTH   sizeof(UpdateManifest_t)
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;                     // FOTA_MANIFEST_MAGIC
+    UpdateSignature_t signature;        // same as the trailer of a package without a head manifest
+    uint32_t crc32;                     // CRC32 (arm_uc_crc32) over magic and signature
+} UpdateManifest_t;
+
 #endif
@@ -1,8 +1,11 @@
 #ifndef _UPDATE_CERTS_H
 #define _UPDATE_CERTS_H
 
-const char * UPDATE_CERT_PUBKEY = "-----BEGIN PUBLIC KEY-----\nMFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEvt5wK2Mi99mxCyeadYMFKlGOS2A7\nAal3tJyTXjWApjzUMfhqvp9+GlC58iSPkCX7euW4YGiKR3uqdvUTOsTYoQ==\n-----END PUBLIC KEY-----\n";
-const size_t UPDATE_CERT_LENGTH = 179;
+// Raw P-256 public key (X || Y), generated from certs/update.pub by test-fw/create-certs-h.js
+const uint8_t UPDATE_CERT_PUBKEY_RAW[64] = { 0xbe, 0xde, 0x70, 0x2b, 0x63, 0x22, 0xf7, 0xd9, 0xb1, 0x0b, 0x27, 0x9a, 0x75, 0x83, 0x05, 0x2a, 0x51, 0x8e, 0x4b, 0x60, 0x3b, 0x01, 0xa9, 0x77, 0xb4, 0x9c, 0x93, 0x5e, 0x35, 0x80, 0xa6, 0x3c, 0xd4, 0x31, 0xf8, 0x6a, 0xbe, 0x9f, 0x7e, 0x1a, 0x50, 0xb9, 0xf2, 0x24, 0x8f, 0x90, 0x25, 0xfb, 0x7a, 0xe5, 0xb8, 0x60, 0x68, 0x8a, 0x47, 0x7b, 0xaa, 0x76, 0xf5, 0x13, 0x3a, 0xc4, 0xd8, 0xa1 };
+
+// AES-256 key to decrypt encrypted firmware (AES-CTR), from certs/firmware.key
+const uint8_t UPDATE_CERT_FIRMWARE_KEY[32] = { 0xf6, 0x3f, 0x72, 0x25, 0xe2, 0x9a, 0x00, 0xe9, 0x42, 0xc6, 0x71, 0xc2, 0x93, 0xf4, 0x25, 0x24, 0x35, 0xc8, 0x40, 0x11, 0x40, 0xfb, 0x6a, 0x3e, 0x82, 0x88, 0x59, 0x4e, 0xda, 0x1f, 0x1d, 0x3f };
 
 const uint8_t UPDATE_CERT_MANUFACTURER_UUID[16] = { 0x35, 0xa4, 0x66, 0xb8, 0x8b, 0x16, 0x50, 0x77, 0xaf, 0x86, 0x47, 0x7a, 0x5c, 0x23, 0xe8, 0xca };
 const uint8_t UPDATE_CERT_DEVICE_CLASS_UUID[16] = { 0x67, 0x6d, 0x7f, 0xc7, 0x86, 0x16, 0x55, 0xc6, 0x97, 0xc3, 0x1a, 0x42, 0x8b, 0xe6, 0x46, 0x17 };
@@ -0,0 +1,157 @@
+/**
+ * Compressor for FragmentationDecompress.h (src/): the output size (LEB128), log2 of the window, then LZ4 style
+ * sequences with offsets no larger than the window, so the device can decompress with just the window in RAM.
+ */
+
+const MIN_MATCH = 4;
+const MAX_CANDIDATES = 64;
+const HASH_BITS = 14;
+
+function writeNumber(out, value) {
+    do {
+        out.push((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+        value >>>= 7;
+    } while (value);
+}
+
+// a nibble of 15 is followed by bytes that are added, until one is < 255
+function writeLength(out, len) {
+    len -= 15;
+    while (len >= 255) {
+        out.push(255);
+        len -= 255;
+    }
+    out.push(len);
+}
+
+function hash(data, pos) {
+    let v = (data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | (data[pos + 3] << 24)) >>> 0;
+    return Math.imul(v, 2654435761) >>> (32 - HASH_BITS);
+}
+
+/**
+ * @param data Buffer to compress
+ * @param windowBits log2 of the window of the device (9 is 512 bytes)
+ */
+function compress(data, windowBits) {
+    const windowSize = 1 << windowBits;
+    const head = new Int32Array(1 << HASH_BITS).fill(-1);
+    const chain = new Int32Array(data.length).fill(-1);
+    let indexed = 0;
+
+    let out = [];
+    writeNumber(out, data.length);
+    out.push(windowBits);
+
+    function insertUpTo(pos) {
+        for (; indexed < pos && indexed + MIN_MATCH <= data.length; indexed++) {
+            let h = hash(data, indexed);
+            chain[indexed] = head[h];
+            head[h] = indexed;
+        }
+    }
+
+    function findMatch(pos) {
+        let best = { len: 0, offset: 0 };
+        if (pos + MIN_MATCH > data.length) return best;
+
+        insertUpTo(pos);
+        let candidate = head[hash(data, pos)];
+        for (let tries = 0; candidate >= 0 && pos - candidate <= windowSize && tries < MAX_CANDIDATES; tries++) {
+            let len = 0;
+            while (pos + len < data.length && data[candidate + len] === data[pos + len]) len++;
+            if (len > best.len) {
+                best = { len: len, offset: pos - candidate };
+            }
+            candidate = chain[candidate];
+        }
+        return best;
+    }
+
+    function sequence(literalStart, literalEnd, match) {
+        let literalLen = literalEnd - literalStart;
+        let matchLen = match ? match.len - MIN_MATCH : 0;
+        out.push((Math.min(literalLen, 15) << 4) | Math.min(matchLen, 15));
+        if (literalLen >= 15) writeLength(out, literalLen);
+        for (let ix = literalStart; ix < literalEnd; ix++) out.push(data[ix]);
+        if (match) {
+            out.push(match.offset & 0xff, match.offset >> 8);
+            if (matchLen >= 15) writeLength(out, matchLen);
+        }
+    }
+
+    let pos = 0;
+    let literalStart = 0;
+
+    while (pos < data.length) {
+        let match = findMatch(pos);
+        if (match.len < MIN_MATCH) {
+            pos++;
+            continue;
+        }
+
+        // lazy: take a literal if the next position has a longer match
+        let next = findMatch(pos + 1);
+        if (next.len > match.len + 1) {
+            pos++;
+            continue;
+        }
+
+        sequence(literalStart, pos, match);
+        pos += match.len;
+        literalStart = pos;
+    }
+
+    // the last sequence has literals only (also for empty data)
+    sequence(literalStart, data.length, null);
+
+    return Buffer.from(out);
+}
+
+/**
+ * Same as FragmentationDecompress::inflate, to check the output of compress()
+ */
+function decompress(data) {
+    let pos = 0;
+    function readByte() {
+        if (pos >= data.length) throw new Error('Compressed data is truncated');
+        return data[pos++];
+    }
+    function readLength(nibble) {
+        let len = nibble;
+        if (nibble === 15) {
+            let b;
+            do {
+                b = readByte();
+                len += b;
+            } while (b === 255);
+        }
+        return len;
+    }
+
+    let size = 0;
+    for (let shift = 0, b = 0x80; b & 0x80; shift += 7) {
+        b = readByte();
+        size += (b & 0x7f) * Math.pow(2, shift);
+    }
+    readByte(); // window bits
+
+    let out = Buffer.alloc(size);
+    let total = 0;
+    while (true) {
+        let token = readByte();
+        let len = readLength(token >> 4);
+        for (let ix = 0; ix < len; ix++) out[total++] = readByte();
+        if (total >= size) break;
+
+        let offset = readByte() | (readByte() << 8);
+        len = readLength(token & 0x0f) + MIN_MATCH;
+        if (offset === 0 || offset > total || total + len > size) throw new Error('Compressed data is corrupt');
+        for (let ix = 0; ix < len; ix++, total++) out[total] = out[total - offset];
+    }
+    if (total !== size || pos !== data.length) throw new Error('Compressed data is corrupt');
+
+    return out;
+}
+
+module.exports = { compress: compress, decompress: decompress };
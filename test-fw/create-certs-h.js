@@ -0,0 +1,67 @@
+const execSync = require('child_process').execSync;
+const UUID = require('uuid-1345');
+const fs = require('fs');
+const Path = require('path');
+
+const certsFolder = Path.join(__dirname, 'certs');
+
+function toCArray(buffer) {
+    return Array.from(buffer).map(c => '0x' + c.toString(16).padStart(2, '0')).join(', ');
+}
+
+// The public key is stored on the device as the raw point (X || Y), so the device does not need to parse PEM / ASN.1.
+// The DER encoded key ends with the uncompressed point: 0x04 || X || Y.
+function getRawPublicKey(pubKeyPath) {
+    let der = execSync(`openssl ec -pubin -in ${pubKeyPath} -outform DER`, { stdio: [ 'pipe', 'pipe', 'ignore' ] });
+    let point = der.slice(der.length - 65);
+    if (point[0] !== 0x04) {
+        throw new Error('Public key is not an uncompressed P-256 point');
+    }
+    return point.slice(1);
+}
+
+// AES-256 key for encrypted firmware, stored as hex in certs/firmware.key
+function getFirmwareKey() {
+    let key = Buffer.from(fs.readFileSync(Path.join(certsFolder, 'firmware.key'), 'utf-8').trim(), 'hex');
+    if (key.length !== 32) {
+        throw new Error('certs/firmware.key is not a 256 bits key');
+    }
+    return key;
+}
+
+function createCertsH() {
+    let deviceIds = require(Path.join(certsFolder, 'device-ids'));
+
+    let rawKey = getRawPublicKey(Path.join(certsFolder, 'update.pub'));
+    let firmwareKey = getFirmwareKey();
+    let manufacturerUUID = new UUID(deviceIds['manufacturer-uuid']).toBuffer();
+    let deviceClassUUID = new UUID(deviceIds['device-class-uuid']).toBuffer();
+
+    let certs = `#ifndef _UPDATE_CERTS_H
+#define _UPDATE_CERTS_H
+
+// Raw P-256 public key (X || Y), generated from certs/update.pub by test-fw/create-certs-h.js
+const uint8_t UPDATE_CERT_PUBKEY_RAW[64] = { ${toCArray(rawKey)} };
+
+// AES-256 key to decrypt encrypted firmware (AES-CTR), from certs/firmware.key
+const uint8_t UPDATE_CERT_FIRMWARE_KEY[32] = { ${toCArray(firmwareKey)} };
+
+const uint8_t UPDATE_CERT_MANUFACTURER_UUID[16] = { ${toCArray(manufacturerUUID)} };
+const uint8_t UPDATE_CERT_DEVICE_CLASS_UUID[16] = { ${toCArray(deviceClassUUID)} };
+
+#endif // _UPDATE_CERTS_H_
+`;
+
+    console.log('Writing UpdateCerts.h');
+    fs.writeFileSync(Path.join(certsFolder, 'UpdateCerts.h'), certs, 'utf-8');
+    fs.writeFileSync(Path.join(__dirname, '..', 'src', 'UpdateCerts.h'), certs, 'utf-8');
+    console.log('Writing UpdateCerts.h OK');
+}
+
+module.exports = createCertsH;
+module.exports.getFirmwareKey = getFirmwareKey;
+
+// Regenerate UpdateCerts.h from the keys in the certs folder
+if (require.main === module) {
+    createCertsH();
+}
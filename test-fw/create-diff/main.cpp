@@ -0,0 +1,298 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Creates a patch for FragmentationPatch.h (src/) from an old and a new application binary.
+ *
+ *     $ g++ -O2 -std=c++11 -I../../src -o create-diff main.cpp
+ *     $ ./create-diff [--window bytes] [--page-size bytes] old_application.bin new_application.bin patch.bin
+ *
+ * The device writes the new image front to back and reads the old image from internal flash, so the patch is a single
+ * pass over the new image: every byte is either copied from the old image or inserted from the patch. Matches are found
+ * with a hash index over the old image, and the old position is kept in lockstep through small edits (changed
+ * constants, branch offsets), so most copies need no seek. --window limits how far from its own offset a copy can come
+ * from (0 is the whole old image). The patch is applied again with the code of the device (FragmentationPatchCore.h),
+ * in pages of --page-size, and checked against the new image before it's written.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "FragmentationPatchCore.h"
+
+// Bytes that are hashed to find candidates in the old image
+#define HASH_LENGTH             8
+#define HASH_BITS               18
+// Candidates that are tried per position, newest first
+#define MAX_CANDIDATES          64
+
+static bool read_file(const char* path, std::vector<uint8_t>* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+
+    uint8_t buffer[4096];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data->insert(data->end(), buffer, buffer + len);
+    }
+    fclose(f);
+    return true;
+}
+
+static size_t number_length(uint32_t value) {
+    size_t len = 1;
+    while (value > 0x7f) {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static uint32_t zigzag(int64_t offset) {
+    return offset < 0 ? ((uint32_t)(-(offset + 1)) << 1) | 1 : (uint32_t)offset << 1;
+}
+
+class PatchWriter {
+public:
+    PatchWriter() : copies(0), inserts(0), seeks(0), copied(0), inserted(0) {}
+
+    void number(uint32_t value) {
+        do {
+            data.push_back((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+            value >>= 7;
+        } while (value);
+    }
+
+    void copy(uint32_t len) {
+        data.push_back(FRAG_PATCH_COPY);
+        number(len);
+        copies++;
+        copied += len;
+    }
+
+    void insert(const uint8_t* bytes, uint32_t len) {
+        data.push_back(FRAG_PATCH_INSERT);
+        number(len);
+        data.insert(data.end(), bytes, bytes + len);
+        inserts++;
+        inserted += len;
+    }
+
+    void seek(int64_t offset) {
+        data.push_back(FRAG_PATCH_SEEK);
+        number(zigzag(offset));
+        seeks++;
+    }
+
+    std::vector<uint8_t> data;
+    size_t copies, inserts, seeks, copied, inserted;
+};
+
+class DiffGenerator {
+public:
+    DiffGenerator(const std::vector<uint8_t>& old_image, const std::vector<uint8_t>& new_image, size_t window)
+        : _old(old_image), _new(new_image), _window(window), _head(1 << HASH_BITS, -1), _chain(old_image.size(), -1)
+    {
+        for (size_t pos = 0; pos + HASH_LENGTH <= _old.size(); pos++) {
+            uint32_t h = hash(&_old[pos]);
+            _chain[pos] = _head[h];
+            _head[h] = (int32_t)pos;
+        }
+    }
+
+    void generate(PatchWriter* patch) {
+        size_t pos = 0;             // position in the new image
+        size_t old_pos = 0;         // position in the old image, as the device will have it
+        size_t literal_start = 0;   // start of the bytes that will be inserted
+
+        patch->number((uint32_t)_new.size());
+
+        while (pos < _new.size()) {
+            size_t literal_len = pos - literal_start;
+            size_t best_len = 0, best_src = 0;
+
+            // lockstep: the old position as it was, or moved along with the inserted bytes (bytes that were replaced)
+            try_candidate(old_pos, pos, &best_len, &best_src);
+            try_candidate(old_pos + literal_len, pos, &best_len, &best_src);
+
+            if (best_len < HASH_LENGTH * 4 && pos + HASH_LENGTH <= _new.size()) {
+                int32_t candidate = _head[hash(&_new[pos])];
+                for (int tries = 0; candidate >= 0 && tries < MAX_CANDIDATES; tries++, candidate = _chain[candidate]) {
+                    try_candidate(candidate, pos, &best_len, &best_src);
+                }
+            }
+
+            // a copy needs to pay for its command, and for the seek and the end of the insert if it breaks one
+            size_t cost = 1 + number_length((uint32_t)best_len);
+            if (best_src != old_pos) cost += 1 + number_length(zigzag((int64_t)best_src - (int64_t)old_pos));
+            if (literal_len > 0) cost += 1 + number_length((uint32_t)literal_len);
+
+            if (best_len <= cost) {
+                pos++;
+                continue;
+            }
+
+            if (literal_len > 0) {
+                patch->insert(&_new[literal_start], (uint32_t)literal_len);
+            }
+            if (best_src != old_pos) {
+                patch->seek((int64_t)best_src - (int64_t)old_pos);
+            }
+            patch->copy((uint32_t)best_len);
+
+            pos += best_len;
+            old_pos = best_src + best_len;
+            literal_start = pos;
+        }
+
+        if (pos > literal_start) {
+            patch->insert(&_new[literal_start], (uint32_t)(pos - literal_start));
+        }
+    }
+
+private:
+    static uint32_t hash(const uint8_t* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+    }
+
+    void try_candidate(size_t src, size_t pos, size_t* best_len, size_t* best_src) {
+        if (src >= _old.size()) return;
+        if (_window && (src > pos ? src - pos : pos - src) > _window) return;
+
+        size_t len = 0;
+        size_t max = _old.size() - src < _new.size() - pos ? _old.size() - src : _new.size() - pos;
+        while (len < max && _old[src + len] == _new[pos + len]) len++;
+
+        if (len > *best_len) {
+            *best_len = len;
+            *best_src = src;
+        }
+    }
+
+    const std::vector<uint8_t>& _old;
+    const std::vector<uint8_t>& _new;
+    size_t _window;
+    std::vector<int32_t> _head;
+    std::vector<int32_t> _chain;
+};
+
+/**
+ * FragmentationPatchCore over a patch in memory, with the page size of the device
+ */
+class MemoryPatch : public FragmentationPatchCore {
+public:
+    MemoryPatch(std::vector<uint8_t>* page_buffer, const std::vector<uint8_t>& patch, std::vector<uint8_t>* out)
+        : FragmentationPatchCore(page_buffer->data(), page_buffer->size()),
+          _patch(patch.data()), _size(patch.size()), _out(out)
+    {
+    }
+
+protected:
+    virtual FragmentationPatchResult refill(const uint8_t** data, size_t* size) {
+        *data = _patch;
+        *size = _size;
+        _size = 0;
+        return FRAG_PATCH_OK;
+    }
+
+    virtual FragmentationPatchResult flush(const uint8_t* data, size_t size) {
+        _out->insert(_out->end(), data, data + size);
+        return FRAG_PATCH_OK;
+    }
+
+private:
+    const uint8_t* _patch;
+    size_t _size;
+    std::vector<uint8_t>* _out;
+};
+
+static void usage() {
+    fprintf(stderr, "Usage: create-diff [--window bytes] [--page-size bytes] old.bin new.bin patch.bin\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t window = 0;
+    size_t page_size = 528;
+    std::vector<const char*> files;
+
+    for (int ix = 1; ix < argc; ix++) {
+        std::string arg = argv[ix];
+        if (arg == "--window" && ix + 1 < argc) {
+            window = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (arg == "--page-size" && ix + 1 < argc) {
+            page_size = strtoul(argv[++ix], NULL, 0);
+        }
+        else {
+            files.push_back(argv[ix]);
+        }
+    }
+    if (files.size() != 3 || page_size == 0) usage();
+
+    std::vector<uint8_t> old_image, new_image;
+    if (!read_file(files[0], &old_image) || !read_file(files[1], &new_image)) {
+        fprintf(stderr, "Could not read %s or %s\n", files[0], files[1]);
+        return 1;
+    }
+    if (old_image.size() > 0xffffff) {
+        fprintf(stderr, "Old image does not fit in diff_info (24 bits)\n");
+        return 1;
+    }
+
+    PatchWriter patch;
+    DiffGenerator(old_image, new_image, window).generate(&patch);
+
+    // apply it the way the device does, page by page
+    std::vector<uint8_t> page_buffer(page_size), check;
+    size_t check_size;
+    MemoryPatch check_patch(&page_buffer, patch.data, &check);
+    if (check_patch.apply(old_image.data(), old_image.size(), SIZE_MAX, &check_size) != FRAG_PATCH_OK || check != new_image) {
+        fprintf(stderr, "Patch does not reproduce the new image\n");
+        return 1;
+    }
+
+    FILE* f = fopen(files[2], "wb");
+    if (!f || fwrite(patch.data.data(), 1, patch.data.size(), f) != patch.data.size()) {
+        fprintf(stderr, "Could not write %s\n", files[2]);
+        return 1;
+    }
+    fclose(f);
+
+    // pages of the new image that are the same as in the old image, at the same offset
+    size_t pages = (new_image.size() + page_size - 1) / page_size, same_pages = 0;
+    for (size_t page = 0; page < pages; page++) {
+        size_t start = page * page_size;
+        size_t len = new_image.size() - start < page_size ? new_image.size() - start : page_size;
+        if (start + len <= old_image.size() && memcmp(&old_image[start], &new_image[start], len) == 0) same_pages++;
+    }
+
+    printf("Old image %u bytes, new image %u bytes, patch %u bytes (%.1f%%)\n",
+        (unsigned)old_image.size(), (unsigned)new_image.size(), (unsigned)patch.data.size(),
+        new_image.size() ? 100.0 * patch.data.size() / new_image.size() : 0.0);
+    printf("%u copies (%u bytes), %u inserts (%u bytes), %u seeks\n",
+        (unsigned)patch.copies, (unsigned)patch.copied, (unsigned)patch.inserts, (unsigned)patch.inserted, (unsigned)patch.seeks);
+    printf("%u of %u pages (%u bytes) unchanged\n", (unsigned)same_pages, (unsigned)pages, (unsigned)page_size);
+
+    return 0;
+}
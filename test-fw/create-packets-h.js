@@ -1,9 +1,12 @@
 const fs = require('fs');
 const Path = require('path');
 const execSync = require('child_process').execSync;
+const crypto = require('crypto');
 const UUID = require('uuid-1345');
 const deviceId = require('./certs/device-ids');
 const crc64 = require('./calculate-crc64/crc');
+const lz = require('./compress/compress');
+const replayFile = require('./replay/replay');
 
 let manufacturerUUID = new UUID(deviceId['manufacturer-uuid']).toBuffer();
 let deviceClassUUID = new UUID(deviceId['device-class-uuid']).toBuffer();
@@ -11,16 +14,168 @@ let deviceClassUUID = new UUID(deviceId['device-class-uuid']).toBuffer();
 // diff info contains (bool is_diff, 3 bytes for the size of the *old* firmware)
 let isDiffBuffer = Buffer.from([ 0, 0, 0, 0 ]);
 
-const binaryPath = Path.resolve(process.argv[2]);
+// Options with a value, removed from argv
+function takeOption(name) {
+    let ix = process.argv.indexOf(name);
+    if (ix === -1) return null;
+    let value = process.argv[ix + 1];
+    process.argv.splice(ix, 2);
+    return value;
+}
+
+// Options that can be given more than once
+function takeOptions(name) {
+    let values = [];
+    for (let value; (value = takeOption(name)) !== null; ) {
+        values.push(value);
+    }
+    return values;
+}
+
+// --redundancy <n> sets the number of redundancy frames after the fragments
+const FRAGMENT_SIZE = 204;
+const redundancyOption = takeOption('--redundancy');
+const redundancy = redundancyOption !== null ? Number(redundancyOption) : 20;
+
+// --replay <replay.bin> writes a replay file for FragmentationReplay (simulator builds) rather than packets.h.
+// --interval <ms> adds a timestamp per frame, every --loss <capture.txt> (frame counters of lost frames) a loss mask.
+const replayPath = takeOption('--replay');
+const interval = takeOption('--interval');
+const lossPaths = takeOptions('--loss');
+if ((interval !== null || lossPaths.length) && !replayPath) {
+    console.log('--interval and --loss need --replay');
+    process.exit(1);
+}
+
+// --old <old.bin> sends a delta update: the package holds the patch against the old firmware, the signature is over
+// the new firmware (the binary), and diff_info holds the size of the old firmware. The patch is made by create-diff,
+// or taken from --patch <patch.bin>.
+let patchPath = takeOption('--patch');
+const oldPath = takeOption('--old');
+if (patchPath && !oldPath) {
+    console.log('--patch needs --old');
+    process.exit(1);
+}
+
+// --compress compresses the firmware (or the patch) for FragmentationDecompress, with the window of the device
+// (DECOMPRESS_WINDOW_SIZE in main.cpp, 512 bytes). Fewer bytes means fewer fragments.
+const compress = process.argv.indexOf('--compress') !== -1;
+const COMPRESS_WINDOW_BITS = 9;
+
+// --encrypt encrypts the firmware with AES-256-CTR under certs/firmware.key, the signature stays over the plaintext.
+// The 8 byte nonce goes in the signature field after the raw signature, so it needs --raw-signature (implied).
+const encrypt = process.argv.indexOf('--encrypt') !== -1;
+
+// --raw-signature stores the signature as raw r || s (64 bytes) rather than DER, the device does not need to parse it
+const rawSignature = encrypt || process.argv.indexOf('--raw-signature') !== -1;
+// --head-manifest puts the signature block at the start of the package (UpdateManifest_t), so devices for other
+// hardware drop the session as soon as the first fragment is in
+const headManifest = process.argv.indexOf('--head-manifest') !== -1;
+
+const args = process.argv.filter(a => a !== '--raw-signature' && a !== '--encrypt' && a !== '--compress' && a !== '--head-manifest');
+
+// FOTA_SIGNATURE_RAW and FOTA_DIFF_FLAG_* in update_params.h
+const SIGNATURE_RAW_FLAG = 0x80;
+const DIFF_FLAG_DIFF = 0x01;
+const DIFF_FLAG_ENCRYPTED = 0x02;
+const DIFF_FLAG_COMPRESSED = 0x04;
+
+// FOTA_MANIFEST_MAGIC ('FOTM'), little endian
+const MANIFEST_MAGIC = 0x4d544f46;
+
+// CRC32 as arm_uc_crc32 (IEEE 802.3, reflected)
+function crc32(data) {
+    let crc = 0xffffffff;
+    for (let b of data) {
+        crc ^= b;
+        for (let ix = 0; ix < 8; ix++) {
+            crc = (crc >>> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return (crc ^ 0xffffffff) >>> 0;
+}
+
+// DER signature is SEQUENCE { INTEGER r, INTEGER s }, the integers get a leading zero if the top bit is set
+function derToRaw(der) {
+    let raw = Buffer.alloc(64);
+    let offset = 2;
+    for (let ix = 0; ix < 2; ix++) {
+        if (der[offset] !== 0x02) throw new Error('Signature is not DER encoded');
+        let len = der[offset + 1];
+        let value = der.slice(offset + 2, offset + 2 + len);
+        while (value.length > 32 && value[0] === 0) value = value.slice(1);
+        value.copy(raw, ix * 32 + (32 - value.length));
+        offset += 2 + len;
+    }
+    return raw;
+}
+
+const binaryPath = Path.resolve(args[2]);
 const tempFilePath = Path.join(__dirname, 'temp.bin');
+const tempPatchPath = Path.join(__dirname, 'temp-patch.bin');
+const tempFramesPath = Path.join(__dirname, 'temp-frames.bin');
 
 // now we need to create a signature...
 let signature = execSync(`openssl dgst -sha256 -sign ${Path.join(__dirname, 'certs', 'update.key')} ${binaryPath}`);
 console.log('Signed signature is', signature.toString('hex'));
 
-let sigLength = Buffer.from([ signature.length ]);
+if (rawSignature) {
+    signature = derToRaw(signature);
+    console.log('Raw signature is', signature.toString('hex'));
+}
+
+let sigLength = Buffer.from([ rawSignature ? (SIGNATURE_RAW_FLAG | signature.length) : signature.length ]);
+
+let firmware = fs.readFileSync(binaryPath);
+
+if (oldPath && !patchPath) {
+    const createDiff = Path.join(__dirname, 'create-diff', 'create-diff');
+    if (!fs.existsSync(createDiff)) {
+        execSync(`g++ -O2 -std=c++11 -I${Path.join(__dirname, '..', 'src')} -o ${createDiff} ${Path.join(__dirname, 'create-diff', 'main.cpp')}`);
+    }
+    patchPath = tempPatchPath;
+    console.log(execSync(`${createDiff} ${Path.resolve(oldPath)} ${binaryPath} ${patchPath}`).toString('utf-8').trim());
+}
 
-if (signature.length === 70) {
+if (oldPath) {
+    let oldSize = fs.statSync(oldPath).size;
+    if (oldSize > 0xffffff) {
+        throw new Error('Old firmware does not fit in diff_info');
+    }
+    isDiffBuffer[0] |= DIFF_FLAG_DIFF;
+    isDiffBuffer.writeUIntBE(oldSize, 1, 3);
+    firmware = fs.readFileSync(patchPath);
+    console.log('Delta update, patch is', firmware.length, 'bytes for', fs.statSync(binaryPath).size, 'bytes of firmware');
+}
+
+// compressed before it's encrypted, ciphertext does not compress
+if (compress) {
+    let compressed = lz.compress(firmware, COMPRESS_WINDOW_BITS);
+    if (compressed.length < firmware.length) {
+        console.log('Compressed firmware from', firmware.length, 'to', compressed.length, 'bytes');
+        firmware = compressed;
+        isDiffBuffer[0] |= DIFF_FLAG_COMPRESSED;
+    }
+    else {
+        console.log('Firmware does not compress (' + compressed.length + ' bytes), sending it as is');
+    }
+}
+
+// the counter block is nonce || 64 bits big endian block counter, starting at 0
+let nonce = Buffer.alloc(8);
+if (encrypt) {
+    nonce = crypto.randomBytes(8);
+    let cipher = crypto.createCipheriv('aes-256-ctr', require('./create-certs-h').getFirmwareKey(), Buffer.concat([ nonce, Buffer.alloc(8) ]));
+    firmware = Buffer.concat([ cipher.update(firmware), cipher.final() ]);
+    isDiffBuffer[0] |= DIFF_FLAG_ENCRYPTED;
+    console.log('Encrypted firmware, nonce is', nonce.toString('hex'));
+}
+
+// the signature field is 72 bytes
+if (rawSignature) {
+    signature = Buffer.concat([ signature, nonce ]);
+}
+else if (signature.length === 70) {
     signature = Buffer.concat([ signature, Buffer.from([ 0, 0 ]) ]);
 }
 else if (signature.length === 71) {
@@ -30,45 +185,63 @@ else if (signature.length === 71) {
 let manifest = Buffer.concat([ sigLength, signature, manufacturerUUID, deviceClassUUID, isDiffBuffer ]);
 
 // now make a temp file which contains bin + signature + class IDs + if it's a diff or not
-fs.writeFileSync(tempFilePath, Buffer.concat([ fs.readFileSync(binaryPath), manifest ]));
+if (headManifest) {
+    let magic = Buffer.alloc(4);
+    magic.writeUInt32LE(MANIFEST_MAGIC, 0);
+    let crc = Buffer.alloc(4);
+    crc.writeUInt32LE(crc32(Buffer.concat([ magic, manifest ])), 0);
+    fs.writeFileSync(tempFilePath, Buffer.concat([ magic, manifest, crc, firmware ]));
+}
+else {
+    fs.writeFileSync(tempFilePath, Buffer.concat([ firmware, manifest ]));
+}
 
-// Invoke encode_file.py to make packets...
-const infile = execSync('python ' + Path.join(__dirname, 'encode_file.py') + ' ' + tempFilePath + ' 204 20').toString('utf-8').split('\n');
+// Split the package in fragments and add redundancy frames with encode-file (the generator of the device)
+const encodeFile = Path.join(__dirname, 'encode-file', 'encode-file');
+if (!fs.existsSync(encodeFile)) {
+    execSync(`g++ -O3 -march=native -std=c++11 -pthread -o ${encodeFile} ${Path.join(__dirname, 'encode-file', 'main.cpp')}`);
+}
+console.log(execSync(`${encodeFile} --fragment-size ${FRAGMENT_SIZE} --redundancy ${redundancy} ${tempFilePath} ${tempFramesPath}`).toString('utf-8').trim());
 
 // calculate CRC64 hash
 const hash = crc64(fs.readFileSync(tempFilePath));
 console.log('CRC64 hash is', hash);
 
-const outfile = process.argv[3];
+const outfile = args[3];
 
-let header;
+// the frames are DataFragment commands: 0x08, the fragment number (little endian) and the payload
+let frames = fs.readFileSync(tempFramesPath);
 let fragments = [];
-
-for (let line of infile) {
-    if (line.indexOf('Fragmentation header likely') === 0) {
-        header = line.replace('Fragmentation header likely: ', '').match(/\b0x(\w\w)\b/g).map(n => parseInt(n));
-    }
-
-    else if (line.indexOf('[8, ') === 0) {
-        fragments.push(line.replace('[', '').replace(']', '').split(',').map(n => Number(n)));
-    }
+for (let offset = 0; offset < frames.length; offset += 3 + FRAGMENT_SIZE) {
+    fragments.push(Array.from(frames.slice(offset, offset + 3 + FRAGMENT_SIZE)));
 }
+fs.unlinkSync(tempFramesPath);
 
-// so the header format is wrong...
-header[1] = header[1] << 4;
-[header[2], header[3]] = [header[3], header[2]];
-
+// FragSessionSetupReq: FragSession, NbFrag (little endian), FragSize, Control, Padding
 let sz = fs.statSync(tempFilePath).size;
-if (sz % 204 === 0) {
-    header.push(0);
-}
-else {
-    header.push(204 - (sz % 204));
-}
+let numberOfFragments = Math.ceil(sz / FRAGMENT_SIZE);
+let header = [ 0x02, 0x10, numberOfFragments & 0xff, numberOfFragments >> 8, FRAGMENT_SIZE, 0x00,
+    numberOfFragments * FRAGMENT_SIZE - sz ];
 
-// also fragment header is wrong...
-for (let f of fragments) {
-    [f[1], f[2]] = [f[2], f[1]];
+if (replayPath) {
+    let replay = replayFile.createReplay({
+        numberOfFragments: (header[3] << 8) + header[2],
+        fragmentSize: header[4],
+        padding: header[6],
+        crc64: hash,
+        frames: fragments,
+        timestamps: interval !== null ? fragments.map((f, ix) => ix * Number(interval)) : null,
+        lossMasks: lossPaths.map(p => replayFile.parseLossCapture(fs.readFileSync(p, 'utf-8'), fragments))
+    });
+    fs.writeFileSync(replayPath, replay);
+
+    fs.unlinkSync(tempFilePath);
+    if (patchPath === tempPatchPath) {
+        fs.unlinkSync(tempPatchPath);
+    }
+
+    console.log('Done, written', fragments.length, 'frames to', replayPath);
+    process.exit(0);
 }
 
 let packetsData = `/*
@@ -112,5 +285,8 @@ uint64_t FAKE_PACKETS_CRC64_HASH = 0x${hash};
 fs.writeFileSync(Path.join(__dirname, '../src', 'packets.h'), packetsData, 'utf-8');
 
 fs.unlinkSync(tempFilePath);
+if (patchPath === tempPatchPath) {
+    fs.unlinkSync(tempPatchPath);
+}
 
 console.log('Done, written to packets.h')
@@ -0,0 +1,161 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef _FRAGMENTATION_ENCODER_H_
+#define _FRAGMENTATION_ENCODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// The generator and the XOR kernels of the device, so the parity frames match what the decoder expects
+#include "../../src/FragmentationMatrixLine.h"
+#include "../../src/FragmentationXor.h"
+
+// DataFragment command identifier, the first byte of every frame
+#define FRAG_ENCODER_DATA_FRAGMENT_CMD  0x08
+// Command identifier and the 2 byte index and N field
+#define FRAG_ENCODER_FRAME_HEADER_SIZE  3
+// The fragment number is 14 bits, the FragIndex takes the top 2 bits
+#define FRAG_ENCODER_MAX_FRAMES         0x3fff
+
+/**
+ * Host side encoder for the LoRaWAN fragmentation scheme: splits a package in fragments and adds redundancy frames, the
+ * XOR of the fragments selected by frag_matrix_line (the same generator as FragmentationDecoder on the device).
+ *
+ * Every redundancy frame is independent of the others, so they are spread over threads, each with its own matrix line.
+ * The frames are written as DataFragment commands: the command identifier, the fragment number (1-based) with the
+ * FragIndex in the top 2 bits (little endian), and the payload. The last fragment is padded with zeros.
+ */
+class FragmentationEncoder {
+public:
+    /**
+     * @param data The package
+     * @param size Size of the package
+     * @param fragment_size Payload bytes per frame
+     */
+    FragmentationEncoder(const uint8_t* data, size_t size, uint8_t fragment_size)
+        : _data(data), _size(size), _fragment_size(fragment_size),
+          _fragments((size + fragment_size - 1) / fragment_size)
+    {
+    }
+
+    size_t get_number_of_fragments() const {
+        return _fragments;
+    }
+
+    uint8_t get_fragment_size() const {
+        return _fragment_size;
+    }
+
+    /**
+     * Bytes of zeros after the package in the last fragment
+     */
+    uint8_t get_padding() const {
+        return _fragments * _fragment_size - _size;
+    }
+
+    size_t get_frame_size() const {
+        return FRAG_ENCODER_FRAME_HEADER_SIZE + _fragment_size;
+    }
+
+    /**
+     * Create all frames
+     *
+     * @param redundancy Number of redundancy frames after the fragments
+     * @param frag_index FragIndex of the session (0..3)
+     * @param frames Receives (fragments + redundancy) frames of get_frame_size() bytes
+     * @param threads Number of threads for the redundancy frames, 0 for one per core
+     * @returns false if there are more frames than fit in the fragment number
+     */
+    bool encode(uint16_t redundancy, uint8_t frag_index, std::vector<uint8_t>* frames, unsigned threads = 0) {
+        if (_fragment_size == 0 || _fragments == 0 || _fragments + redundancy > FRAG_ENCODER_MAX_FRAMES) {
+            return false;
+        }
+
+        size_t frame_size = get_frame_size();
+        frames->assign((_fragments + redundancy) * frame_size, 0);
+        uint8_t* out = frames->data();
+
+        for (size_t ix = 0; ix < _fragments + redundancy; ix++) {
+            uint16_t index = ((ix + 1) & FRAG_ENCODER_MAX_FRAMES) | (frag_index << 14);
+            out[ix * frame_size] = FRAG_ENCODER_DATA_FRAGMENT_CMD;
+            out[ix * frame_size + 1] = index & 0xff;
+            out[ix * frame_size + 2] = index >> 8;
+        }
+
+        // uncoded fragments, the padding stays zero
+        for (size_t ix = 0; ix < _fragments; ix++) {
+            size_t len = _size - ix * _fragment_size < _fragment_size ? _size - ix * _fragment_size : _fragment_size;
+            memcpy(out + ix * frame_size + FRAG_ENCODER_FRAME_HEADER_SIZE, _data + ix * _fragment_size, len);
+        }
+
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+        if (threads > redundancy) {
+            threads = redundancy ? redundancy : 1;
+        }
+
+        // the parity frames XOR the (padded) fragments from the output, contiguous blocks of lines per thread
+        std::vector<std::thread> workers;
+        for (unsigned tx = 1; tx < threads; tx++) {
+            workers.push_back(std::thread(&FragmentationEncoder::encode_lines, this, out,
+                                          redundancy * tx / threads, redundancy * (tx + 1) / threads));
+        }
+        encode_lines(out, 0, redundancy / threads);
+
+        for (size_t tx = 0; tx < workers.size(); tx++) {
+            workers[tx].join();
+        }
+
+        return true;
+    }
+
+private:
+    /**
+     * Redundancy frames [first, end), line numbers are 1-based
+     */
+    void encode_lines(uint8_t* out, size_t first, size_t end) const {
+        size_t frame_size = get_frame_size();
+        std::vector<frag_bits_t> line(frag_bits_words(_fragments));
+
+        for (size_t lx = first; lx < end; lx++) {
+            frag_matrix_line(lx + 1, _fragments, line.data());
+
+            uint8_t* parity = out + (_fragments + lx) * frame_size + FRAG_ENCODER_FRAME_HEADER_SIZE;
+            for (size_t wx = 0; wx < line.size(); wx++) {
+                for (frag_bits_t w = line[wx]; w != 0; w &= w - 1) {
+                    size_t fragment = wx * FRAG_BITS_PER_WORD + FRAG_BITS_CTZ(w);
+                    frag_xor(parity, out + fragment * frame_size + FRAG_ENCODER_FRAME_HEADER_SIZE, _fragment_size);
+                }
+            }
+        }
+    }
+
+    const uint8_t* _data;
+    size_t _size;
+    uint8_t _fragment_size;
+    size_t _fragments;
+};
+
+#endif // _FRAGMENTATION_ENCODER_H_
@@ -0,0 +1,146 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Splits a package in fragments and adds redundancy frames, with FragmentationEncoder.h.
+ *
+ *     $ g++ -O3 -march=native -std=c++11 -pthread -o encode-file main.cpp
+ *     $ ./encode-file [--fragment-size 204] [--redundancy 20] [--frag-index 0] [--threads n] [--check] package.bin frames.bin
+ *
+ * frames.bin holds the DataFragment commands back to back, the fragments first and then the redundancy frames, every
+ * one 3 + fragment size bytes. --check encodes again on one thread with the byte kernel and compares.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "FragmentationEncoder.h"
+
+static bool read_file(const char* path, std::vector<uint8_t>* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+
+    uint8_t buffer[4096];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data->insert(data->end(), buffer, buffer + len);
+    }
+    fclose(f);
+    return true;
+}
+
+/**
+ * Redundancy frames the slow way, one bit test and one byte XOR at a time, to check the threaded encode
+ */
+static bool check_frames(const std::vector<uint8_t>& frames, size_t fragments, size_t redundancy, size_t frame_size) {
+    size_t fragment_size = frame_size - FRAG_ENCODER_FRAME_HEADER_SIZE;
+    std::vector<frag_bits_t> line(frag_bits_words(fragments));
+    std::vector<uint8_t> parity(fragment_size);
+
+    for (size_t lx = 0; lx < redundancy; lx++) {
+        frag_matrix_line(lx + 1, fragments, line.data());
+
+        memset(parity.data(), 0, fragment_size);
+        for (size_t fx = 0; fx < fragments; fx++) {
+            if (frag_bits_get(line.data(), fx)) {
+                frag_xor_bytes(parity.data(), &frames[fx * frame_size + FRAG_ENCODER_FRAME_HEADER_SIZE], fragment_size);
+            }
+        }
+
+        if (memcmp(parity.data(), &frames[(fragments + lx) * frame_size + FRAG_ENCODER_FRAME_HEADER_SIZE], fragment_size)) {
+            fprintf(stderr, "Redundancy frame %u does not match\n", (unsigned)(lx + 1));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: encode-file [--fragment-size 204] [--redundancy 20] [--frag-index 0] [--threads n] [--check] package.bin frames.bin\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned fragment_size = 204;
+    unsigned redundancy = 20;
+    unsigned frag_index = 0;
+    unsigned threads = 0;
+    bool check = false;
+    std::vector<const char*> paths;
+
+    for (int ix = 1; ix < argc; ix++) {
+        if (strcmp(argv[ix], "--fragment-size") == 0 && ix + 1 < argc) {
+            fragment_size = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (strcmp(argv[ix], "--redundancy") == 0 && ix + 1 < argc) {
+            redundancy = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (strcmp(argv[ix], "--frag-index") == 0 && ix + 1 < argc) {
+            frag_index = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (strcmp(argv[ix], "--threads") == 0 && ix + 1 < argc) {
+            threads = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (strcmp(argv[ix], "--check") == 0) {
+            check = true;
+        }
+        else {
+            paths.push_back(argv[ix]);
+        }
+    }
+
+    if (paths.size() != 2 || fragment_size == 0 || fragment_size > 255 || frag_index > 3 || redundancy > FRAG_ENCODER_MAX_FRAMES) {
+        usage();
+        return 1;
+    }
+
+    std::vector<uint8_t> package;
+    if (!read_file(paths[0], &package)) {
+        fprintf(stderr, "Could not read %s\n", paths[0]);
+        return 1;
+    }
+
+    FragmentationEncoder encoder(package.data(), package.size(), fragment_size);
+    std::vector<uint8_t> frames;
+
+    auto start = std::chrono::steady_clock::now();
+    if (!encoder.encode(redundancy, frag_index, &frames, threads)) {
+        fprintf(stderr, "%u fragments and %u redundancy frames do not fit in the fragment number (max. %u frames)\n",
+            (unsigned)encoder.get_number_of_fragments(), redundancy, FRAG_ENCODER_MAX_FRAMES);
+        return 1;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (check && !check_frames(frames, encoder.get_number_of_fragments(), redundancy, encoder.get_frame_size())) {
+        return 1;
+    }
+
+    FILE* f = fopen(paths[1], "wb");
+    if (!f || fwrite(frames.data(), 1, frames.size(), f) != frames.size()) {
+        fprintf(stderr, "Could not write %s\n", paths[1]);
+        return 1;
+    }
+    fclose(f);
+
+    printf("Encoded %u fragments of %u bytes (padding %u) and %u redundancy frames in %.1f ms (%s kernel)\n",
+        (unsigned)encoder.get_number_of_fragments(), fragment_size, encoder.get_padding(), redundancy,
+        us / 1000.0, frag_xor_kernel_name());
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * Replay files for FragmentationReplay.h (src/): the frames of a package with the session opts and the CRC64, and
+ * optionally a timestamp per frame and masks of frames that were lost in captured sessions. Little endian throughout.
+ */
+
+const MAGIC = 0x4c505246; // 'FRPL'
+const VERSION = 1;
+const HEADER_SIZE = 48;
+
+function align(n, to) {
+    return Math.ceil(n / to) * to;
+}
+
+/**
+ * @param replay.numberOfFragments Number of uncoded fragments
+ * @param replay.fragmentSize Size of a fragment
+ * @param replay.padding Padding in the last fragment
+ * @param replay.crc64 CRC64 of the package, as a hex string
+ * @param replay.frames Array of frames (arrays or Buffers, the DataFragment command), all the same size
+ * @param replay.timestamps Optional, ms since the first frame for every frame
+ * @param replay.lossMasks Optional, arrays with a boolean (lost) for every frame
+ */
+function createReplay(replay) {
+    const frameCount = replay.frames.length;
+    const frameSize = replay.frames[0].length;
+    const lossMasks = replay.lossMasks || [];
+    const maskSize = Math.ceil(frameCount / 8);
+
+    if (replay.frames.some(f => f.length !== frameSize)) {
+        throw new Error('Frames are not all the same size');
+    }
+
+    const framesOffset = align(HEADER_SIZE, 8);
+    let end = framesOffset + frameCount * frameSize;
+    const timestampsOffset = replay.timestamps ? align(end, 4) : 0;
+    if (replay.timestamps) end = timestampsOffset + frameCount * 4;
+    const lossMasksOffset = lossMasks.length ? end : 0;
+    end += lossMasks.length * maskSize;
+
+    let file = Buffer.alloc(end);
+    file.writeUInt32LE(MAGIC, 0);
+    file.writeUInt16LE(VERSION, 4);
+    file.writeUInt16LE(HEADER_SIZE, 6);
+    file.writeUInt32LE(file.length, 8);
+    file.writeUInt16LE(replay.numberOfFragments, 12);
+    file.writeUInt8(replay.fragmentSize, 14);
+    file.writeUInt8(replay.padding, 15);
+    file.writeUInt32LE(frameCount, 16);
+    file.writeUInt16LE(frameSize, 20);
+    file.writeUInt16LE(lossMasks.length, 22);
+    Buffer.from(replay.crc64.padStart(16, '0'), 'hex').reverse().copy(file, 24);
+    file.writeUInt32LE(framesOffset, 32);
+    file.writeUInt32LE(timestampsOffset, 36);
+    file.writeUInt32LE(lossMasksOffset, 40);
+
+    replay.frames.forEach((f, ix) => Buffer.from(f).copy(file, framesOffset + ix * frameSize));
+
+    if (replay.timestamps) {
+        replay.timestamps.forEach((t, ix) => file.writeUInt32LE(t, timestampsOffset + ix * 4));
+    }
+
+    lossMasks.forEach((mask, mx) => {
+        mask.forEach((lost, ix) => {
+            if (lost) file[lossMasksOffset + mx * maskSize + (ix >> 3)] |= 1 << (ix & 7);
+        });
+    });
+
+    return file;
+}
+
+/**
+ * Loss mask from a capture: the frame counters (the index in the DataFragment command) of the frames that were lost,
+ * separated by whitespace or commas, lines starting with # are ignored
+ */
+function parseLossCapture(text, frames) {
+    let lost = new Set(text.split('\n')
+        .filter(l => l.trim()[0] !== '#')
+        .join(' ')
+        .split(/[\s,]+/)
+        .filter(n => n.length)
+        .map(n => parseInt(n)));
+
+    return frames.map(f => lost.has(((f[2] << 8) | f[1]) & 0x3fff));
+}
+
+module.exports = { createReplay: createReplay, parseLossCapture: parseLossCapture };
@@ -0,0 +1,472 @@
+/*
+* PackageLicenseDeclared: Apache-2.0
+* Copyright (c) 2018 ARM Limited
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Verifies packages the way the device does after a session completes, so they can be checked before they are sent.
+ *
+ *     $ gcc -O2 -I../../update-client-hub-common -c ../../update-client-hub-common/source/arm_uc_utilities.c
+ *     $ g++ -O2 -std=c++11 -pthread -I../../src -I../../update-client-hub-common -o verify-package main.cpp \
+ *           arm_uc_utilities.o -lmbedcrypto
+ *     $ ./verify-package [--pubkey <hex>] [--firmware-key <hex>] [--old old_application.bin] [--threads n] package.bin...
+ *
+ * Every package is mapped and gets the CRC64 over the whole package (FragmentationCrc.h, what the network compares),
+ * then the firmware is decrypted, decompressed and patched as needed, and the SHA256 of the new firmware is checked
+ * against the signature with FragmentationEcdsa.h. Decompressing, patching and the CRCs use the same code as the device
+ * (FragmentationDecompressCore.h, FragmentationPatchCore.h, arm_uc_crc32). The keys and the UUIDs come from
+ * src/UpdateCerts.h. Packages are verified in parallel, one line per package, and the exit code is 1 if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mbedtls/aes.h"
+#include "mbedtls/sha256.h"
+#include "update-client-common/arm_uc_utilities.h"
+#include "FragmentationCrc.h"
+#include "FragmentationDecompressCore.h"
+#include "FragmentationEcdsa.h"
+#include "FragmentationPatchCore.h"
+#include "update_params.h"
+#include "UpdateCerts.h"
+
+// Window of the decompressor and page buffer of the patcher on the device (DECOMPRESS_WINDOW_SIZE and
+// PATCH_PAGE_SIZE in main.cpp)
+#define DEVICE_DECOMPRESS_WINDOW    512
+#define DEVICE_PATCH_PAGE           528
+
+struct Options {
+    uint8_t pubkey[FRAG_ECDSA_RAW_KEY_LENGTH];
+    uint8_t firmware_key[32];
+    std::vector<uint8_t> old_image;
+    bool has_old;
+};
+
+struct Result {
+    bool ok;
+    uint64_t crc64;
+    unsigned char sha256[32];
+    std::string info;               // how the package was built, or why it failed
+};
+
+/**
+ * Read-only mapping of a file
+ */
+class MappedFile {
+public:
+    MappedFile() : _data(NULL), _size(0)
+    {
+    }
+
+    ~MappedFile() {
+        if (_data) munmap((void*)_data, _size);
+    }
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        _size = st.st_size;
+
+        // an empty file can't be mapped, it's left as an empty package
+        if (_size > 0) {
+            void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            _data = (const uint8_t*)data;
+            madvise(data, _size, MADV_SEQUENTIAL);
+        }
+
+        ::close(fd);
+        return true;
+    }
+
+    const uint8_t* data() const {
+        return _data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+private:
+    const uint8_t* _data;
+    size_t _size;
+};
+
+static bool read_file(const char* path, std::vector<uint8_t>* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+
+    uint8_t buffer[4096];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data->insert(data->end(), buffer, buffer + len);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool parse_hex(const char* hex, uint8_t* out, size_t len) {
+    if (strlen(hex) != len * 2) return false;
+
+    for (size_t ix = 0; ix < len; ix++) {
+        char byte[3] = { hex[ix * 2], hex[ix * 2 + 1], 0 };
+        char* end;
+        out[ix] = strtoul(byte, &end, 16);
+        if (*end != 0) return false;
+    }
+    return true;
+}
+
+/**
+ * FragmentationDecompressCore over data in memory, with the window of the device
+ */
+class MemoryDecompress : public FragmentationDecompressCore {
+public:
+    MemoryDecompress(const uint8_t* data, size_t size, std::vector<uint8_t>* out)
+        : FragmentationDecompressCore(_window_buffer, sizeof(_window_buffer)), _data(data), _size(size), _out(out)
+    {
+    }
+
+protected:
+    virtual FragmentationDecompressResult refill(const uint8_t** data, size_t* size) {
+        *data = _data;
+        *size = _size;
+        _size = 0;
+        return FRAG_DECOMPRESS_OK;
+    }
+
+    virtual FragmentationDecompressResult flush(const uint8_t* data, size_t size) {
+        _out->insert(_out->end(), data, data + size);
+        return FRAG_DECOMPRESS_OK;
+    }
+
+private:
+    uint8_t _window_buffer[DEVICE_DECOMPRESS_WINDOW];
+    const uint8_t* _data;
+    size_t _size;
+    std::vector<uint8_t>* _out;
+};
+
+/**
+ * FragmentationPatchCore over a patch in memory, with the page size of the device
+ */
+class MemoryPatch : public FragmentationPatchCore {
+public:
+    MemoryPatch(const uint8_t* patch, size_t size, std::vector<uint8_t>* out)
+        : FragmentationPatchCore(_page_buffer, sizeof(_page_buffer)), _patch(patch), _size(size), _out(out)
+    {
+    }
+
+protected:
+    virtual FragmentationPatchResult refill(const uint8_t** data, size_t* size) {
+        *data = _patch;
+        *size = _size;
+        _size = 0;
+        return FRAG_PATCH_OK;
+    }
+
+    virtual FragmentationPatchResult flush(const uint8_t* data, size_t size) {
+        _out->insert(_out->end(), data, data + size);
+        return FRAG_PATCH_OK;
+    }
+
+private:
+    uint8_t _page_buffer[DEVICE_PATCH_PAGE];
+    const uint8_t* _patch;
+    size_t _size;
+    std::vector<uint8_t>* _out;
+};
+
+static bool fail(Result* result, const char* reason) {
+    result->ok = false;
+    result->info = reason;
+    return false;
+}
+
+/**
+ * Everything the device checks once the package is in flash, in the same order
+ */
+static bool verify(const Options& options, const uint8_t* package, size_t size, Result* result) {
+    result->crc64 = frag_crc64_update(0, package, size);
+    memset(result->sha256, 0, sizeof(result->sha256));
+
+    if (size < FOTA_SIGNATURE_LENGTH) {
+        return fail(result, "too small for a signature");
+    }
+
+    // the signature block is at the start (a head manifest) or at the end (the trailer)
+    UpdateManifest_t manifest;
+    UpdateSignature_t header;
+    bool head_manifest = false;
+    if (size >= FOTA_MANIFEST_LENGTH) {
+        memcpy(&manifest, package, FOTA_MANIFEST_LENGTH);
+        head_manifest = manifest.magic == FOTA_MANIFEST_MAGIC
+            && manifest.crc32 == arm_uc_crc32((const uint8_t*)&manifest, offsetof(UpdateManifest_t, crc32));
+    }
+
+    const uint8_t* firmware;
+    size_t firmware_size;
+    if (head_manifest) {
+        header = manifest.signature;
+        firmware = package + FOTA_MANIFEST_LENGTH;
+        firmware_size = size - FOTA_MANIFEST_LENGTH;
+        result->info = "head manifest";
+    }
+    else {
+        memcpy(&header, package + size - FOTA_SIGNATURE_LENGTH, FOTA_SIGNATURE_LENGTH);
+        firmware = package;
+        firmware_size = size - FOTA_SIGNATURE_LENGTH;
+        result->info = "trailer";
+    }
+
+    if (memcmp(header.manufacturer_uuid, UPDATE_CERT_MANUFACTURER_UUID, 16) != 0) {
+        return fail(result, "manufacturer UUID does not match");
+    }
+    if (memcmp(header.device_class_uuid, UPDATE_CERT_DEVICE_CLASS_UUID, 16) != 0) {
+        return fail(result, "device class UUID does not match");
+    }
+
+    uint8_t flags = ((uint8_t*)&header.diff_info)[0];
+    bool raw_signature = header.signature_length == (FOTA_SIGNATURE_RAW | FRAG_ECDSA_RAW_SIG_LENGTH);
+
+    // the firmware is rebuilt in steps, `image` points at the current one
+    std::vector<uint8_t> plaintext, inflated, patched;
+    const uint8_t* image = firmware;
+    size_t image_size = firmware_size;
+
+    if (flags & FOTA_DIFF_FLAG_ENCRYPTED) {
+        if (!raw_signature) {
+            return fail(result, "encrypted firmware needs a raw signature");
+        }
+
+        // counter block is nonce || 64 bits block counter, starting at 0
+        unsigned char counter[16] = { 0 };
+        unsigned char stream_block[16];
+        size_t nc_off = 0;
+        memcpy(counter, header.signature + FRAG_ECDSA_RAW_SIG_LENGTH, FOTA_NONCE_LENGTH);
+
+        plaintext.resize(image_size);
+        mbedtls_aes_context aes;
+        mbedtls_aes_init(&aes);
+        int r = mbedtls_aes_setkey_enc(&aes, options.firmware_key, 256);
+        if (r == 0 && image_size > 0) {
+            r = mbedtls_aes_crypt_ctr(&aes, image_size, &nc_off, counter, stream_block, image, plaintext.data());
+        }
+        mbedtls_aes_free(&aes);
+        if (r != 0) {
+            return fail(result, "decryption failed");
+        }
+
+        image = plaintext.data();
+        result->info += ", encrypted";
+    }
+
+    if (flags & FOTA_DIFF_FLAG_COMPRESSED) {
+        size_t inflated_size;
+        MemoryDecompress decompress(image, image_size, &inflated);
+        FragmentationDecompressResult r = decompress.inflate(SIZE_MAX, &inflated_size);
+        if (r == FRAG_DECOMPRESS_WINDOW) {
+            return fail(result, "compressed with a larger window than the device has");
+        }
+        if (r != FRAG_DECOMPRESS_OK) {
+            return fail(result, "compressed data is corrupt");
+        }
+
+        image = inflated.data();
+        image_size = inflated.size();
+        result->info += ", compressed";
+    }
+
+    if (flags & FOTA_DIFF_FLAG_DIFF) {
+        size_t old_size = (((uint8_t*)&header.diff_info)[1] << 16) | (((uint8_t*)&header.diff_info)[2] << 8)
+                        | ((uint8_t*)&header.diff_info)[3];
+        if (!options.has_old) {
+            return fail(result, "delta update, the old image is needed (--old)");
+        }
+        if (old_size != options.old_image.size()) {
+            return fail(result, "delta update against an old image of another size");
+        }
+
+        size_t patched_size;
+        MemoryPatch patch(image, image_size, &patched);
+        if (patch.apply(options.old_image.data(), options.old_image.size(), SIZE_MAX, &patched_size) != FRAG_PATCH_OK) {
+            return fail(result, "patch is corrupt");
+        }
+
+        image = patched.data();
+        image_size = patched.size();
+        result->info += ", delta";
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0 /* SHA-256 */);
+    mbedtls_sha256_update(&sha, image, image_size);
+    mbedtls_sha256_finish(&sha, result->sha256);
+    mbedtls_sha256_free(&sha);
+
+    FragmentationEcdsa ecdsa(options.pubkey);
+    FragmentationEcdsaResult ecdsa_result;
+    if (raw_signature) {
+        ecdsa_result = ecdsa.start_raw(result->sha256, header.signature);
+        result->info += ", raw signature";
+    }
+    else {
+        ecdsa_result = ecdsa.start(result->sha256, header.signature, header.signature_length);
+    }
+    if (ecdsa_result == FRAG_ECDSA_IN_PROGRESS) {
+        ecdsa_result = ecdsa.step();
+    }
+
+    if (ecdsa_result == FRAG_ECDSA_ERROR) {
+        return fail(result, "public key is not valid");
+    }
+    if (ecdsa_result != FRAG_ECDSA_VALID) {
+        return fail(result, "signature is not valid");
+    }
+
+    result->ok = true;
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: verify-package [--pubkey <hex>] [--firmware-key <hex>] [--old old_application.bin] [--threads n] package.bin...\n");
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    memcpy(options.pubkey, UPDATE_CERT_PUBKEY_RAW, sizeof(options.pubkey));
+    memcpy(options.firmware_key, UPDATE_CERT_FIRMWARE_KEY, sizeof(options.firmware_key));
+    options.has_old = false;
+
+    unsigned threads = 0;
+    std::vector<const char*> paths;
+
+    for (int ix = 1; ix < argc; ix++) {
+        if (strcmp(argv[ix], "--pubkey") == 0 && ix + 1 < argc) {
+            if (!parse_hex(argv[++ix], options.pubkey, sizeof(options.pubkey))) {
+                fprintf(stderr, "--pubkey needs the raw public key, X || Y in hex (128 characters)\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[ix], "--firmware-key") == 0 && ix + 1 < argc) {
+            if (!parse_hex(argv[++ix], options.firmware_key, sizeof(options.firmware_key))) {
+                fprintf(stderr, "--firmware-key needs the AES-256 key in hex (64 characters)\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[ix], "--old") == 0 && ix + 1 < argc) {
+            if (!read_file(argv[++ix], &options.old_image)) {
+                fprintf(stderr, "Could not read %s\n", argv[ix]);
+                return 1;
+            }
+            options.has_old = true;
+        }
+        else if (strcmp(argv[ix], "--threads") == 0 && ix + 1 < argc) {
+            threads = strtoul(argv[++ix], NULL, 0);
+        }
+        else if (argv[ix][0] == '-' && argv[ix][1] == '-') {
+            usage();
+            return 1;
+        }
+        else {
+            paths.push_back(argv[ix]);
+        }
+    }
+
+    if (paths.empty()) {
+        usage();
+        return 1;
+    }
+
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (threads > paths.size()) {
+        threads = paths.size();
+    }
+
+    // every thread takes the next package until all are done, the results are printed in order
+    std::vector<Result> results(paths.size());
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t ix = next++; ix < paths.size(); ix = next++) {
+            MappedFile file;
+            if (!file.open(paths[ix])) {
+                results[ix].ok = false;
+                results[ix].crc64 = 0;
+                results[ix].info = "could not open";
+                continue;
+            }
+            verify(options, file.data(), file.size(), &results[ix]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned tx = 1; tx < threads; tx++) {
+        workers.push_back(std::thread(worker));
+    }
+    worker();
+
+    for (size_t tx = 0; tx < workers.size(); tx++) {
+        workers[tx].join();
+    }
+
+    size_t failed = 0;
+    for (size_t ix = 0; ix < paths.size(); ix++) {
+        const Result& result = results[ix];
+        if (!result.ok) {
+            printf("%s: FAIL, %s\n", paths[ix], result.info.c_str());
+            failed++;
+            continue;
+        }
+
+        printf("%s: OK crc64 %016llx sha256 ", paths[ix], (unsigned long long)result.crc64);
+        for (size_t bx = 0; bx < 32; bx++) {
+            printf("%02x", result.sha256[bx]);
+        }
+        printf(" (%s)\n", result.info.c_str());
+    }
+
+    if (paths.size() > 1) {
+        fflush(stdout);
+        fprintf(stderr, "%u of %u packages verified\n", (unsigned)(paths.size() - failed), (unsigned)paths.size());
+    }
+
+    return failed ? 1 : 0;
+}
@@ -85,9 +85,34 @@ void test_strnstren()
     TEST_ASSERT_EQUAL('5', input[index]);
 }
 
+void test_crc32()
+{
+    const uint8_t check[] = "123456789";
+
+    /* standard check value for CRC-32 (IEEE 802.3) */
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, arm_uc_crc32(check, 9));
+    TEST_ASSERT_EQUAL_HEX32(0, arm_uc_crc32(check, 0));
+
+    uint8_t buffer[300];
+    for (uint32_t index = 0; index < sizeof(buffer); index++)
+    {
+        buffer[index] = index * 31 + 7;
+    }
+
+    /* CRC in chunks, split at every position, equals the CRC in one go */
+    uint32_t expected = arm_uc_crc32(buffer, sizeof(buffer));
+    for (uint32_t split = 0; split <= sizeof(buffer); split++)
+    {
+        uint32_t crc = arm_uc_crc32_update(0, buffer, split);
+        crc = arm_uc_crc32_update(crc, buffer + split, sizeof(buffer) - split);
+        TEST_ASSERT_EQUAL_HEX32(expected, crc);
+    }
+}
+
 Case cases[] = {
     Case("test_str_to_uri", test_str_to_uri),
     Case("test_strnstren", test_strnstren),
+    Case("test_crc32", test_crc32),
 };
 
 Specification specification(cases, verbose_continue_handlers);
@@ -309,7 +309,7 @@ arm_uc_error_t ARM_UC_cryptoHashFinish(arm_uc_mdHandle_t* hDigest, arm_uc_buffer
     return result;
 }
 
-#if 0
+#if defined(MBEDTLS_AES_C) && defined(MBEDTLS_CIPHER_MODE_CTR)
 
 arm_uc_error_t ARM_UC_cryptoDecryptSetup(arm_uc_cipherHandle_t* hCipher, arm_uc_buffer_t* key, arm_uc_buffer_t* iv, int32_t aesKeySize)
 {
@@ -352,34 +352,54 @@ arm_uc_error_t ARM_UC_cryptoDecryptSetup(arm_uc_cipherHandle_t* hCipher, arm_uc_
 
 arm_uc_error_t ARM_UC_cryptoDecryptUpdate(arm_uc_cipherHandle_t* hCipher, const uint8_t* input_ptr, uint32_t input_size, arm_uc_buffer_t* output)
 {
-    arm_uc_error_t result = (arm_uc_error_t){ ARM_UC_CU_ERR_INVALID_PARAMETER };
-    size_t data_size = input_size < output->size_max ? input_size : output->size_max;
-    output->size = 0;
-    int mbedtls_result = mbedtls_aes_crypt_ctr(
-        &hCipher->aes_context,
-        data_size,
-        &hCipher->aes_nc_off,
-        hCipher->aes_iv,
-        hCipher->aes_partial,
-        input_ptr,
-        output->ptr
+    uint32_t data_size = input_size < output->size_max ? input_size : output->size_max;
+    const uint8_t* input = input_ptr;
+    uint8_t* out = output->ptr;
+    uint32_t left = data_size;
 
-    );
-    if (mbedtls_result == 0)
+    /* use up the keystream that is left over from the previous call */
+    while ((left > 0) && (hCipher->aes_nc_off != 0))
     {
-        result = (arm_uc_error_t){ ARM_UC_CU_ERR_NONE };
-        output->size = data_size;
+        *out++ = *input++ ^ hCipher->aes_partial[hCipher->aes_nc_off];
+        hCipher->aes_nc_off = (hCipher->aes_nc_off + 1) & 0x0F;
+        left--;
     }
-    return result;
+
+    /* whole blocks go through the batched keystream engine, see arm_uc_aes_ctr.c */
+    uint32_t blocks = left / 16;
+    arm_uc_aes_ctr_blocks(&hCipher->aes_context, hCipher->aes_iv, blocks, input, out);
+    input += blocks * 16;
+    out += blocks * 16;
+    left -= blocks * 16;
+
+    /* keep the keystream of the last block for the next call, same state as mbedtls_aes_crypt_ctr */
+    if (left > 0)
+    {
+        memset(hCipher->aes_partial, 0, 16);
+        arm_uc_aes_ctr_blocks(&hCipher->aes_context, hCipher->aes_iv, 1, hCipher->aes_partial, hCipher->aes_partial);
+
+        for (uint32_t index = 0; index < left; index++)
+        {
+            out[index] = input[index] ^ hCipher->aes_partial[index];
+        }
+        hCipher->aes_nc_off = left;
+    }
+
+    output->size = data_size;
+    return (arm_uc_error_t){ARM_UC_CU_ERR_NONE};
 }
 
 arm_uc_error_t ARM_UC_cryptoDecryptFinish(arm_uc_cipherHandle_t* hCipher, arm_uc_buffer_t* output)
 {
     (void) output;
+
+    /* CTR mode has no padding, there is nothing left to output */
+    mbedtls_aes_free(&hCipher->aes_context);
+
     return (arm_uc_error_t){ARM_UC_CU_ERR_NONE};
 }
 
-#endif
+#endif // MBEDTLS_AES_C && MBEDTLS_CIPHER_MODE_CTR
 
 arm_uc_error_t ARM_UC_cryptoHMACSHA256(arm_uc_buffer_t* key,
                                        arm_uc_buffer_t* input,
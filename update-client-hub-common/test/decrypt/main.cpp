@@ -30,6 +30,12 @@ using namespace utest::v1;
 #include "update-client-common/arm_uc_crypto.h"
 #include "../alice.h"
 
+#if defined(TARGET_LIKE_MBED)
+#include "mbed.h"
+#else
+#include <time.h>
+#endif
+
 #define MIN_SIZE (16)
 
 arm_uc_cipherHandle_t cipherHandle;
@@ -94,7 +100,7 @@ void test_unit()
                                                   output.size,
                                                   "decryption failed");
 
-            if (result.error == ERR_NONE)
+            if (result.error == ARM_UC_CU_ERR_NONE)
             {
                 index += output.size;
             }
@@ -117,8 +123,81 @@ void test_unit()
     printf("done\r\n");
 }
 
+/* microseconds since the first call */
+static uint32_t elapsed_us()
+{
+#if defined(TARGET_LIKE_MBED)
+    static Timer timer;
+    timer.start();
+    return timer.read_us();
+#else
+    return (uint32_t)((uint64_t) clock() * 1000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+static uint8_t bench_output[sizeof(ecila)];
+
+/* decrypt all of ecila in `block_size` steps, with the hub or with mbedtls_aes_crypt_ctr */
+static uint32_t bench_decrypt(uint32_t block_size, bool use_mbedtls)
+{
+    uint8_t nc_copy[16];
+    memcpy(nc_copy, nc, sizeof(nc));
+
+    arm_uc_buffer_t keyBuffer = { 32, 32, (uint8_t*) key };
+    arm_uc_buffer_t ivBuffer = { 16, 16, nc_copy };
+    ARM_UC_cryptoDecryptSetup(&cipherHandle, &keyBuffer, &ivBuffer, 256);
+    memset(bench_output, 0, sizeof(bench_output));
+
+    uint32_t start = elapsed_us();
+    for (size_t index = 0; index < sizeof(ecila); index += block_size)
+    {
+        uint32_t size = index + block_size > sizeof(ecila) ? sizeof(ecila) - index : block_size;
+
+        if (use_mbedtls)
+        {
+            mbedtls_aes_crypt_ctr(&cipherHandle.aes_context, size, &cipherHandle.aes_nc_off, nc_copy,
+                                  cipherHandle.aes_partial, &ecila[index], &bench_output[index]);
+        }
+        else
+        {
+            arm_uc_buffer_t output = { size, 0, &bench_output[index] };
+            ARM_UC_cryptoDecryptUpdate(&cipherHandle, &ecila[index], size, &output);
+        }
+    }
+    uint32_t time_us = elapsed_us() - start;
+
+    ARM_UC_cryptoDecryptFinish(&cipherHandle, NULL);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(alice, bench_output, sizeof(alice), "decryption failed");
+
+    return time_us;
+}
+
+static uint32_t kb_per_s(uint32_t time_us)
+{
+    return time_us ? (uint32_t)((uint64_t) sizeof(ecila) * 1000000 / time_us / 1024) : 0;
+}
+
+void test_benchmark()
+{
+    /* from the range of test_init */
+    const uint32_t block_sizes[] = { 17, 64, 128, 204, 256, 528, 999 };
+
+    printf("AES-256-CTR over %u bytes, engine %s\r\n", (unsigned) sizeof(ecila), arm_uc_aes_ctr_engine_name());
+    printf("block size | mbedtls_aes_crypt_ctr | ARM_UC_cryptoDecryptUpdate\r\n");
+
+    for (size_t ix = 0; ix < sizeof(block_sizes) / sizeof(block_sizes[0]); ix++)
+    {
+        uint32_t mbedtls_us = bench_decrypt(block_sizes[ix], true);
+        uint32_t engine_us = bench_decrypt(block_sizes[ix], false);
+
+        printf("%10" PRIu32 " | %14" PRIu32 " KB/s | %21" PRIu32 " KB/s\r\n",
+               block_sizes[ix], kb_per_s(mbedtls_us), kb_per_s(engine_us));
+    }
+}
+
 Case cases[] = {
-    Case("test_init", test_unit)
+    Case("test_init", test_unit),
+    Case("test_benchmark", test_benchmark)
 };
 
 utest::v1::status_t greentea_setup(const size_t number_of_cases)
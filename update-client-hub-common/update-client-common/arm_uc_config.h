@@ -65,6 +65,40 @@
 // NOTE: The charset must be sorted except for the trailing character which is used as a padding character.
 #define MBED_CLOUD_UPDATE_BASE64_CHARSET "0123456789@ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz-"
 
+/* Lookup table used by arm_uc_crc32, trading flash for speed:
+   0    - bit by bit, no table
+   16   - one entry per nibble, 64 bytes
+   256  - one entry per byte, 1 KiB
+   1024 - slicing-by-4, four bytes per step, 4 KiB
+*/
+#ifndef ARM_UC_CRC32_TABLE_SIZE
+#define ARM_UC_CRC32_TABLE_SIZE 256
+#endif
+
+#if (ARM_UC_CRC32_TABLE_SIZE != 0) && (ARM_UC_CRC32_TABLE_SIZE != 16) && \
+    (ARM_UC_CRC32_TABLE_SIZE != 256) && (ARM_UC_CRC32_TABLE_SIZE != 1024)
+#error ARM_UC_CRC32_TABLE_SIZE must be 0, 16, 256 or 1024
+#endif
+
+/* Keystream engine used by ARM_UC_cryptoDecryptUpdate (AES-CTR, not with PAL crypto):
+   0 - one mbedtls_aes_crypt_ecb call per block, works with any AES implementation (MBEDTLS_AES_ALT always uses this)
+   1 - T-table on the mbed TLS key schedule, 1.25 KiB of tables on top of the ones in mbed TLS, so only select it when
+       the decrypt benchmark in TESTS/fragmentation shows the gain is worth the flash on the target
+   2 - AES-NI with four blocks in flight, needs -maes (the default when __AES__ is defined)
+   1 and 2 read the key schedule of mbed TLS 2, with mbed TLS 3 (private context) 0 is always used
+*/
+#ifndef ARM_UC_AES_CTR_ENGINE
+#if defined(__AES__) && defined(__SSE2__)
+#define ARM_UC_AES_CTR_ENGINE 2
+#else
+#define ARM_UC_AES_CTR_ENGINE 0
+#endif
+#endif
+
+#if (ARM_UC_AES_CTR_ENGINE < 0) || (ARM_UC_AES_CTR_ENGINE > 2)
+#error ARM_UC_AES_CTR_ENGINE must be 0, 1 or 2
+#endif
+
 #ifndef ARM_UC_SCHEDULER_STORAGE_POOL_SIZE
 #define ARM_UC_SCHEDULER_STORAGE_POOL_SIZE 32
 #endif
@@ -64,6 +64,30 @@ typedef struct arm_uc_cipherHandle_t {
 
 #define ARM_UC_CU_SHA256 MBEDTLS_MD_SHA256
 
+/**
+ * @brief Encrypt or decrypt whole blocks in AES-CTR mode
+ * @details Generates the keystream for `blocks` consecutive counter blocks and XORs it into
+ *          the data, with the engine selected by ARM_UC_AES_CTR_ENGINE. The counter is
+ *          incremented once per block, as a 128 bit big endian number, the same as
+ *          mbedtls_aes_crypt_ctr does. `input` and `output` may be the same buffer.
+ *
+ * @param ctx     AES context, with an encryption key schedule (mbedtls_aes_setkey_enc).
+ * @param counter Counter block, updated to the block after the last one.
+ * @param blocks  Number of 16 byte blocks.
+ * @param input   Input data, `blocks` * 16 bytes.
+ * @param output  Output data, `blocks` * 16 bytes.
+ */
+void arm_uc_aes_ctr_blocks(mbedtls_aes_context* ctx,
+                           uint8_t counter[16],
+                           uint32_t blocks,
+                           const uint8_t* input,
+                           uint8_t* output);
+
+/**
+ * @brief Name of the AES-CTR engine that was built in
+ */
+const char* arm_uc_aes_ctr_engine_name(void);
+
 #endif // ARM_UC_USE_PAL_CRYPTO
 
 /**
@@ -99,6 +99,22 @@ uint32_t arm_uc_str2uint32(const uint8_t* buffer,
  */
 uint32_t arm_uc_crc32(const uint8_t* buffer, uint32_t length);
 
+/**
+ * @brief Continue a CRC 32 with the next chunk of data.
+ * @details Allows a large region (e.g. on a block device) to be checked in
+ *          chunks. Start with 0, pass the result of the previous call for
+ *          every chunk. The result after the last chunk equals arm_uc_crc32
+ *          over the whole region. The lookup table is selected with
+ *          ARM_UC_CRC32_TABLE_SIZE.
+ *
+ * @param crc CRC of the data so far, 0 for the first chunk.
+ * @param buffer Input array.
+ * @param length Length of array in bytes.
+ *
+ * @return 32 bit CRC of the data so far, including this chunk.
+ */
+uint32_t arm_uc_crc32_update(uint32_t crc, const uint8_t* buffer, uint32_t length);
+
 /**
  * @brief Parse 4 byte array into uint32_t
  *